@@ -0,0 +1,115 @@
+#include "AllocationCount.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TIHEX_POSIX 1
+#endif
+
+namespace
+{
+    std::atomic<uint64_t> allocationCount(0);
+    std::atomic<uint64_t> allocationBytes(0);
+
+    /* Same as the library operator new: call the new handler until memory is found, null when there is none. */
+    void *allocate(size_t size)
+    {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        allocationBytes.fetch_add(size, std::memory_order_relaxed);
+        if(!size) size = 1;
+        for(;;){
+            void *p = std::malloc(size);
+            if(p) return p;
+            std::new_handler handler = std::get_new_handler();
+            if(!handler) return nullptr;
+            handler(); // Frees memory, throws std::bad_alloc or terminates.
+        }
+    }
+
+    void *allocateOrThrow(size_t size)
+    {
+        void *p = allocate(size);
+        if(!p) throw std::bad_alloc();
+        return p;
+    }
+
+    void *allocateOrNull(size_t size) noexcept
+    {
+        try{
+            return allocate(size);
+        }catch(...){
+            return nullptr;
+        }
+    }
+}
+
+uint64_t AllocationCount::count() {
+  return allocationCount.load(std::memory_order_relaxed);
+}
+
+uint64_t AllocationCount::bytes() {
+  return allocationBytes.load(std::memory_order_relaxed);
+}
+
+void *operator new(size_t size) { return allocateOrThrow(size); }
+void *operator new[](size_t size) { return allocateOrThrow(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return allocateOrNull(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return allocateOrNull(size); }
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+#endif
+
+#if defined(__cpp_aligned_new) && defined(TIHEX_POSIX)
+namespace
+{
+    void *allocateAligned(size_t size, std::align_val_t alignment)
+    {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        allocationBytes.fetch_add(size, std::memory_order_relaxed);
+        size_t bytes = static_cast<size_t>(alignment);
+        if(bytes < sizeof(void *)) bytes = sizeof(void *);
+        if(!size) size = 1;
+        for(;;){
+            void *p = nullptr;
+            if(posix_memalign(&p, bytes, size) == 0) return p;
+            std::new_handler handler = std::get_new_handler();
+            if(!handler) throw std::bad_alloc();
+            handler();
+        }
+    }
+
+    void *allocateAlignedOrNull(size_t size, std::align_val_t alignment) noexcept
+    {
+        try{
+            return allocateAligned(size, alignment);
+        }catch(...){
+            return nullptr;
+        }
+    }
+}
+
+void *operator new(size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment); }
+void *operator new[](size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment); }
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+  return allocateAlignedOrNull(size, alignment);
+}
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+  return allocateAlignedOrNull(size, alignment);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+#endif
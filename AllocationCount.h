@@ -0,0 +1,31 @@
+#ifndef ALLOCATIONCOUNT_H
+#define ALLOCATIONCOUNT_H
+
+/**
+ * @file AllocationCount.h
+ * @author Fabricio Ribeiro Toloczko
+ * @brief Heap allocations of the whole process, counted by replacing the global operator new. Linked into programs
+ * reporting them (tihex --stats, tihex_bench), never into the image library.
+ * Plain, array and nothrow forms are counted. Over-aligned forms (std::align_val_t) only exist from C++17 on: they are
+ * counted by C++17 builds on POSIX systems. malloc() calls are never counted.
+ *
+ * @copyright Copyright (c) 2022
+ * License: ZLib, see TIHex.h.
+ */
+
+#include <cstdint>
+
+namespace AllocationCount
+{
+    /**
+     * @brief Number of operator new calls so far, successful or not.
+     */
+    uint64_t count();
+
+    /**
+     * @brief Bytes asked for by operator new calls so far.
+     */
+    uint64_t bytes();
+}
+
+#endif
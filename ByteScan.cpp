@@ -0,0 +1,269 @@
+#include "ByteScan.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BYTESCAN_X86 1
+#include <immintrin.h>
+#endif
+
+static size_t mismatchScalar(const uint8_t *a, const uint8_t *b, size_t size) {
+  size_t i = 0;
+  // Whole words first: most compared bytes are equal.
+  for(; i + 8 <= size; i += 8){
+    uint64_t x, y;
+    std::memcpy(&x, a + i, 8);
+    std::memcpy(&y, b + i, 8);
+    if(x != y) break;
+  }
+  for(; i < size; i++){
+    if(a[i] != b[i]) return i;
+  }
+  return size;
+}
+
+static size_t matchScalar(const uint8_t *a, const uint8_t *b, size_t size) {
+  for(size_t i = 0; i < size; i++){
+    if(a[i] == b[i]) return i;
+  }
+  return size;
+}
+
+static size_t findPairScalar(const uint8_t *data, size_t size, uint8_t first, uint8_t second, size_t distance) {
+  for(size_t i = 0; i < size; i++){
+    const void *found = std::memchr(data + i, first, size - i);
+    if(!found) break;
+    i = static_cast<const uint8_t *>(found) - data;
+    if(data[i + distance] == second) return i;
+  }
+  return size;
+}
+
+#ifdef BYTESCAN_X86
+
+__attribute__((target("sse2")))
+static size_t mismatchSSE2(const uint8_t *a, const uint8_t *b, size_t size) {
+  size_t i = 0;
+  for(; i + 16 <= size; i += 16){
+    __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+    unsigned mask = _mm_movemask_epi8(equal) ^ 0xFFFF;
+    if(mask) return i + __builtin_ctz(mask);
+  }
+  return i + mismatchScalar(a + i, b + i, size - i);
+}
+
+__attribute__((target("sse2")))
+static size_t matchSSE2(const uint8_t *a, const uint8_t *b, size_t size) {
+  size_t i = 0;
+  for(; i + 16 <= size; i += 16){
+    __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+    unsigned mask = _mm_movemask_epi8(equal);
+    if(mask) return i + __builtin_ctz(mask);
+  }
+  return i + matchScalar(a + i, b + i, size - i);
+}
+
+__attribute__((target("sse2")))
+static size_t findPairSSE2(const uint8_t *data, size_t size, uint8_t first, uint8_t second, size_t distance) {
+  const __m128i firsts = _mm_set1_epi8(static_cast<char>(first));
+  const __m128i seconds = _mm_set1_epi8(static_cast<char>(second));
+  size_t i = 0;
+  for(; i + 16 <= size; i += 16){
+    __m128i found = _mm_and_si128(
+        _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)), firsts),
+        _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + distance)), seconds));
+    unsigned mask = _mm_movemask_epi8(found);
+    if(mask) return i + __builtin_ctz(mask);
+  }
+  return i + findPairScalar(data + i, size - i, first, second, distance);
+}
+
+__attribute__((target("avx2")))
+static size_t mismatchAVX2(const uint8_t *a, const uint8_t *b, size_t size) {
+  size_t i = 0;
+  // Two vectors per step, checked together: equal data is the common case.
+  for(; i + 64 <= size; i += 64){
+    __m256i equal0 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)),
+                                       _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)));
+    __m256i equal1 = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i + 32)),
+                                       _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i + 32)));
+    if(_mm256_movemask_epi8(_mm256_and_si256(equal0, equal1)) != -1){
+      unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(equal0));
+      if(mask){
+        _mm256_zeroupper();
+        return i + __builtin_ctz(mask);
+      }
+      mask = ~static_cast<unsigned>(_mm256_movemask_epi8(equal1));
+      _mm256_zeroupper();
+      return i + 32 + __builtin_ctz(mask);
+    }
+  }
+  _mm256_zeroupper(); // Avoid AVX to SSE transition penalties on the tail.
+  return i + mismatchSSE2(a + i, b + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static size_t matchAVX2(const uint8_t *a, const uint8_t *b, size_t size) {
+  size_t i = 0;
+  for(; i + 32 <= size; i += 32){
+    __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)),
+                                      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)));
+    unsigned mask = _mm256_movemask_epi8(equal);
+    if(mask){
+      _mm256_zeroupper();
+      return i + __builtin_ctz(mask);
+    }
+  }
+  _mm256_zeroupper(); // Avoid AVX to SSE transition penalties on the tail.
+  return i + matchSSE2(a + i, b + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static size_t findPairAVX2(const uint8_t *data, size_t size, uint8_t first, uint8_t second, size_t distance) {
+  const __m256i firsts = _mm256_set1_epi8(static_cast<char>(first));
+  const __m256i seconds = _mm256_set1_epi8(static_cast<char>(second));
+  size_t i = 0;
+  for(; i + 32 <= size; i += 32){
+    __m256i found = _mm256_and_si256(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)), firsts),
+        _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + distance)), seconds));
+    unsigned mask = _mm256_movemask_epi8(found);
+    if(mask){
+      _mm256_zeroupper();
+      return i + __builtin_ctz(mask);
+    }
+  }
+  _mm256_zeroupper(); // Avoid AVX to SSE transition penalties on the tail.
+  return i + findPairSSE2(data + i, size - i, first, second, distance);
+}
+
+#endif
+
+namespace
+{
+    struct Kernels
+    {
+        size_t (*mismatch)(const uint8_t *, const uint8_t *, size_t);
+        size_t (*match)(const uint8_t *, const uint8_t *, size_t);
+        size_t (*findPair)(const uint8_t *, size_t, uint8_t, uint8_t, size_t);
+        const char *name;
+    };
+
+    /* Selected once. TIHEX_ISA environment variable ("avx2", "sse2" or "scalar") may force a lower level. */
+    const Kernels &kernels()
+    {
+        static const Kernels selected = []() {
+            const char *forced = std::getenv("TIHEX_ISA");
+            bool allowAVX2 = !forced || !std::strcmp(forced, "avx2");
+            bool allowSSE2 = allowAVX2 || !std::strcmp(forced, "sse2");
+            (void)allowSSE2;
+#ifdef BYTESCAN_X86
+            __builtin_cpu_init();
+            if(allowAVX2 && __builtin_cpu_supports("avx2")) return Kernels{mismatchAVX2, matchAVX2, findPairAVX2, "avx2"};
+            if(allowSSE2 && __builtin_cpu_supports("sse2")) return Kernels{mismatchSSE2, matchSSE2, findPairSSE2, "sse2"};
+#endif
+            return Kernels{mismatchScalar, matchScalar, findPairScalar, "scalar"};
+        }();
+        return selected;
+    }
+}
+
+size_t ByteScan::mismatch(const uint8_t *a, const uint8_t *b, size_t size) {
+  return kernels().mismatch(a, b, size);
+}
+
+size_t ByteScan::match(const uint8_t *a, const uint8_t *b, size_t size) {
+  return kernels().match(a, b, size);
+}
+
+size_t ByteScan::findPair(const uint8_t *data, size_t size, uint8_t first, uint8_t second, size_t distance) {
+  return kernels().findPair(data, size, first, second, distance);
+}
+
+/* Patterns without fully significant bytes for findPair() are searched with Horspool from this length on: shorter
+ * ones can't skip much, checking every position is as fast. Where findPair() can be used, it goes through data faster
+ * than the skip table jumps over it, even on long patterns over data made of a few values. */
+static const size_t HORSPOOL_MIN_LENGTH = 4;
+
+ByteScan::Pattern::Pattern(const uint8_t *pattern, const uint8_t *mask, size_t length)
+    : __pattern(pattern, pattern + length), __mask(length, 0xFF) {
+  if(mask) __mask.assign(mask, mask + length);
+  for(size_t i = 0; i < length; i++) __pattern[i] &= __mask[i];
+
+  // Anchors are fully significant bytes, preferably other than the 00 and FF filling most images and holding two
+  // different values, so that runs of one value don't get through the filter.
+  auto rank = [&](size_t i) { return __mask[i] != 0xFF ? 0 : __pattern[i] == 0x00 || __pattern[i] == 0xFF ? 1 : 2; };
+  int best = 0;
+  for(size_t i = 0; i < length; i++){
+    if(rank(i) > best) best = rank(i), __first = i;
+  }
+  __anchored = best > 0;
+  __last = __first;
+  best = 0;
+  for(size_t i = length; __anchored && i-- > 0;){
+    int score = 2 * rank(i) + (__pattern[i] != __pattern[__first]);
+    if(i != __first && rank(i) && score > best) best = score, __last = i;
+  }
+  if(__last < __first) std::swap(__first, __last);
+
+  __horspool = !__anchored && length >= HORSPOOL_MIN_LENGTH;
+  if(!__horspool) return;
+  // How far the window may move on, given its last byte, up to the next place it could match.
+  for(auto &shift : __shift) shift = length;
+  for(size_t i = 0; i + 1 < length; i++){
+    if(__mask[i] == 0xFF){
+      __shift[__pattern[i]] = length - 1 - i;
+      continue;
+    }
+    for(unsigned value = 0; value < 256; value++){
+      if((value & __mask[i]) == __pattern[i]) __shift[value] = length - 1 - i;
+    }
+  }
+}
+
+size_t ByteScan::Pattern::find(const uint8_t *data, size_t size) const {
+  if(__pattern.empty() || size < __pattern.size()) return size;
+  if(__anchored) return findFiltered(data, size);
+  return __horspool ? findHorspool(data, size) : findScalar(data, size);
+}
+
+bool ByteScan::Pattern::matches(const uint8_t *data) const {
+  for(size_t i = 0; i < __pattern.size(); i++){
+    if((data[i] & __mask[i]) != __pattern[i]) return false;
+  }
+  return true;
+}
+
+size_t ByteScan::Pattern::findFiltered(const uint8_t *data, size_t size) const {
+  const size_t positions = size - __pattern.size() + 1;
+  for(size_t i = 0; i < positions; i++){
+    i += findPair(data + i + __first, positions - i, __pattern[__first], __pattern[__last], __last - __first);
+    if(i == positions) break;
+    if(matches(data + i)) return i;
+  }
+  return size;
+}
+
+size_t ByteScan::Pattern::findHorspool(const uint8_t *data, size_t size) const {
+  const size_t length = __pattern.size();
+  const uint8_t lastPattern = __pattern[length - 1], lastMask = __mask[length - 1];
+  for(size_t i = 0; i + length <= size; i += __shift[data[i + length - 1]]){
+    if((data[i + length - 1] & lastMask) == lastPattern && matches(data + i)) return i;
+  }
+  return size;
+}
+
+size_t ByteScan::Pattern::findScalar(const uint8_t *data, size_t size) const {
+  for(size_t i = 0; i + __pattern.size() <= size; i++){
+    if(matches(data + i)) return i;
+  }
+  return size;
+}
+
+const char *ByteScan::isa() {
+  return kernels().name;
+}
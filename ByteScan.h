@@ -0,0 +1,91 @@
+#ifndef BYTESCAN_H
+#define BYTESCAN_H
+
+/**
+ * @file ByteScan.h
+ * @author Fabricio Ribeiro Toloczko
+ * @brief Byte comparison kernels used by TIHex::diff(): where two buffers start and stop differing, and by
+ * TIHex::find(): where a byte pattern, with masks, occurs.
+ * SSE2 and AVX2 versions are picked at runtime, falling back to portable code, as for HexCodec.
+ *
+ * @copyright Copyright (c) 2022
+ * License: ZLib, see TIHex.h.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ByteScan
+{
+    /**
+     * @brief Find the first position where two buffers differ.
+     *
+     * @param a size bytes.
+     * @param b size bytes.
+     * @param size number of bytes to compare.
+     * @return offset of the first differing byte, size when all bytes are equal.
+     */
+    size_t mismatch(const uint8_t *a, const uint8_t *b, size_t size);
+
+    /**
+     * @brief Find the first position where two buffers hold the same byte, i.e. the end of a run of differences.
+     *
+     * @return offset of the first equal byte, size when all bytes differ.
+     */
+    size_t match(const uint8_t *a, const uint8_t *b, size_t size);
+
+    /**
+     * @brief Find the first position holding first, with second distance bytes after it.
+     *
+     * @param data size + distance bytes.
+     * @param size number of positions to check.
+     * @return offset of the first such position, size when there is none.
+     */
+    size_t findPair(const uint8_t *data, size_t size, uint8_t first, uint8_t second, size_t distance);
+
+    /**
+     * @brief Byte pattern where each byte only has to match on the bits of its mask: 00 for any value, F0 for the upper
+     * nibble only. Candidates come from findPair() on two fully significant bytes, far apart, or from a Horspool skip
+     * table, built from the masked bytes, for patterns without such bytes.
+     */
+    class Pattern
+    {
+    public:
+        /**
+         * @param pattern length bytes.
+         * @param mask length bytes, null when all bits are significant.
+         */
+        Pattern(const uint8_t *pattern, const uint8_t *mask, size_t length);
+
+        /**
+         * @brief Find the first occurrence.
+         *
+         * @param data size bytes.
+         * @param size number of bytes.
+         * @return offset of the first occurrence lying wholly in data, size when there is none.
+         */
+        size_t find(const uint8_t *data, size_t size) const;
+
+    private:
+        bool matches(const uint8_t *data) const;
+        size_t findFiltered(const uint8_t *data, size_t size) const;
+        size_t findHorspool(const uint8_t *data, size_t size) const;
+        size_t findScalar(const uint8_t *data, size_t size) const;
+
+        std::vector<uint8_t> __pattern; // Already masked.
+        std::vector<uint8_t> __mask;
+        size_t __first = 0;             // Fully significant bytes checked by findPair(), when __anchored.
+        size_t __last = 0;
+        bool __anchored = false;
+        bool __horspool = false;        // Not anchored, long enough for __shift to pay off.
+        size_t __shift[256];            // Horspool shift for each value of the last window byte.
+    };
+
+    /**
+     * @brief Name of the instruction set selected at runtime: "avx2", "sse2" or "scalar".
+     */
+    const char *isa();
+}
+
+#endif
@@ -0,0 +1,376 @@
+#include "Hash.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HASH_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+const size_t Hash::DIGEST_MAX;
+
+namespace
+{
+    /* Slicing by 8 tables of a reflected CRC: table[0] is the classic byte table, table[k] advances k more zero bytes. */
+    struct CrcTable
+    {
+        uint32_t table[8][256];
+
+        explicit CrcTable(uint32_t polynomial)
+        {
+            for(uint32_t i = 0; i < 256; i++){
+                uint32_t crc = i;
+                for(int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (polynomial & (0 - (crc & 1)));
+                table[0][i] = crc;
+            }
+            for(int k = 1; k < 8; k++){
+                for(int i = 0; i < 256; i++) table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+            }
+        }
+    };
+
+    const CrcTable &crc32Table()
+    {
+        static const CrcTable table(0xEDB88320);
+        return table;
+    }
+
+    const CrcTable &crc32cTable()
+    {
+        static const CrcTable table(0x82F63B78);
+        return table;
+    }
+
+    /* Update a CRC register, 8 bytes per step. */
+    uint32_t crcScalar(const CrcTable &crcTable, uint32_t crc, const uint8_t *data, size_t size)
+    {
+        const uint32_t (*t)[256] = crcTable.table;
+        for(; size >= 8; data += 8, size -= 8){
+            uint32_t low = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | static_cast<uint32_t>(data[3]) << 24);
+            uint32_t high = data[4] | data[5] << 8 | data[6] << 16 | static_cast<uint32_t>(data[7]) << 24;
+            crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^
+                  t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+        }
+        for(; size; data++, size--) crc = t[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+        return crc;
+    }
+
+    uint32_t crc32Scalar(uint32_t crc, const uint8_t *data, size_t size)
+    {
+        return crcScalar(crc32Table(), crc, data, size);
+    }
+
+    uint32_t crc32cScalar(uint32_t crc, const uint8_t *data, size_t size)
+    {
+        return crcScalar(crc32cTable(), crc, data, size);
+    }
+
+    const uint32_t SHA256_K[64] = {
+      0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+      0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+      0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+      0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+      0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+      0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+      0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+      0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+    };
+
+    inline uint32_t rotr(uint32_t value, int bits) { return (value >> bits) | (value << (32 - bits)); }
+
+    void sha256Scalar(uint32_t *state, const uint8_t *data, size_t count)
+    {
+        for(; count; data += 64, count--){
+            uint32_t w[64];
+            for(int i = 0; i < 16; i++){
+                w[i] = static_cast<uint32_t>(data[4*i]) << 24 | data[4*i + 1] << 16 | data[4*i + 2] << 8 | data[4*i + 3];
+            }
+            for(int i = 16; i < 64; i++){
+                uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+            }
+            uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+            uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+            for(int i = 0; i < 64; i++){
+                uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+                uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+            state[4] += e;
+            state[5] += f;
+            state[6] += g;
+            state[7] += h;
+        }
+    }
+}
+
+#ifdef HASH_X86
+
+/* Fold x over the next 128 bits. */
+__attribute__((target("pclmul,sse4.1")))
+static inline __m128i crc32Fold128(__m128i x, __m128i next, __m128i k3k4) {
+  __m128i low = _mm_clmulepi64_si128(x, k3k4, 0x00);
+  return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k3k4, 0x11), next), low);
+}
+
+/*
+ * CRC32 by carry-less multiplication: 64 byte blocks are folded 4 x 128 bits at a time, then into 128 bits, then
+ * reduced to 32 bits (Barrett). Constants are those of Intel's "Fast CRC Computation for Generic Polynomials Using
+ * PCLMULQDQ Instruction", in the bit reflected domain. Needs size >= 64, multiple of 16.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32Fold(uint32_t crc, const uint8_t *data, size_t size) {
+  const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596, 0x0154442BD4);
+  const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009E, 0x01751997D0);
+  const __m128i k5k0 = _mm_set_epi64x(0, 0x0163CD6124);
+  const __m128i poly = _mm_set_epi64x(0x01F7011641, 0x01DB710641);
+  const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+  __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+  __m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16));
+  __m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 32));
+  __m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 48));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+  data += 64;
+  size -= 64;
+  for(; size >= 64; data += 64, size -= 64){
+    __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 32)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 48)));
+  }
+
+  // Fold the 4 lanes, then any 16 byte block left, into one.
+  x1 = crc32Fold128(x1, x2, k3k4);
+  x1 = crc32Fold128(x1, x3, k3k4);
+  x1 = crc32Fold128(x1, x4, k3k4);
+  for(; size >= 16; data += 16, size -= 16){
+    x1 = crc32Fold128(x1, _mm_loadu_si128(reinterpret_cast<const __m128i *>(data)), k3k4);
+  }
+
+  // 128 to 64 bits, then 64 to 32 bits.
+  x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5k0, 0x00), x2);
+
+  // Barrett reduction.
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask32), poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return _mm_extract_epi32(x1, 1);
+}
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32PCLMUL(uint32_t crc, const uint8_t *data, size_t size) {
+  if(size >= 64){
+    size_t folded = size & ~static_cast<size_t>(15);
+    crc = crc32Fold(crc, data, folded);
+    data += folded;
+    size -= folded;
+  }
+  return crc32Scalar(crc, data, size);
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32cSSE42(uint32_t crc, const uint8_t *data, size_t size) {
+#ifdef __x86_64__
+  uint64_t crc64 = crc;
+  for(; size >= 8; data += 8, size -= 8){
+    uint64_t word;
+    std::memcpy(&word, data, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = static_cast<uint32_t>(crc64);
+#endif
+  for(; size >= 4; data += 4, size -= 4){
+    uint32_t word;
+    std::memcpy(&word, data, 4);
+    crc = _mm_crc32_u32(crc, word);
+  }
+  for(; size; data++, size--) crc = _mm_crc32_u8(crc, *data);
+  return crc;
+}
+
+/* SHA-256 by SHA extensions. State is kept as ABEF and CDGH lanes, as sha256rnds2 wants it. */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256SHA(uint32_t *state, const uint8_t *data, size_t count) {
+  const __m128i byteSwap = _mm_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+  __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0xB1); // CDAB
+  __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(state + 4)), 0x1B); // EFGH
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0); // CDGH
+
+  for(; count; data += 64, count--){
+    __m128i abef = state0;
+    __m128i cdgh = state1;
+    __m128i w[4]; // Message schedule, 4 words per group of 4 rounds.
+    for(int i = 0; i < 16; i++){
+      if(i < 4) w[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16*i)), byteSwap);
+      __m128i message = _mm_add_epi32(w[i % 4], _mm_loadu_si128(reinterpret_cast<const __m128i *>(SHA256_K + 4*i)));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, message);
+      if(i >= 3 && i < 15){
+        // Words of group i + 1.
+        __m128i &next = w[(i + 1) % 4];
+        next = _mm_add_epi32(next, _mm_alignr_epi8(w[i % 4], w[(i + 3) % 4], 4));
+        next = _mm_sha256msg2_epu32(next, w[i % 4]);
+      }
+      state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(message, 0x0E));
+      if(i >= 1 && i < 13) w[(i - 1) % 4] = _mm_sha256msg1_epu32(w[(i - 1) % 4], w[i % 4]);
+    }
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B); // FEBA
+  state1 = _mm_shuffle_epi32(state1, 0xB1); // DCHG
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(state), _mm_blend_epi16(tmp, state1, 0xF0)); // DCBA
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(state + 4), _mm_alignr_epi8(state1, tmp, 8)); // HGFE
+}
+
+#endif
+
+namespace
+{
+    struct Kernels
+    {
+        uint32_t (*crc32)(uint32_t, const uint8_t *, size_t);
+        uint32_t (*crc32c)(uint32_t, const uint8_t *, size_t);
+        void (*sha256)(uint32_t *, const uint8_t *, size_t);
+        const char *name;
+    };
+
+    /* Selected once. TIHEX_ISA environment variable set to "scalar" forces portable code. */
+    const Kernels &kernels()
+    {
+        static const Kernels selected = []() {
+            Kernels k = {crc32Scalar, crc32cScalar, sha256Scalar, "scalar"};
+            const char *forced = std::getenv("TIHEX_ISA");
+            if(forced && !std::strcmp(forced, "scalar")) return k;
+#ifdef HASH_X86
+            __builtin_cpu_init();
+            bool pclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+            bool sse42 = __builtin_cpu_supports("sse4.2");
+            // No __builtin_cpu_supports("sha") on older compilers: CPUID leaf 7, EBX bit 29.
+            unsigned a, b, c, d;
+            bool sha = __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b >> 29) & 1 &&
+                       __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3");
+            static const char *names[8] = {"scalar", "pclmul", "sse4.2", "pclmul,sse4.2",
+                                           "sha", "pclmul,sha", "sse4.2,sha", "pclmul,sse4.2,sha"};
+            if(pclmul) k.crc32 = crc32PCLMUL;
+            if(sse42) k.crc32c = crc32cSSE42;
+            if(sha) k.sha256 = sha256SHA;
+            k.name = names[pclmul | sse42 << 1 | sha << 2];
+#endif
+            return k;
+        }();
+        return selected;
+    }
+}
+
+Hash::Hash(Algorithm algorithm) : __algorithm(algorithm) {
+  static const uint32_t initial[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+                                      0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+  std::memcpy(__state, initial, sizeof(__state));
+}
+
+bool Hash::algorithm(const std::string &name, Algorithm &algorithm) {
+  if(name == "crc32") algorithm = Algorithm::Crc32;
+  else if(name == "crc32c") algorithm = Algorithm::Crc32c;
+  else if(name == "sha256") algorithm = Algorithm::Sha256;
+  else return false;
+  return true;
+}
+
+void Hash::blocks(const uint8_t *data, size_t count) {
+  kernels().sha256(__state, data, count);
+}
+
+void Hash::update(const uint8_t *data, size_t size) {
+  switch(__algorithm){
+    case Algorithm::Crc32:
+      __crc = kernels().crc32(__crc, data, size);
+      return;
+    case Algorithm::Crc32c:
+      __crc = kernels().crc32c(__crc, data, size);
+      return;
+    case Algorithm::Sha256:
+      break;
+  }
+  __total += size;
+  if(__blockUsed){
+    size_t part = std::min(size, sizeof(__block) - __blockUsed);
+    std::memcpy(__block + __blockUsed, data, part);
+    __blockUsed += part;
+    data += part;
+    size -= part;
+    if(__blockUsed < sizeof(__block)) return;
+    blocks(__block, 1);
+    __blockUsed = 0;
+  }
+  blocks(data, size / 64);
+  __blockUsed = size % 64;
+  std::memcpy(__block, data + size - __blockUsed, __blockUsed);
+}
+
+void Hash::update(uint8_t value, uint64_t count) {
+  uint8_t run[4096];
+  std::memset(run, value, static_cast<size_t>(std::min<uint64_t>(count, sizeof(run))));
+  for(; count; ){
+    size_t part = static_cast<size_t>(std::min<uint64_t>(count, sizeof(run)));
+    update(run, part);
+    count -= part;
+  }
+}
+
+void Hash::final(uint8_t *digest) {
+  if(__algorithm != Algorithm::Sha256){
+    uint32_t crc = ~__crc;
+    for(int i = 0; i < 4; i++) digest[i] = crc >> (24 - 8*i);
+    return;
+  }
+  // Padding: 0x80, zeros up to 56 bytes of the last block, then the size in bits, most significant byte first.
+  uint64_t bits = __total * 8;
+  uint8_t padding[72] = {0x80};
+  size_t length = (__blockUsed < 56 ? 56 : 120) - __blockUsed;
+  for(int i = 0; i < 8; i++) padding[length + i] = bits >> (56 - 8*i);
+  update(padding, length + 8);
+  for(int i = 0; i < 8; i++){
+    for(int b = 0; b < 4; b++) digest[4*i + b] = __state[i] >> (24 - 8*b);
+  }
+}
+
+uint32_t Hash::crc32(const uint8_t *data, size_t size, uint32_t crc) {
+  return ~kernels().crc32(~crc, data, size);
+}
+
+uint32_t Hash::crc32c(const uint8_t *data, size_t size, uint32_t crc) {
+  return ~kernels().crc32c(~crc, data, size);
+}
+
+const char *Hash::isa() {
+  return kernels().name;
+}
@@ -0,0 +1,105 @@
+#ifndef HASH_H
+#define HASH_H
+
+/**
+ * @file Hash.h
+ * @author Fabricio Ribeiro Toloczko
+ * @brief CRC32, CRC32C and SHA-256 of image data, e.g. before signing or flashing, see TIHex::hash().
+ * PCLMUL (CRC32), SSE4.2 (CRC32C) and SHA extensions (SHA-256) are picked at runtime, falling back to portable code.
+ *
+ * @copyright Copyright (c) 2022
+ * License: ZLib, see TIHex.h.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class Hash
+{
+public:
+    enum class Algorithm
+    {
+        Crc32,   // ISO-HDLC (zlib, Ethernet, PNG), reflected polynomial 0xEDB88320.
+        Crc32c,  // Castagnoli (iSCSI, ext4), reflected polynomial 0x82F63B78.
+        Sha256
+    };
+
+    /* Longest digest, see size() */
+    static const size_t DIGEST_MAX = 32;
+
+    explicit Hash(Algorithm algorithm);
+
+    /**
+     * @brief Get the algorithm by its name: "crc32", "crc32c" or "sha256".
+     *
+     * @return true if name is known.
+     */
+    static bool algorithm(const std::string &name, Algorithm &algorithm);
+
+    /**
+     * @brief Digest size in bytes: 4 for CRCs, 32 for SHA-256.
+     */
+    size_t size() const { return __algorithm == Algorithm::Sha256 ? 32 : 4; }
+
+    /**
+     * @brief Hash more bytes.
+     *
+     * @param data first byte.
+     * @param size number of bytes.
+     */
+    void update(const uint8_t *data, size_t size);
+
+    /**
+     * @brief Hash count copies of a byte, e.g. padding of addresses without data.
+     */
+    void update(uint8_t value, uint64_t count);
+
+    /**
+     * @brief Get the digest of all bytes hashed so far. CRCs are given most significant byte first, as printed.
+     * No more bytes may be hashed after it.
+     *
+     * @param digest room for size() bytes.
+     */
+    void final(uint8_t *digest);
+
+    /**
+     * @brief CRC32 of a buffer, zlib style: pass the CRC of previous bytes to continue it.
+     *
+     * @param data first byte.
+     * @param size number of bytes.
+     * @param crc CRC of previous bytes, 0 when there are none.
+     * @return CRC of previous bytes followed by data.
+     */
+    static uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0);
+
+    /**
+     * @brief CRC32C of a buffer. See crc32().
+     */
+    static uint32_t crc32c(const uint8_t *data, size_t size, uint32_t crc = 0);
+
+    /**
+     * @brief Instruction set extensions selected at runtime, e.g. "pclmul,sse4.2,sha" or "scalar".
+     * TIHEX_ISA environment variable set to "scalar" forces portable code, as for HexCodec.
+     */
+    static const char *isa();
+
+private:
+    /**
+     * @brief Hash whole 64 byte blocks of SHA-256.
+     */
+    void blocks(const uint8_t *data, size_t count);
+
+    Algorithm __algorithm;
+
+    /* CRC register: bit inverted CRC. */
+    uint32_t __crc = 0xFFFFFFFF;
+
+    /* SHA-256 state, partial block and total size in bytes */
+    uint32_t __state[8];
+    uint8_t __block[64];
+    size_t __blockUsed = 0;
+    uint64_t __total = 0;
+};
+
+#endif
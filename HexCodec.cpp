@@ -0,0 +1,244 @@
+#include "HexCodec.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HEXCODEC_X86 1
+#include <immintrin.h>
+#endif
+
+const int8_t HexCodec::digitTable[256] = {
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+   0, 1, 2, 3, 4, 5, 6, 7, 8, 9,-1,-1,-1,-1,-1,-1,
+  -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+};
+
+/* Two upper case hexadecimal digits of each byte value. */
+const char HexCodec::pairTable[513] =
+  "0001020304050607"
+  "08090A0B0C0D0E0F"
+  "1011121314151617"
+  "18191A1B1C1D1E1F"
+  "2021222324252627"
+  "28292A2B2C2D2E2F"
+  "3031323334353637"
+  "38393A3B3C3D3E3F"
+  "4041424344454647"
+  "48494A4B4C4D4E4F"
+  "5051525354555657"
+  "58595A5B5C5D5E5F"
+  "6061626364656667"
+  "68696A6B6C6D6E6F"
+  "7071727374757677"
+  "78797A7B7C7D7E7F"
+  "8081828384858687"
+  "88898A8B8C8D8E8F"
+  "9091929394959697"
+  "98999A9B9C9D9E9F"
+  "A0A1A2A3A4A5A6A7"
+  "A8A9AAABACADAEAF"
+  "B0B1B2B3B4B5B6B7"
+  "B8B9BABBBCBDBEBF"
+  "C0C1C2C3C4C5C6C7"
+  "C8C9CACBCCCDCECF"
+  "D0D1D2D3D4D5D6D7"
+  "D8D9DADBDCDDDEDF"
+  "E0E1E2E3E4E5E6E7"
+  "E8E9EAEBECEDEEEF"
+  "F0F1F2F3F4F5F6F7"
+  "F8F9FAFBFCFDFEFF";
+
+static const char upperDigits[] = "0123456789ABCDEF";
+
+static bool decodeScalar(const char *in, size_t count, uint8_t *out) {
+  int invalid = 0;
+  for(size_t i = 0; i < count; i++){
+    int value = HexCodec::decodeByte(in + 2*i);
+    invalid |= value;
+    out[i] = value;
+  }
+  return invalid >= 0;
+}
+
+static void encodeScalar(const uint8_t *in, size_t count, char *out) {
+  for(size_t i = 0; i < count; i++){
+    out[2*i] = upperDigits[in[i] >> 4];
+    out[2*i+1] = upperDigits[in[i] & 0x0F];
+  }
+}
+
+#ifdef HEXCODEC_X86
+
+/*
+ * Both directions work on nibbles:
+ *  decode: '0'..'9' -> c-'0', 'a'..'f'/'A'..'F' -> (c|0x20)-'a'+10, anything else is rejected.
+ *          Even characters are high nibbles, odd ones low nibbles: each 16 bit lane becomes (even<<4)|odd.
+ *  encode: n + '0' + (n > 9 ? 7 : 0), interleaving high and low nibbles.
+ */
+
+__attribute__((target("sse2")))
+static inline __m128i nibblesSSE2(__m128i c, __m128i &valid) {
+  __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+  __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+  __m128i alpha = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+  __m128i isAlpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+  valid = _mm_and_si128(valid, _mm_or_si128(isDigit, isAlpha));
+  return _mm_or_si128(_mm_and_si128(isDigit, digit),
+                      _mm_and_si128(isAlpha, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i pairsSSE2(__m128i nibbles) {
+  __m128i high = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00FF)), 4);
+  return _mm_or_si128(high, _mm_srli_epi16(nibbles, 8));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i asciiSSE2(__m128i nibbles) {
+  __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8(7));
+  return _mm_add_epi8(nibbles, _mm_add_epi8(letter, _mm_set1_epi8('0')));
+}
+
+__attribute__((target("sse2")))
+static bool decodeSSE2(const char *in, size_t count, uint8_t *out) {
+  __m128i valid = _mm_set1_epi8(-1);
+  size_t i = 0;
+  for(; i + 16 <= count; i += 16){
+    __m128i a = nibblesSSE2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2*i)), valid);
+    __m128i b = nibblesSSE2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2*i + 16)), valid);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packus_epi16(pairsSSE2(a), pairsSSE2(b)));
+  }
+  if(i + 8 <= count){
+    __m128i a = nibblesSSE2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2*i)), valid);
+    __m128i w = pairsSSE2(a);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i), _mm_packus_epi16(w, w));
+    i += 8;
+  }
+  if(_mm_movemask_epi8(valid) != 0xFFFF) return false;
+  return decodeScalar(in + 2*i, count - i, out + i);
+}
+
+__attribute__((target("sse2")))
+static void encodeSSE2(const uint8_t *in, size_t count, char *out) {
+  size_t i = 0;
+  for(; i + 16 <= count; i += 16){
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    __m128i high = asciiSSE2(_mm_and_si128(_mm_srli_epi16(bytes, 4), _mm_set1_epi8(0x0F)));
+    __m128i low = asciiSSE2(_mm_and_si128(bytes, _mm_set1_epi8(0x0F)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2*i), _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2*i + 16), _mm_unpackhi_epi8(high, low));
+  }
+  encodeScalar(in + i, count - i, out + 2*i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i nibblesAVX2(__m256i c, __m256i &valid) {
+  __m256i digit = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+  __m256i isDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+  __m256i alpha = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+  __m256i isAlpha = _mm256_cmpeq_epi8(_mm256_min_epu8(alpha, _mm256_set1_epi8(5)), alpha);
+  valid = _mm256_and_si256(valid, _mm256_or_si256(isDigit, isAlpha));
+  return _mm256_or_si256(_mm256_and_si256(isDigit, digit),
+                         _mm256_and_si256(isAlpha, _mm256_add_epi8(alpha, _mm256_set1_epi8(10))));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i pairsAVX2(__m256i nibbles) {
+  __m256i high = _mm256_slli_epi16(_mm256_and_si256(nibbles, _mm256_set1_epi16(0x00FF)), 4);
+  return _mm256_or_si256(high, _mm256_srli_epi16(nibbles, 8));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i asciiAVX2(__m256i nibbles) {
+  __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)), _mm256_set1_epi8(7));
+  return _mm256_add_epi8(nibbles, _mm256_add_epi8(letter, _mm256_set1_epi8('0')));
+}
+
+__attribute__((target("avx2")))
+static bool decodeAVX2(const char *in, size_t count, uint8_t *out) {
+  __m256i valid = _mm256_set1_epi8(-1);
+  size_t i = 0;
+  for(; i + 32 <= count; i += 32){
+    __m256i a = nibblesAVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + 2*i)), valid);
+    __m256i b = nibblesAVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + 2*i + 32)), valid);
+    // packus works per 128 bit lane: reorder 64 bit blocks back to a0,a1,b0,b1.
+    __m256i packed = _mm256_packus_epi16(pairsAVX2(a), pairsAVX2(b));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+  }
+  if(_mm256_movemask_epi8(valid) != -1) return false;
+  _mm256_zeroupper(); // Avoid AVX to SSE transition penalties on the tail.
+  return decodeSSE2(in + 2*i, count - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static void encodeAVX2(const uint8_t *in, size_t count, char *out) {
+  size_t i = 0;
+  for(; i + 32 <= count; i += 32){
+    __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+    __m256i high = asciiAVX2(_mm256_and_si256(_mm256_srli_epi16(bytes, 4), _mm256_set1_epi8(0x0F)));
+    __m256i low = asciiAVX2(_mm256_and_si256(bytes, _mm256_set1_epi8(0x0F)));
+    // unpack works per 128 bit lane: first holds bytes 0-7,16-23 and second 8-15,24-31.
+    __m256i first = _mm256_unpacklo_epi8(high, low);
+    __m256i second = _mm256_unpackhi_epi8(high, low);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 2*i), _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 2*i + 32), _mm256_permute2x128_si256(first, second, 0x31));
+  }
+  _mm256_zeroupper(); // Avoid AVX to SSE transition penalties on the tail.
+  encodeSSE2(in + i, count - i, out + 2*i);
+}
+
+#endif
+
+namespace
+{
+    struct Kernels
+    {
+        bool (*decode)(const char *, size_t, uint8_t *);
+        void (*encode)(const uint8_t *, size_t, char *);
+        const char *name;
+    };
+
+    /* Selected once. TIHEX_ISA environment variable ("avx2", "sse2" or "scalar") may force a lower level. */
+    const Kernels &kernels()
+    {
+        static const Kernels selected = []() {
+            const char *forced = std::getenv("TIHEX_ISA");
+            bool allowAVX2 = !forced || !std::strcmp(forced, "avx2");
+            bool allowSSE2 = allowAVX2 || !std::strcmp(forced, "sse2");
+            (void)allowSSE2;
+#ifdef HEXCODEC_X86
+            __builtin_cpu_init();
+            if(allowAVX2 && __builtin_cpu_supports("avx2")) return Kernels{decodeAVX2, encodeAVX2, "avx2"};
+            if(allowSSE2 && __builtin_cpu_supports("sse2")) return Kernels{decodeSSE2, encodeSSE2, "sse2"};
+#endif
+            return Kernels{decodeScalar, encodeScalar, "scalar"};
+        }();
+        return selected;
+    }
+}
+
+bool HexCodec::decode(const char *in, size_t count, uint8_t *out) {
+  return kernels().decode(in, count, out);
+}
+
+void HexCodec::encode(const uint8_t *in, size_t count, char *out) {
+  kernels().encode(in, count, out);
+}
+
+const char *HexCodec::isa() {
+  return kernels().name;
+}
@@ -0,0 +1,106 @@
+#ifndef HEXCODEC_H
+#define HEXCODEC_H
+
+/**
+ * @file HexCodec.h
+ * @author Fabricio Ribeiro Toloczko
+ * @brief ASCII hexadecimal <-> binary conversion kernels used by TIHex parser and serializer.
+ * SSE2 and AVX2 versions are picked at runtime, falling back to portable scalar code.
+ *
+ * @copyright Copyright (c) 2022
+ * License: ZLib, see TIHex.h.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace HexCodec
+{
+    /* Hexadecimal digit values, -1 for anything else. */
+    extern const int8_t digitTable[256];
+
+    /* Upper case hexadecimal digit pairs, 2*value is the pair of value. Null terminated. */
+    extern const char pairTable[513];
+
+    /**
+     * @brief Decode two hexadecimal characters.
+     *
+     * @param s pointer to at least 2 characters.
+     * @return byte value, or a negative value if any character is not a hexadecimal digit.
+     */
+    inline int decodeByte(const char *s)
+    {
+        int high = digitTable[static_cast<uint8_t>(s[0])];
+        int low = digitTable[static_cast<uint8_t>(s[1])];
+        return (high | low) < 0 ? -1 : (high << 4) | low;
+    }
+
+    /**
+     * @brief Decode 2*count hexadecimal characters, upper or lower case, into count bytes.
+     * Every character is validated.
+     *
+     * @param in 2*count characters.
+     * @param count number of bytes to decode.
+     * @param out count bytes. Contents are undefined when false is returned.
+     * @return true when all characters were hexadecimal digits, false otherwise.
+     */
+    bool decode(const char *in, size_t count, uint8_t *out);
+
+    /**
+     * @brief Encode one byte into 2 upper case hexadecimal characters, through pairTable.
+     *
+     * @param value byte to encode.
+     * @param out 2 characters.
+     */
+    inline void encodeByte(uint8_t value, char *out)
+    {
+        out[0] = pairTable[2*value];
+        out[1] = pairTable[2*value + 1];
+    }
+
+    /**
+     * @brief Encode count bytes into 2*count upper case hexadecimal characters, as printf("%.2X") does.
+     * No terminating null character is written.
+     *
+     * @param in count bytes.
+     * @param count number of bytes to encode.
+     * @param out 2*count characters.
+     */
+    void encode(const uint8_t *in, size_t count, char *out);
+
+    /**
+     * @brief Sum bytes modulo 256, as record checksums do.
+     * SSE2 is part of every x86-64 target, so it is picked at compile time and the function stays inline.
+     *
+     * @param in count bytes.
+     * @param count number of bytes to sum.
+     * @return sum of all bytes, truncated to 8 bits.
+     */
+    inline uint8_t sum(const uint8_t *in, size_t count)
+    {
+        unsigned total = 0;
+        size_t i = 0;
+#ifdef __SSE2__
+        __m128i zero = _mm_setzero_si128();
+        __m128i sums = zero;
+        for(; i + 16 <= count; i += 16){
+            // Two 64 bit lanes, each holding the sum of 8 bytes.
+            sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)), zero));
+        }
+        total = _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sums, sums));
+#endif
+        for(; i < count; i++) total += in[i];
+        return static_cast<uint8_t>(total);
+    }
+
+    /**
+     * @brief Name of the instruction set selected at runtime: "avx2", "sse2" or "scalar".
+     */
+    const char *isa();
+}
+
+#endif
@@ -0,0 +1,93 @@
+#include "ImageCache.h"
+#include "MappedFile.h"
+#include "TIHex.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    /* Cache file header, followed by the TIHex state. */
+    struct CacheHeader
+    {
+        char magic[8];
+        ImageCache::Key key;
+        uint64_t stateHash;  // Catches truncated or damaged cache files.
+    };
+
+    const char CACHE_MAGIC[8] = {'T', 'I', 'H', 'E', 'X', 'C', 'A', '1'};
+
+    inline uint64_t rotate(uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); }
+
+    inline uint64_t mix(uint64_t lane, uint64_t word)
+    {
+        return rotate(lane + word * 0xC2B2AE3D27D4EB4FULL, 31) * 0x9E3779B97F4A7C15ULL;
+    }
+}
+
+uint64_t ImageCache::hash(const char *data, size_t size) {
+  // Four independent lanes of 8 byte words keep multipliers busy, then lanes and tail are folded together.
+  uint64_t lanes[4] = {0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0x27D4EB2F165667C5ULL};
+  size_t i = 0;
+  for(; i + 32 <= size; i += 32){
+    for(int l = 0; l < 4; l++){
+      uint64_t word;
+      std::memcpy(&word, data + i + 8*l, 8);
+      lanes[l] = mix(lanes[l], word);
+    }
+  }
+  uint64_t h = size;
+  for(int l = 0; l < 4; l++) h = mix(h, lanes[l]);
+  for(; i < size; i++) h = mix(h, static_cast<uint8_t>(data[i]));
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  return h;
+}
+
+ImageCache::Key ImageCache::key(const MappedFile &source) {
+  return Key{source.size(), source.mtime(), hash(source.begin(), source.size())};
+}
+
+std::string ImageCache::path(const std::string &source) {
+  return source + ".tihexcache";
+}
+
+bool ImageCache::load(TIHex &hex, const std::string &cacheFile, const Key &key) {
+  MappedFile cache;
+  if(!cache.open(cacheFile) || cache.size() < sizeof(CacheHeader)) return false;
+  CacheHeader header;
+  std::memcpy(&header, cache.begin(), sizeof(header));
+  if(std::memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) || header.key.size != key.size ||
+     header.key.mtime != key.mtime || header.key.hash != key.hash ||
+     header.stateHash != hash(cache.begin() + sizeof(header), cache.size() - sizeof(header))){
+    return false;
+  }
+  return hex.loadState(cache.begin() + sizeof(header), cache.end());
+}
+
+bool ImageCache::save(TIHex &hex, const std::string &cacheFile, const Key &key) {
+  std::vector<char> data(sizeof(CacheHeader));
+  CacheHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.key = key;
+  hex.saveState(data);
+  header.stateHash = hash(data.data() + sizeof(header), data.size() - sizeof(header));
+  std::memcpy(data.data(), &header, sizeof(header));
+
+  std::string temporary = cacheFile + ".tmp";
+  std::FILE *file = std::fopen(temporary.c_str(), "wb");
+  if(!file) return false;
+  bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+  ok = std::fclose(file) == 0 && ok;
+  ok = ok && std::rename(temporary.c_str(), cacheFile.c_str()) == 0;
+  if(!ok){
+    int error = errno;
+    std::remove(temporary.c_str());
+    errno = error;
+  }
+  return ok;
+}
@@ -0,0 +1,72 @@
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+/**
+ * @file ImageCache.h
+ * @author Fabricio Ribeiro Toloczko
+ * @brief Binary sidecar file holding a parsed image (TIHex::saveState()), reloaded instead of parsing the text again.
+ * A cache is only used while the source file keeps its size, modification time and contents hash.
+ *
+ * @copyright Copyright (c) 2022
+ * License: ZLib, see TIHex.h.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class MappedFile;
+class TIHex;
+
+namespace ImageCache
+{
+    /* Identity of a source file. */
+    struct Key
+    {
+        uint64_t size;
+        int64_t mtime;  // Nanoseconds since epoch.
+        uint64_t hash;  // See hash().
+    };
+
+    /**
+     * @brief Fast 64 bit hash of file contents. Not cryptographic: it detects edits, not tampering.
+     *
+     * @param data first byte.
+     * @param size number of bytes.
+     * @return hash value.
+     */
+    uint64_t hash(const char *data, size_t size);
+
+    /**
+     * @brief Key of a mapped source file.
+     */
+    Key key(const MappedFile &source);
+
+    /**
+     * @brief Default cache file name of a source file: source name plus ".tihexcache".
+     */
+    std::string path(const std::string &source);
+
+    /**
+     * @brief Load an image from a cache file, if it was saved for the same key.
+     *
+     * @param hex receives the image. Left cleared if the cache is invalid.
+     * @param cacheFile cache file name.
+     * @param key source file key.
+     * @return true when the image was loaded, false when the cache is missing, stale or invalid.
+     */
+    bool load(TIHex &hex, const std::string &cacheFile, const Key &key);
+
+    /**
+     * @brief Save an image into a cache file, replacing it atomically through a temporary file.
+     * Check errno if false is returned.
+     *
+     * @param hex image, as parsed from the source file.
+     * @param cacheFile cache file name.
+     * @param key source file key.
+     * @return true on success, false otherwise.
+     */
+    bool save(TIHex &hex, const std::string &cacheFile, const Key &key);
+}
+
+#endif
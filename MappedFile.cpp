@@ -0,0 +1,123 @@
+#include "MappedFile.h"
+
+#include <cerrno>
+#include <cstdio>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPEDFILE_POSIX 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef MAPPEDFILE_POSIX
+
+bool MappedFile::open(const std::string &filename) {
+  close();
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if(fd < 0) return false;
+  bool ok = map(fd) || read(fd);
+  int error = errno;
+  ::close(fd);
+  errno = error;
+  return ok;
+}
+
+bool MappedFile::openStdin() {
+  close();
+  return map(STDIN_FILENO) || read(STDIN_FILENO);
+}
+
+void MappedFile::close() {
+  if(__mapped) munmap(const_cast<char *>(__data), __size);
+  __mapped = false;
+  __data = nullptr;
+  __size = 0;
+  __mtime = 0;
+  __buffer.clear();
+  __buffer.shrink_to_fit();
+}
+
+bool MappedFile::map(int fd) {
+  struct stat status;
+  if(fstat(fd, &status) != 0 || !S_ISREG(status.st_mode)) return false;
+#if defined(__APPLE__)
+  __mtime = static_cast<int64_t>(status.st_mtimespec.tv_sec) * 1000000000 + status.st_mtimespec.tv_nsec;
+#else
+  __mtime = static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+#endif
+  if(status.st_size == 0) return true; // Nothing to map, __data stays nullptr with zero size.
+  size_t length = status.st_size;
+  void *address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(address == MAP_FAILED) return false;
+  madvise(address, length, MADV_SEQUENTIAL);
+  __data = static_cast<const char *>(address);
+  __size = length;
+  __mapped = true;
+  return true;
+}
+
+bool MappedFile::read(int fd) {
+  const size_t chunk = 1 << 20;
+  size_t size = 0;
+  for(;;){
+    __buffer.resize(size + chunk);
+    ssize_t n = ::read(fd, __buffer.data() + size, chunk);
+    if(n < 0){
+      if(errno == EINTR) continue;
+      __buffer.clear();
+      return false;
+    }
+    if(n == 0) break;
+    size += n;
+  }
+  __buffer.resize(size);
+  __data = __buffer.data();
+  __size = size;
+  return true;
+}
+
+#else
+
+bool MappedFile::open(const std::string &filename) {
+  close();
+  std::FILE *file = std::fopen(filename.c_str(), "rb");
+  if(!file) return false;
+  size_t size = 0;
+  for(;;){
+    __buffer.resize(size + (1 << 20));
+    size_t n = std::fread(__buffer.data() + size, 1, __buffer.size() - size, file);
+    size += n;
+    if(n == 0) break;
+  }
+  std::fclose(file);
+  __buffer.resize(size);
+  __data = __buffer.data();
+  __size = size;
+  return true;
+}
+
+bool MappedFile::openStdin() {
+  close();
+  size_t size = 0;
+  for(;;){
+    __buffer.resize(size + (1 << 20));
+    size_t n = std::fread(__buffer.data() + size, 1, __buffer.size() - size, stdin);
+    size += n;
+    if(n == 0) break;
+  }
+  __buffer.resize(size);
+  __data = __buffer.data();
+  __size = size;
+  return true;
+}
+
+void MappedFile::close() {
+  __data = nullptr;
+  __size = 0;
+  __mtime = 0;
+  __buffer.clear();
+}
+
+#endif
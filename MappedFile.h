@@ -0,0 +1,89 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+/**
+ * @file MappedFile.h
+ * @author Fabricio Ribeiro Toloczko
+ * @brief Read only view of a whole file, memory mapped when possible.
+ * Pipes, terminals and systems without mmap fall back to reading the data into memory.
+ *
+ * @copyright Copyright (c) 2022
+ * License: ZLib, see TIHex.h.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    /**
+     * @brief Map a file.
+     * Check errno if false is returned.
+     *
+     * @param filename path to the file.
+     * @return true when the file contents are available, false otherwise.
+     */
+    bool open(const std::string &filename);
+
+    /**
+     * @brief Map standard input if it is redirected from a regular file, otherwise read it until end of file.
+     * Check errno if false is returned.
+     *
+     * @return true when the contents are available, false otherwise.
+     */
+    bool openStdin();
+
+    /**
+     * @brief Release the file contents.
+     *
+     */
+    void close();
+
+    /**
+     * @brief First character of the file.
+     */
+    const char *begin() const { return __data; }
+
+    /**
+     * @brief After last character of the file.
+     */
+    const char *end() const { return __data + __size; }
+
+    /**
+     * @brief File size in bytes.
+     */
+    size_t size() const { return __size; }
+
+    /**
+     * @brief Last modification time of a regular file, in nanoseconds since epoch. 0 when unknown.
+     */
+    int64_t mtime() const { return __mtime; }
+
+    /**
+     * @brief Check if contents are memory mapped: then pages are read from the file on first access, not by open().
+     */
+    bool mapped() const { return __mapped; }
+
+private:
+    bool map(int fd);
+    bool read(int fd);
+
+    const char *__data = nullptr;
+    size_t __size = 0;
+    bool __mapped = false;
+    int64_t __mtime = 0;
+
+    /* Contents of files that could not be mapped */
+    std::vector<char> __buffer;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "PatchSet.h"
+#include "HexCodec.h"
+
+#include <algorithm>
+#include <cstring>
+
+bool PatchSet::add(const Address address, const uint8_t *data, size_t length) {
+  if(!length) return true;
+  if(address + (length - 1) < address) return false; // Wraps around 64 bit addressing.
+  __edits.push_back({address, length, __editData.size()});
+  __editData.insert(__editData.end(), data, data + length);
+  return true;
+}
+
+void PatchSet::clear() {
+  __edits.clear();
+  __editData.clear();
+  __patches.clear();
+  __data.clear();
+}
+
+size_t PatchSet::lowerBound(const Address address) const {
+  auto it = std::lower_bound(__patches.begin(), __patches.end(), address,
+                             [](const Patch &patch, Address a) { return patch.address + (patch.length - 1) < a; });
+  return it - __patches.begin();
+}
+
+bool PatchSet::parse(const char *begin, const char *end, uint64_t *errorLine) {
+  std::vector<uint8_t> bytes;
+  uint64_t lineNumber = 0;
+  for(const char *line = begin; line < end;){
+    const char *next = static_cast<const char *>(std::memchr(line, '\n', end - line));
+    if(!next) next = end;
+    lineNumber++;
+    const char *comment = static_cast<const char *>(std::memchr(line, '#', next - line));
+    const char *lineEnd = comment ? comment : next;
+    auto blank = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+    const char *p = line;
+    while(p < lineEnd && blank(*p)) p++;
+    if(p < lineEnd){
+      // Address: up to 16 hexadecimal digits, optionally prefixed by 0x.
+      if(lineEnd - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) p += 2;
+      Address address = 0;
+      int digits = 0;
+      for(; p < lineEnd && !blank(*p); p++, digits++){
+        int digit = HexCodec::digitTable[static_cast<uint8_t>(*p)];
+        if(digit < 0 || digits == 16) break;
+        address = (address << 4) | digit;
+      }
+      bool valid = digits > 0 && (p == lineEnd || blank(*p));
+      // Data: groups of hexadecimal digit pairs, separated by blanks.
+      bytes.clear();
+      while(valid){
+        while(p < lineEnd && blank(*p)) p++;
+        if(p == lineEnd) break;
+        const char *group = p;
+        while(p < lineEnd && !blank(*p)) p++;
+        size_t count = (p - group) / 2;
+        bytes.resize(bytes.size() + count);
+        valid = (p - group) % 2 == 0 && HexCodec::decode(group, count, bytes.data() + bytes.size() - count);
+      }
+      if(!valid || bytes.empty() || !add(address, bytes.data(), bytes.size())){
+        if(errorLine) *errorLine = lineNumber;
+        return false;
+      }
+    }
+    line = next + 1;
+  }
+  return true;
+}
+
+bool PatchSet::sort(Address *conflict) {
+  bool consistent = true;
+  std::vector<uint8_t> copied; // Patch bytes copied so far, while merging a group.
+  __patches.clear();
+  __data.clear();
+  // Edit positions by address, ties in adding order.
+  std::vector<size_t> order(__edits.size());
+  for(size_t i = 0; i < order.size(); i++) order[i] = i;
+  std::stable_sort(order.begin(), order.end(),
+                   [this](size_t a, size_t b) { return __edits[a].address < __edits[b].address; });
+
+  size_t first = 0;
+  while(first < order.size()){
+    // Group edits overlapping or touching the patch being built. Last addresses avoid 64 bit wrap around.
+    Address start = __edits[order[first]].address;
+    Address last = start + (__edits[order[first]].length - 1);
+    size_t next = first + 1;
+    while(next < order.size() && (last == UINT64_MAX || __edits[order[next]].address <= last + 1)){
+      const Edit &edit = __edits[order[next]];
+      last = std::max(last, edit.address + (edit.length - 1));
+      next++;
+    }
+    // Copy group edits in adding order, so later ones overwrite earlier ones.
+    std::sort(order.begin() + first, order.begin() + next);
+    Patch patch = {start, last - start + 1, __data.size()};
+    __data.resize(__data.size() + patch.length);
+    uint8_t *data = &__data[patch.dataOffset];
+    copied.assign(patch.length, 0);
+    for(size_t i = first; i < next; i++){
+      const Edit &edit = __edits[order[i]];
+      const uint8_t *bytes = &__editData[edit.dataOffset];
+      uint64_t offset = edit.address - start;
+      if(i > first){
+        // Bytes already copied by an earlier edit must match.
+        for(uint64_t k = 0; k < edit.length; k++){
+          if(copied[offset + k] && data[offset + k] != bytes[k]){
+            if(consistent && conflict) *conflict = edit.address + k;
+            consistent = false;
+            break;
+          }
+        }
+      }
+      std::memcpy(data + offset, bytes, edit.length);
+      std::memset(&copied[offset], 1, edit.length);
+    }
+    __patches.push_back(patch);
+    first = next;
+  }
+  return consistent;
+}
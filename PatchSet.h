@@ -0,0 +1,111 @@
+#ifndef PATCHSET_H
+#define PATCHSET_H
+
+/**
+ * @file PatchSet.h
+ * @author Fabricio Ribeiro Toloczko
+ * @brief Set of data edits, sorted by address and merged into non overlapping patches before being applied.
+ *
+ * @copyright Copyright (c) 2022
+ * License: ZLib, see TIHex.h.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class PatchSet
+{
+public:
+    typedef uint64_t Address;
+
+    /* Merged edit: length bytes from address on, stored in data() */
+    struct Patch
+    {
+        Address address;
+        uint64_t length;
+        uint64_t dataOffset;
+    };
+
+    /**
+     * @brief Add an edit. Edits added later win where they overlap earlier ones.
+     *
+     * @param address first address to write.
+     * @param data length bytes.
+     * @param length number of bytes.
+     * @return false if the edit wraps around 64 bit addressing, true otherwise.
+     */
+    bool add(const Address address, const uint8_t *data, size_t length);
+
+    /**
+     * @brief Remove all edits.
+     *
+     */
+    void clear();
+
+    /**
+     * @brief Bytes of a patch.
+     */
+    const uint8_t *data(const Patch &patch) const { return __data.data() + patch.dataOffset; }
+
+    /**
+     * @brief Check if there are no edits.
+     *
+     */
+    bool empty() const { return __edits.empty(); }
+
+    /**
+     * @brief Position of first patch ending after address, patches().size() if none.
+     *
+     * @param address to search.
+     * @return patches() position.
+     */
+    size_t lowerBound(const Address address) const;
+
+    /**
+     * @brief Add edits from text, one per line: hexadecimal address, then hexadecimal data bytes.
+     * Data digit pairs may be split into groups by blanks. '#' starts a comment, blank lines are skipped.
+     * E.g. "0800F000 DEADBEEF # serial number" or "0x10 01 02 03".
+     * Edits before a failing line are kept.
+     *
+     * @param begin first character.
+     * @param end after last character.
+     * @param errorLine when not null and false is returned, receives the failing line number, starting at 1.
+     * @return true when all lines were valid, false otherwise.
+     */
+    bool parse(const char *begin, const char *end, uint64_t *errorLine = nullptr);
+
+    /**
+     * @brief Patches in address order, without overlaps. Overlapping or adjacent edits are merged into one patch.
+     * Call sort() after adding edits.
+     *
+     */
+    const std::vector<Patch> &patches() const { return __patches; }
+
+    /**
+     * @brief Sort and merge edits into patches().
+     * Overlapping edits giving different values to the same address are conflicts: the last added one wins.
+     *
+     * @param conflict when not null and false is returned, receives the first conflicting address found.
+     * @return true when there were no conflicts, false otherwise.
+     */
+    bool sort(Address *conflict = nullptr);
+
+private:
+    struct Edit
+    {
+        Address address;
+        uint64_t length;
+        uint64_t dataOffset; // In __editData.
+    };
+
+    /* Edits and their bytes, in the order they were added */
+    std::vector<Edit> __edits;
+    std::vector<uint8_t> __editData;
+
+    /* Merged edits, see patches() */
+    std::vector<Patch> __patches;
+    std::vector<uint8_t> __data;
+};
+
+#endif
@@ -1,4 +1,55 @@
 #include "TIHex.h"
+#include "ByteScan.h"
+#include "Hash.h"
+#include "HexCodec.h"
+#include "PatchSet.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TIHEX_POSIX 1
+#include <unistd.h>
+#endif
+
+const uint64_t TIHex::NO_SOURCE;
+const uint64_t TIHex::SCATTERED;
+
+namespace
+{
+    double seconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /* Adds the wall time of a bulk operation, and the bytes it handled, to a statistics phase when it ends. */
+    class PhaseTimer
+    {
+    public:
+        PhaseTimer(TIHex::Statistics &statistics, TIHex::Statistics::Phase phase, uint64_t bytes = 0)
+            : bytes(bytes), __statistics(statistics), __phase(phase), __start(std::chrono::steady_clock::now()) {}
+
+        ~PhaseTimer()
+        {
+            __statistics.seconds[__phase] += seconds(__start);
+            __statistics.seconds[__phase] -= excluded;
+            __statistics.bytes[__phase] += bytes;
+        }
+
+        uint64_t bytes;
+        double excluded = 0;  // Seconds already given to other phases.
+
+    private:
+        TIHex::Statistics &__statistics;
+        TIHex::Statistics::Phase __phase;
+        std::chrono::steady_clock::time_point __start;
+    };
+}
 
 TIHex::TIHex()
 {
@@ -8,170 +59,402 @@ TIHex::~TIHex()
 {
 }
 bool TIHex::append(const std::string &line) {
-  //Start code   Byte count   Address   Record type   Data   Checksum
-  int lineSize = line.size();
-  int p;
-  // Discard leading spaces or tabs or ':'
-  for (p = 0; line[p] == ' ' || line[p] == '\t' || line[p] == ':'; p++);
-  // Check if there is at least characters for 5 bytes.
-  if(p == lineSize || (lineSize - p < 5*2)){
-    __error = Error::Malformed;
-    return false;
-  }
-  std::string byteCountStr = line.substr(p,2); p+=2;
-  std::string addressStr = line.substr(p,4); p+=4;
-  std::string recordTypeStr = line.substr(p,2); p+=2;
+  return append(line.data(), line.size());
+}
 
-  uint16_t entryAddress = 0;
-  try{
-    entryAddress = std::stoul(addressStr,nullptr,16);
-  }
-  catch(const std::exception& e) {
-    __error = Error::Malformed;
-    return false;
-  }
-  if(static_cast<uint16_t>(__addressPointer) != entryAddress){
-    // Entry address is different from previous calculation.
-    Address newAddressPointer = __addressPointer & ~(0xFFFF); // __addressPointer with cleared lower 16 bits.
-    newAddressPointer |= entryAddress; // Define lower 16 bits with new entry.
-    __addressPointer = newAddressPointer;
-  }
+bool TIHex::append(const char *line, size_t length) {
   __entryList.emplace_back(); // Append new element.
-  auto& entry = __entryList.back(); // Get reference.
-
-  entry.startCode = ':';
+  auto& header = __entryList.back(); // Get reference.
 
-  try{
-    entry.byteCount = std::stoul(byteCountStr,nullptr,16);
+  Error error = decodeLine(line, length, header, __entryData);
+  if(error == Error::None){
+    error = placeEntry(__entryList.size() - 1);
+    if(error != Error::None) __entryData.resize(header.dataOffset);
   }
-  catch(const std::exception& e) {
-      __entryList.pop_back();
-    __error = Error::Malformed;
+  if(error != Error::None){
+    __entryList.pop_back();
+    __error = error;
     return false;
   }
-  
-  // Check if there is enough data
-  if(2*(entry.byteCount+1) > lineSize-p){
-      __entryList.pop_back();
-    __error = Error::Malformed;
-    return false;
+  __sourceOffsets.push_back(NO_SOURCE);
+  __error = Error::None;
+  return true;
+}
+
+/* Offset of the first data character of a line decoded by decodeLine(): after leading blanks or ':' and 8 header digits. */
+static uint64_t dataCharacterOffset(const char *line) {
+  uint64_t p = 0;
+  while(line[p] == ' ' || line[p] == '\t' || line[p] == ':') p++;
+  return p + 8;
+}
+
+/* Smallest amount of text worth handing to a load() worker thread */
+static const size_t LOAD_CHUNK_MIN_SIZE = 1 << 20;
+
+bool TIHex::load(const char *begin, const char *end, unsigned threads) {
+  PhaseTimer timer(__statistics, Statistics::Parse, end - begin);
+  __errorLine = 0;
+  __errorOffset = 0;
+  __error = Error::None;
+
+  if(threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t maxThreads = (end - begin) / LOAD_CHUNK_MIN_SIZE;
+  if(threads > maxThreads) threads = maxThreads;
+  if(threads > 1) return loadParallel(begin, end, threads);
+
+  // Reserving avoids copies on growth, but capacity is kept for the life of the object: size storage from a line count
+  // pass rather than from the text size alone. A record line has at least 11 characters, others being data digits.
+  size_t records = 0;
+  size_t dataCharacters = 0;
+  for(const char *line = begin; line < end;){
+    const char *next = static_cast<const char *>(std::memchr(line, '\n', end - line));
+    if(!next) next = end;
+    if(next - line >= 11){
+      records++;
+      dataCharacters += (next - line) - 11;
+    }
+    line = next + 1;
   }
-  
-  entry.address = entryAddress;
-  if(entry.address > TIHEX_ADDRESS_MAX_JUMP){
-      __entryList.pop_back();
-    __error = Error::InvalidJumpSize;
-    return false;
+  __entryList.reserve(__entryList.size() + records);
+  __entryData.reserve(__entryData.size() + dataCharacters / 2);
+  __sourceOffsets.reserve(__sourceOffsets.size() + records);
+  uint64_t lineNumber = 0;
+  for(const char *line = begin; line < end;){
+    const char *next = static_cast<const char *>(std::memchr(line, '\n', end - line));
+    if(!next) next = end;
+    lineNumber++;
+    if(next != line && line[0] != '\r'){ // Skips empty lines
+      if(!append(line, next - line)){
+        __errorLine = lineNumber;
+        __errorOffset = line - begin;
+        return false;
+      }
+      __sourceOffsets.back() = (line - begin) + dataCharacterOffset(line);
+    }
+    line = next + 1;
   }
-  try{
-    entry.recordType = std::stoul(recordTypeStr,nullptr,16);
+  return true;
+}
+
+/*
+ * Parallel loading:
+ *  1. The buffer is split into newline aligned chunks, decoded by worker threads.
+ *     Each record's address pointer only depends on the upper 48 bits of the address pointer before it, or on nothing at
+ *     all once an extended address record (0x02/0x04) is found. So workers track address pointers relative to the chunk
+ *     input (as if it was zero) until the first extended address record, and absolute ones after it.
+ *  2. A serial prefix pass over the chunks finds each chunk input address pointer: the last pointer of previous chunk,
+ *     or its relative one added to that chunk input.
+ *  3. Workers add their chunk input to relative pointers, checking overflows.
+ *  4. Records are copied into __entryList/__entryData by workers and indexed in original order, up to the first error.
+ */
+struct TIHex::LoadChunk
+{
+    const char *begin;
+    const char *end;
+
+    std::vector<Header> entries;
+    std::vector<uint8_t> data;
+    std::vector<Address> pointers;  // Address pointer after each entry.
+    std::vector<uint64_t> offsets;  // Line offset of each entry, from chunk begin.
+    size_t firstAbsolute = 0;       // Entries before this one have pointers relative to input.
+
+    uint64_t lines = 0;             // Lines consumed, including the failing one.
+    Error error = Error::None;      // Error on line number `lines`, if any.
+    uint64_t errorOffset = 0;
+
+    Address input = 0;              // Address pointer upper bits when entering the chunk.
+    size_t overflow = 0;            // First entry overflowing once rebased to input, entries.size() if none.
+    size_t count = 0;               // Entries to keep.
+    size_t entryIndex = 0;          // Where kept entries go in __entryList and __entryData.
+    uint64_t dataOffset = 0;
+};
+
+void TIHex::decodeChunk(LoadChunk &chunk) const {
+  Address pointer = 0;
+  bool absolute = false;
+  for(const char *line = chunk.begin; line < chunk.end;){
+    const char *next = static_cast<const char *>(std::memchr(line, '\n', chunk.end - line));
+    if(!next) next = chunk.end;
+    chunk.lines++;
+    if(next != line && line[0] != '\r'){ // Skips empty lines
+      chunk.entries.emplace_back();
+      auto& header = chunk.entries.back();
+      Error error = decodeLine(line, next - line, header, chunk.data);
+      if(error == Error::None){
+        if(!absolute && (header.recordType == 0x02 || header.recordType == 0x04)){
+          absolute = true;
+          chunk.firstAbsolute = chunk.pointers.size();
+        }
+        error = advance(header, chunk.data.data() + header.dataOffset, pointer);
+        if(error != Error::None) chunk.data.resize(header.dataOffset);
+      }
+      if(error != Error::None){
+        chunk.entries.pop_back();
+        chunk.error = error;
+        chunk.errorOffset = line - chunk.begin;
+        break;
+      }
+      chunk.pointers.push_back(pointer);
+      chunk.offsets.push_back(line - chunk.begin);
+    }
+    line = next + 1;
   }
-  catch(const std::exception& e) {
-      __entryList.pop_back();
-    __error = Error::Malformed;
-    return false;
+  if(!absolute) chunk.firstAbsolute = chunk.pointers.size();
+}
+
+bool TIHex::loadParallel(const char *begin, const char *end, unsigned threads) {
+  std::vector<LoadChunk> chunks(threads);
+  const char *chunkBegin = begin;
+  for(unsigned i = 0; i < threads; i++){
+    const char *chunkEnd = begin + (end - begin) * (i + 1) / threads;
+    if(chunkEnd < chunkBegin) chunkEnd = chunkBegin;
+    if(chunkEnd < end){
+      chunkEnd = static_cast<const char *>(std::memchr(chunkEnd, '\n', end - chunkEnd));
+      chunkEnd = chunkEnd ? chunkEnd + 1 : end;
+    }
+    chunks[i].begin = chunkBegin;
+    chunks[i].end = chunkEnd;
+    chunkBegin = chunkEnd;
   }
 
-  std::string dataStr = line.substr(p,2*entry.byteCount); p+=2*entry.byteCount;
-  auto dataByteCount = dataStr.size()/2;
-  if(dataByteCount != entry.byteCount){
-      __entryList.pop_back();
-    __error = Error::InvalidDataSize;
-    return false;
+  std::vector<std::thread> workers;
+  for(unsigned i = 1; i < threads; i++) workers.emplace_back(&TIHex::decodeChunk, this, std::ref(chunks[i]));
+  decodeChunk(chunks[0]);
+  for(auto &worker : workers) worker.join();
+  workers.clear();
+
+  // Prefix pass: chunk input address pointers.
+  Address pointer = __addressPointer;
+  for(auto &chunk : chunks){
+    chunk.input = pointer & ~static_cast<Address>(0xFFFF);
+    if(chunk.pointers.empty()) continue;
+    pointer = chunk.pointers.back();
+    if(chunk.firstAbsolute == chunk.pointers.size()) pointer += chunk.input;
   }
-  uint64_t newProgramCounter = __programCounter;
-  entry.data.reserve(dataByteCount); // Preallocate memory.
-  for(int i=0; i<dataStr.size(); i+=2)
-  {
-    auto s = dataStr.substr(i,2);
-    uint8_t value;
-    try{
-      value = std::stoul(s,nullptr,16);
-    }
-    catch(const std::exception& e) {
-      __entryList.pop_back();
-      __error = Error::Malformed;
-      return false;
+
+  // Rebase relative pointers.
+  auto rebase = [](LoadChunk *chunk) {
+    Address limit = ~chunk->input; // Largest relative pointer not overflowing.
+    chunk->overflow = chunk->entries.size();
+    for(size_t i = 0; i < chunk->firstAbsolute; i++){
+      if(chunk->pointers[i] > limit){
+        chunk->overflow = i;
+        break;
+      }
+      chunk->pointers[i] += chunk->input;
     }
-    entry.data.push_back(value);
-    newProgramCounter++;
+  };
+  for(unsigned i = 1; i < threads; i++) workers.emplace_back(rebase, &chunks[i]);
+  rebase(&chunks[0]);
+  for(auto &worker : workers) worker.join();
+
+  // Find kept records: up to the first error.
+  uint64_t lineNumber = 0;
+  size_t entryIndex = __entryList.size();
+  uint64_t dataOffset = __entryData.size();
+  size_t used = 0;
+  for(auto &chunk : chunks){
+    used++;
+    chunk.count = std::min(chunk.overflow, chunk.entries.size());
+    chunk.entryIndex = entryIndex;
+    chunk.dataOffset = dataOffset;
+    entryIndex += chunk.count;
+    dataOffset += chunk.count ? chunk.entries[chunk.count - 1].dataOffset + chunk.entries[chunk.count - 1].byteCount : 0;
+
+    if(chunk.overflow < chunk.offsets.size()){
+      const char *line = chunk.begin + chunk.offsets[chunk.overflow];
+      __error = Error::Overflow;
+      __errorLine = lineNumber + 1 + std::count(chunk.begin, line, '\n');
+      __errorOffset = line - begin;
+      break;
+    }
+    if(chunk.error != Error::None){
+      __error = chunk.error;
+      __errorLine = lineNumber + chunk.lines;
+      __errorOffset = chunk.begin - begin + chunk.errorOffset;
+      break;
+    }
+    lineNumber += chunk.lines;
   }
 
-  std::string checksumStr = line.substr(p,2); p+=2;
+  // Copy records into storage.
+  __entryList.resize(entryIndex);
+  __entryData.resize(dataOffset);
+  __sourceOffsets.resize(entryIndex);
+  auto copy = [this, begin](LoadChunk *chunk) {
+    for(size_t i = 0; i < chunk->count; i++){
+      Header &header = __entryList[chunk->entryIndex + i];
+      header = chunk->entries[i];
+      header.dataOffset += chunk->dataOffset;
+      const char *line = chunk->begin + chunk->offsets[i];
+      __sourceOffsets[chunk->entryIndex + i] = (line - begin) + dataCharacterOffset(line);
+    }
+    if(chunk->count){
+      const Header &last = chunk->entries[chunk->count - 1];
+      std::memcpy(__entryData.data() + chunk->dataOffset, chunk->data.data(), last.dataOffset + last.byteCount);
+    }
+    std::vector<Header>().swap(chunk->entries);
+    std::vector<uint8_t>().swap(chunk->data);
+  };
+  workers.clear();
+  for(size_t i = 1; i < used; i++) workers.emplace_back(copy, &chunks[i]);
+  copy(&chunks[0]);
+  for(auto &worker : workers) worker.join();
 
-  try{
-    entry.checksum = std::stoul(checksumStr,nullptr,16);
+  // Index data records.
+  for(size_t c = 0; c < used; c++){
+    auto &chunk = chunks[c];
+    for(size_t i = 0; i < chunk.count; i++){
+      const Header &header = __entryList[chunk.entryIndex + i];
+      if(header.recordType == 0x00){
+        indexEntry(chunk.pointers[i] - header.byteCount, chunk.entryIndex + i);
+        __programCounter += header.byteCount;
+      }
+    }
+    if(chunk.count) __addressPointer = chunk.pointers[chunk.count - 1];
   }
-  catch(const std::exception& e) {
-      __entryList.pop_back();
-    __error = Error::Malformed;
-    return false;
+  return __error == Error::None;
+}
+
+TIHex::Error TIHex::decodeLine(const char *line, size_t length, Header &header, std::vector<uint8_t> &data) const {
+  //Start code   Byte count   Address   Record type   Data   Checksum
+  size_t p;
+  // Discard leading spaces or tabs or ':'
+  for (p = 0; p < length && (line[p] == ' ' || line[p] == '\t' || line[p] == ':'); p++);
+  // Check if there is at least characters for 5 bytes.
+  if(length - p < 5*2) return Error::Malformed;
+
+  int byteCount = HexCodec::decodeByte(line + p);
+  int addressHigh = HexCodec::decodeByte(line + p + 2);
+  int addressLow = HexCodec::decodeByte(line + p + 4);
+  int recordType = HexCodec::decodeByte(line + p + 6);
+  if((byteCount | addressHigh | addressLow | recordType) < 0) return Error::Malformed;
+  p += 8;
+
+  // Check if there is enough data
+  if(2*(static_cast<size_t>(byteCount)+1) > length-p) return Error::Malformed;
+
+  header.startCode = ':';
+  header.byteCount = byteCount;
+  header.address = (addressHigh << 8) | addressLow;
+  if(header.address > TIHEX_ADDRESS_MAX_JUMP) return Error::InvalidJumpSize;
+  header.recordType = recordType;
+
+  int checksum = HexCodec::decodeByte(line + p + 2*byteCount);
+  if(checksum < 0) return Error::Malformed;
+  header.checksum = checksum;
+
+  header.dataOffset = data.size();
+  data.resize(header.dataOffset + byteCount);
+  if(!HexCodec::decode(line + p, byteCount, data.data() + header.dataOffset)){
+    data.resize(header.dataOffset);
+    return Error::Malformed;
   }
+  return Error::None;
+}
 
-  Address newAddressPointer = __addressPointer;
+TIHex::Error TIHex::advance(const Header &header, const uint8_t *data, Address &addressPointer) {
+  Address placed = addressPointer;
+  if(static_cast<uint16_t>(placed) != header.address){
+    // Entry address is different from previous calculation.
+    placed &= ~static_cast<Address>(0xFFFF); // Clear lower 16 bits.
+    placed |= header.address; // Define lower 16 bits with new entry.
+  }
+  Address newAddressPointer = placed;
 
   // Process record types
-  if(entry.recordType == 0x00){
-    __entryMap[__addressPointer] = &entry; // Add reference into map.
-    newAddressPointer += entry.byteCount;
-    if(newAddressPointer < __addressPointer){
-      __entryMap.erase(__addressPointer);
-      __entryList.pop_back();
-      __error = Error::Overflow;
-      return false;
-    }
-  }
-  else if(entry.recordType == 0x02){
+  if(header.recordType == 0x02){
     // Extended Segment Address
-    auto dataSize = entry.data.size();
+    auto dataSize = header.byteCount;
     uint64_t addressOffset = 0;
-    for(int i=0; i < dataSize; i++){
+    for(size_t i=0; i < dataSize; i++){
       addressOffset <<= 8;
-      addressOffset |= entry.data[i];
+      addressOffset |= data[i];
     }
     addressOffset <<= 4;
     newAddressPointer = addressOffset;
   }
-  else if(entry.recordType == 0x04){
+  else if(header.recordType == 0x04){
     // Extended Linear Address
-    auto dataSize = entry.data.size();
+    auto dataSize = header.byteCount;
     uint64_t upperAddress = 0;
-    for(int i=0; i < dataSize; i++){
+    for(size_t i=0; i < dataSize; i++){
       upperAddress <<= 8;
-      upperAddress |= entry.data[i];
+      upperAddress |= data[i];
     }
-    upperAddress <<= 32;
+    upperAddress <<= 16; // Bits 16 to 31 of the address.
     newAddressPointer = upperAddress;
   }
   else{
-    // End Of File or Start Segment Address or Start Linear Address
-    newAddressPointer += entry.byteCount;
-    if(newAddressPointer < __addressPointer){
-      __entryList.pop_back();
-      __error = Error::Overflow;
+    // Data or End Of File or Start Segment Address or Start Linear Address
+    newAddressPointer += header.byteCount;
+    if(newAddressPointer < placed) return Error::Overflow;
+  }
+  addressPointer = newAddressPointer;
+  return Error::None;
+}
+
+TIHex::Error TIHex::placeEntry(size_t index) {
+  const Header &header = __entryList[index];
+  Error error = advance(header, __entryData.data() + header.dataOffset, __addressPointer);
+  if(error != Error::None) return error;
+  if(header.recordType == 0x00){
+    indexEntry(__addressPointer - header.byteCount, index); // Add reference into index.
+    __programCounter += header.byteCount;
+  }
+  return Error::None;
+}
+
+bool TIHex::apply(const PatchSet &patches, bool calculateChecksum, Range *unwritten) {
+  sortIndex(); // Timed on its own.
+  PhaseTimer timer(__statistics, Statistics::Patch);
+  // Patches are in address order, so each walk carries on from the index position where the previous one ended.
+  size_t position = 0;
+  Range hole = {0, 0};
+  auto noPiece = [](size_t, uint64_t, uint64_t, uint64_t) { return true; };
+  for(auto &patch : patches.patches()){
+    auto findHole = [&](uint64_t rangeOffset, uint64_t size) {
+      hole = {patch.address + rangeOffset, size};
+      return false;
+    };
+    if(!walk(patch.address, patch.length, noPiece, findHole, &position)){
+      if(unwritten) *unwritten = hole;
+      __error = Error::AddressNotFound;
       return false;
     }
   }
-  if(entry.recordType == 0x00) __programCounter = newProgramCounter;
-  __addressPointer = newAddressPointer;
+
+  // Checksum of an entry is calculated once its last patched byte is written.
+  const size_t none = std::numeric_limits<size_t>::max();
+  size_t pending = none;
+  position = 0;
+  for(auto &patch : patches.patches()){
+    const uint8_t *data = patches.data(patch);
+    auto write = [&](size_t index, uint64_t offset, uint64_t rangeOffset, uint64_t size) {
+      std::memcpy(__entryData.data() + __entryList[index].dataOffset + offset, data + rangeOffset, size);
+      markModified(index);
+      if(calculateChecksum && index != pending){
+        if(pending != none) updateChecksum(pending);
+        pending = index;
+      }
+      return true;
+    };
+    auto noHole = [](uint64_t, uint64_t) { return true; };
+    walk(patch.address, patch.length, write, noHole, &position);
+    timer.bytes += patch.length;
+  }
+  if(pending != none) updateChecksum(pending);
   __error = Error::None;
   return true;
 }
 
 bool TIHex::contains(const Address address){
-    try
-    {
-        __entryMap.at(address);
-        return true;
-    }
-    catch(const std::exception& e)
-    {
-        return false;
-    }
+    size_t position = indexUpperBound(address);
+    return position && __indexAddress[position - 1] == address;
 }
 
-const std::string TIHex::errorString() {
-    switch (__error)
+const std::string TIHex::errorString(Error error) {
+    switch (error)
     {
       case Error::None:
         return "None";
@@ -191,96 +474,1208 @@ const std::string TIHex::errorString() {
         return "UpperAddressNotFound";
       case Error::Overflow:
         return "Overflow";
+      case Error::Output:
+        return "Output";
+      case Error::BufferSize:
+        return "BufferSize";
+      case Error::Input:
+        return "Input";
+      case Error::NotInSource:
+        return "NotInSource";
+      case Error::AddressOrder:
+        return "AddressOrder";
 
       default:
       return "Unknown";
     }
 }
 
-bool TIHex::fixChecksum(Entry &entry) {
-  int sum = 
-    entry.byteCount+
-    (entry.address >> 8)+
-    (entry.address & 0xFF)+
-    entry.recordType;
-  auto dataSize = entry.data.size();
-  for(int i = 0; i<dataSize; i++) sum += entry.data[i];
-  entry.checksum = (~sum) + 1; // Two's complement
+TIHex::Statistics TIHex::statistics() {
+  Statistics statistics = __statistics;
+  for(auto &header : __entryList){
+    if(header.recordType < 6) statistics.records[header.recordType]++;
+    if(header.recordType == 0x00) statistics.dataBytes += header.byteCount;
+  }
+  statistics.recordMemory = __entryList.capacity() * sizeof(Header) + __sourceOffsets.capacity() * sizeof(uint64_t);
+  statistics.dataMemory = __entryData.capacity();
+  statistics.indexMemory = __indexAddress.capacity() * sizeof(Address) + __indexEntry.capacity() * sizeof(size_t) +
+                           __indexTop.capacity() * sizeof(Address) + __segments.capacity() * sizeof(Segment);
+  statistics.recordUsed = __entryList.size() * sizeof(Header) + __sourceOffsets.size() * sizeof(uint64_t);
+  statistics.dataUsed = __entryData.size();
+  statistics.indexUsed = __indexAddress.size() * sizeof(Address) + __indexEntry.size() * sizeof(size_t) +
+                         __indexTop.size() * sizeof(Address) + __segments.size() * sizeof(Segment);
+  return statistics;
+}
+
+const char *TIHex::Statistics::phaseName(Phase phase) {
+  static const char *names[PHASES] = {"read", "parse", "index", "patch", "checksum", "write"};
+  return phase < PHASES ? names[phase] : "unknown";
+}
+
+void TIHex::finalize() {
+  if(__dirtyEntries.empty()) return;
+  PhaseTimer timer(__statistics, Statistics::Checksum);
+  // Entry order keeps the data arena walk sequential.
+  std::sort(__dirtyEntries.begin(), __dirtyEntries.end());
+  for(size_t index : __dirtyEntries){
+    Header &header = __entryList[index];
+    header.checksum = checksumOf(header, __entryData.data() + header.dataOffset);
+    header.flags &= ~HEADER_DIRTY;
+    timer.bytes += header.byteCount;
+  }
+  __dirtyEntries.clear();
+}
+
+uint8_t TIHex::checksumOf(const Header &header, const uint8_t *data) {
+  int sum =
+    header.byteCount+
+    (header.address >> 8)+
+    (header.address & 0xFF)+
+    header.recordType+
+    HexCodec::sum(data, header.byteCount);
+  return (~sum) + 1; // Two's complement
+}
+
+bool TIHex::fixChecksum(Entry entry) {
+  entry.header().checksum = checksumOf(entry.header(), entry.data());
+  entry.header().flags &= ~HEADER_DIRTY; // Stays in __dirtyEntries, finalize() calculates it again harmlessly.
   __error = Error::None;
   return true;
 }
 
+void TIHex::markModified(size_t index) {
+  Header &header = __entryList[index];
+  if(header.flags & HEADER_MODIFIED) return;
+  header.flags |= HEADER_MODIFIED;
+  __modifiedEntries.push_back(index);
+}
+
+void TIHex::updateChecksum(size_t index) {
+  Header &header = __entryList[index];
+  if(!__lazyChecksum){
+    fixChecksum(entryAt(index));
+    return;
+  }
+  if(header.flags & HEADER_DIRTY) return;
+  header.flags |= HEADER_DIRTY;
+  __dirtyEntries.push_back(index);
+}
+
 uint8_t TIHex::getValue(Address address) {
-    auto it = __entryMap.upper_bound(address);
+    size_t index;
+    uint64_t offset;
+    if(!locate(address, index, offset, __lastHit))
+    {
+        __error = Error::AddressNotFound;
+        return 0;
+    }
+
+    __error = Error::None;
+    return entryAt(index)[offset];
+}
+
+uint8_t TIHex::Cursor::getValue(Address address) {
+  size_t index;
+  uint64_t offset;
+  if(!__hex->locate(address, index, offset, __hint)){
+    __hex->__error = Error::AddressNotFound;
+    return 0;
+  }
+  __hex->__error = Error::None;
+  return __hex->entryAt(index)[offset];
+}
+
+bool TIHex::Cursor::overwrite(Address address, uint8_t data, bool calculateChecksum) {
+  size_t index;
+  uint64_t offset;
+  if(!__hex->locate(address, index, offset, __hint)) return false;
+  __hex->entryAt(index)[offset] = data;
+  __hex->markModified(index);
+  if(calculateChecksum) __hex->updateChecksum(index);
+  return true;
+}
+
+/* Index addresses per block of the index top level */
+static const size_t INDEX_BLOCK_SIZE = 64;
+
+#ifdef __GNUC__
+#define TIHEX_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define TIHEX_PREFETCH(address)
+#endif
+
+/* Branchless binary search: number of values lower than or equal to value. */
+static inline size_t upperBound(const uint64_t *values, size_t size, uint64_t value) {
+  if(!size) return 0;
+  const uint64_t *base = values;
+  while(size > 1){
+    size_t half = size / 2;
+    // Both candidates of next step are fetched while this one compares.
+    TIHEX_PREFETCH(base + half / 2);
+    TIHEX_PREFETCH(base + half + half / 2);
+    base = (base[half] <= value) ? base + half : base; // Compiled as a conditional move.
+    size -= half;
+  }
+  return (base - values) + (*base <= value);
+}
 
-    // Let's choose the right iterator, if it exists.
-    if(it == __entryMap.end()){
-      // Over than last address.
-      if(__entryMap.size()){
-        it--; // Get last entry
+void TIHex::indexEntry(Address address, size_t index) {
+  if(__segmentsValid){
+    // A record starting before the end of data so far may cut records short: segments are rebuilt when asked for.
+    const Header &header = __entryList[index];
+    if(!__segments.empty() && address < __segments.back().address + __segments.back().length){
+      __segments.clear();
+      __segmentsValid = false;
+    }
+    else if(header.byteCount) addSegment(address, header.byteCount, header.dataOffset);
+  }
+  if(__indexSorted && !__indexAddress.empty() && address <= __indexAddress.back()){
+    if(address == __indexAddress.back()){
+      __indexEntry.back() = index;
+      return;
+    }
+    __indexSorted = false;
+  }
+  if(__indexSorted && __indexAddress.size() % INDEX_BLOCK_SIZE == 0) __indexTop.push_back(address);
+  __indexAddress.push_back(address);
+  __indexEntry.push_back(index);
+}
+
+void TIHex::addSegment(Address address, uint64_t length, uint64_t dataOffset) {
+  if(!__segments.empty()){
+    Segment &last = __segments.back();
+    if(last.address + last.length == address){
+      if(last.dataOffset != SCATTERED && last.dataOffset + last.length != dataOffset) last.dataOffset = SCATTERED;
+      last.length += length;
+      return;
+    }
+  }
+  __segments.push_back({address, length, dataOffset});
+}
+
+const std::vector<TIHex::Segment> &TIHex::segments() {
+  if(__segmentsValid) return __segments;
+  sortIndex();
+  // Each indexed record owns its bytes up to the next indexed start address.
+  size_t count = __indexAddress.size();
+  for(size_t i = 0; i < count; i++){
+    const Header &header = __entryList[__indexEntry[i]];
+    uint64_t length = header.byteCount;
+    if(i + 1 < count) length = std::min<uint64_t>(length, __indexAddress[i + 1] - __indexAddress[i]);
+    if(length) addSegment(__indexAddress[i], length, header.dataOffset);
+  }
+  __segmentsValid = true;
+  return __segments;
+}
+
+/* diff() compares scattered segments through buffers of this size. */
+static const size_t DIFF_CHUNK_SIZE = 1 << 16;
+
+void TIHex::diff(TIHex &other, std::vector<Difference> &differences) {
+  differences.clear();
+  auto add = [&](Difference::Kind kind, Address address, uint64_t length) {
+    if(!differences.empty()){
+      Difference &last = differences.back();
+      if(last.kind == kind && last.address + last.length == address){
+        last.length += length;
+        return;
+      }
+    }
+    differences.push_back({kind, address, length});
+  };
+  std::vector<uint8_t> oldChunk, newChunk;
+  // Changed runs of an address range both images have data for.
+  auto compare = [&](const Segment &oldSegment, const Segment &newSegment, Address address, uint64_t length) {
+    const uint8_t *oldData = segmentData(oldSegment);
+    const uint8_t *newData = other.segmentData(newSegment);
+    if(oldData) oldData += address - oldSegment.address;
+    if(newData) newData += address - newSegment.address;
+    for(uint64_t done = 0; done < length;){
+      size_t size = length - done;
+      const uint8_t *a = oldData ? oldData + done : nullptr;
+      const uint8_t *b = newData ? newData + done : nullptr;
+      if(!a || !b){
+        size = std::min<uint64_t>(size, DIFF_CHUNK_SIZE);
+        oldChunk.resize(DIFF_CHUNK_SIZE);
+        newChunk.resize(DIFF_CHUNK_SIZE);
+        if(!a){
+          read(address + done, oldChunk.data(), size);
+          a = oldChunk.data();
+        }
+        if(!b){
+          other.read(address + done, newChunk.data(), size);
+          b = newChunk.data();
+        }
       }
-      else{
-          __error = Error::AddressNotFound;
-          return 0;
+      for(size_t offset = 0; offset < size;){
+        offset += ByteScan::mismatch(a + offset, b + offset, size - offset);
+        if(offset == size) break;
+        size_t changed = ByteScan::match(a + offset, b + offset, size - offset);
+        add(Difference::Kind::Changed, address + done + offset, changed);
+        offset += changed;
       }
+      done += size;
     }
-    else it--;
+  };
 
-    // Checking the offset, if it exists.
-    auto offset = address - it->first;
-    auto& data = it->second->data;
-    if(offset >= data.size())
-    {
-        __error = Error::AddressNotFound;
-        return 0; // There is no data to overwrite.
+  // Walk both segment lists, as (address, length) parts left of the current segments.
+  const std::vector<Segment> &oldSegments = segments();
+  const std::vector<Segment> &newSegments = other.segments();
+  size_t i = 0, j = 0;
+  Address oldAddress = 0, newAddress = 0;
+  uint64_t oldLength = 0, newLength = 0;
+  if(i < oldSegments.size()) oldAddress = oldSegments[i].address, oldLength = oldSegments[i].length;
+  if(j < newSegments.size()) newAddress = newSegments[j].address, newLength = newSegments[j].length;
+  while(i < oldSegments.size() || j < newSegments.size()){
+    uint64_t step;
+    if(j == newSegments.size() || (i < oldSegments.size() && oldAddress < newAddress)){
+      step = j == newSegments.size() ? oldLength : std::min(oldLength, newAddress - oldAddress);
+      add(Difference::Kind::Removed, oldAddress, step);
+      oldAddress += step;
+      oldLength -= step;
+    }
+    else if(i == oldSegments.size() || newAddress < oldAddress){
+      step = i == oldSegments.size() ? newLength : std::min(newLength, oldAddress - newAddress);
+      add(Difference::Kind::Added, newAddress, step);
+      newAddress += step;
+      newLength -= step;
+    }
+    else{
+      step = std::min(oldLength, newLength);
+      compare(oldSegments[i], newSegments[j], oldAddress, step);
+      oldAddress += step;
+      oldLength -= step;
+      newAddress += step;
+      newLength -= step;
+    }
+    if(i < oldSegments.size() && !oldLength && ++i < oldSegments.size()){
+      oldAddress = oldSegments[i].address;
+      oldLength = oldSegments[i].length;
     }
+    if(j < newSegments.size() && !newLength && ++j < newSegments.size()){
+      newAddress = newSegments[j].address;
+      newLength = newSegments[j].length;
+    }
+  }
+}
 
-    __error = Error::None;
-    return data[offset];
+void TIHex::sortIndex() {
+  if(__indexSorted) return;
+  PhaseTimer timer(__statistics, Statistics::Index, __indexAddress.size() * (sizeof(Address) + sizeof(size_t)));
+  std::vector<std::pair<Address, size_t>> pairs(__indexAddress.size());
+  for(size_t i = 0; i < pairs.size(); i++) pairs[i] = std::make_pair(__indexAddress[i], __indexEntry[i]);
+  // Entry indexes grow in append order: for repeated addresses the last appended entry comes last and wins.
+  std::sort(pairs.begin(), pairs.end());
+  size_t count = 0;
+  for(size_t i = 0; i < pairs.size(); i++){
+    if(count && __indexAddress[count - 1] == pairs[i].first) count--;
+    __indexAddress[count] = pairs[i].first;
+    __indexEntry[count] = pairs[i].second;
+    count++;
+  }
+  __indexAddress.resize(count);
+  __indexEntry.resize(count);
+  __indexTop.clear();
+  for(size_t i = 0; i < count; i += INDEX_BLOCK_SIZE) __indexTop.push_back(__indexAddress[i]);
+  __indexSorted = true;
+  __indexGeneration++;
+}
+
+size_t TIHex::indexUpperBound(const Address address) {
+  sortIndex();
+  // Top level is small enough to stay in cache, then a single block of the full index is searched.
+  size_t block = upperBound(__indexTop.data(), __indexTop.size(), address);
+  if(!block) return 0;
+  size_t first = (block - 1) * INDEX_BLOCK_SIZE;
+  size_t size = std::min(INDEX_BLOCK_SIZE, __indexAddress.size() - first);
+  return first + upperBound(__indexAddress.data() + first, size, address);
+}
+
+bool TIHex::locate(const Address address, size_t &index, uint64_t &offset, LookupHint &hint) {
+  size_t position = 0;
+  size_t count = __indexAddress.size();
+  if(hint.generation == __indexGeneration && __indexSorted){
+    // The hinted record or the one after it: found when address is below the start of the next one.
+    for(size_t p = hint.position; p < count && p <= hint.position + 1 && __indexAddress[p] <= address; p++){
+      if(p + 1 == count || address < __indexAddress[p + 1]){
+        position = p + 1;
+        break;
+      }
+    }
+  }
+  if(!position) position = indexUpperBound(address);
+  if(!position) return false;
+  hint.position = position - 1;
+  hint.generation = __indexGeneration;
+  index = __indexEntry[position - 1];
+  offset = address - __indexAddress[position - 1];
+  return offset < __entryList[index].byteCount;
 }
 
 TIHex::Address TIHex::lowerAddress(const Address address) {
-    auto it = __entryMap.lower_bound(address);
-    if(it == __entryMap.begin()){
+    size_t position = address ? indexUpperBound(address - 1) : 0;
+    if(!position){
       __error = Error::LowerAddressNotFound;
       return std::numeric_limits<Address>::min();
     }
-    it--;
     __error = Error::None;
-    return it->first;
+    return __indexAddress[position - 1];
 }
 
 bool TIHex::overwrite(const Address address, uint8_t &byte, bool calculateChecksum){
-  auto it = __entryMap.upper_bound(address);
+  size_t index;
+  uint64_t offset;
+  if(!locate(address, index, offset, __lastHit)) return false; // There is no data to overwrite.
+
+  // Overwrite data.
+  auto entry = entryAt(index);
+  entry[offset] = byte;
+  markModified(index);
+  if(calculateChecksum) updateChecksum(index);
+
+  return true;
+}
+
+size_t TIHex::indexUpperBound(const Address address, size_t from) {
+  sortIndex();
+  // Nearby addresses are found scanning forward, far ones through the index levels.
+  size_t last = std::min(from + INDEX_BLOCK_SIZE, __indexAddress.size());
+  while(from < last && __indexAddress[from] <= address) from++;
+  if(from < last || last == __indexAddress.size()) return from;
+  return indexUpperBound(address);
+}
 
-  // Let's choose the right iterator, if it exists.
-  if(it == __entryMap.end()){
-    // Over than last address.
-    if(__entryMap.size()){
-      it--; // Get last entry
+template <typename Piece, typename Hole>
+bool TIHex::walk(const Address address, uint64_t length, Piece piece, Hole hole, size_t *hint) {
+  if(!length) return true;
+  if(address + (length - 1) < address) return false; // Range wraps around.
+  // Index positions up to here start at or before current address.
+  size_t position = hint ? indexUpperBound(address, *hint) : indexUpperBound(address);
+  size_t count = __indexAddress.size();
+  Address current = address;
+  uint64_t done = 0;
+  while(done < length){
+    uint64_t remaining = length - done;
+    // Next entry start limits this piece: from there on, bytes belong to it.
+    uint64_t untilNext = position < count ? __indexAddress[position] - current : remaining;
+    uint64_t size = 0;
+    size_t index = 0;
+    uint64_t offset = 0;
+    if(position){
+      index = __indexEntry[position - 1];
+      offset = current - __indexAddress[position - 1];
+      if(offset < __entryList[index].byteCount) size = __entryList[index].byteCount - offset;
     }
-    else return false;
+    if(size){
+      size = std::min(std::min(size, remaining), untilNext);
+      if(!piece(index, offset, done, size)) return false;
+    }
+    else{
+      size = std::min(remaining, untilNext);
+      if(!hole(done, size)) return false;
+    }
+    done += size;
+    current += size;
+    while(position < count && __indexAddress[position] <= current) position++;
   }
-  else it--;
+  if(hint) *hint = position;
+  return true;
+}
 
-  // Checking the offset, if it exists.
-  auto offset = address - it->first;
-  auto& data = it->second->data;
-  if(offset >= data.size()) return false; // There is no data to overwrite.
+bool TIHex::overwrite(const Address address, const uint8_t *data, size_t length, bool calculateChecksum,
+                      Range *unwritten) {
+  sortIndex(); // Timed on its own.
+  PhaseTimer timer(__statistics, Statistics::Patch);
+  Range hole = {address, 0};
+  auto noPiece = [](size_t, uint64_t, uint64_t, uint64_t) { return true; };
+  auto findHole = [&](uint64_t rangeOffset, uint64_t size) {
+    hole.address = address + rangeOffset;
+    hole.length = size;
+    return false;
+  };
+  if(!walk(address, length, noPiece, findHole)){
+    if(!hole.length) hole.length = length; // Range wraps around: nothing is writable.
+    if(unwritten) *unwritten = hole;
+    __error = Error::AddressNotFound;
+    return false;
+  }
 
-  // Overwrite data.
-  data[offset] = byte;
-  if(calculateChecksum) fixChecksum(*it->second);
+  auto write = [&](size_t index, uint64_t offset, uint64_t rangeOffset, uint64_t size) {
+    auto entry = entryAt(index);
+    std::memcpy(entry.data() + offset, data + rangeOffset, size);
+    markModified(index);
+    if(calculateChecksum) updateChecksum(index);
+    return true;
+  };
+  auto noHole = [](uint64_t, uint64_t) { return true; };
+  walk(address, length, write, noHole);
+  timer.bytes = length;
+  __error = Error::None;
+  return true;
+}
 
+uint64_t TIHex::outputSize() {
+  uint64_t size = 0;
+  for(auto &header : __entryList) size += 1 + 2*(4 + header.byteCount + 1) + 1;
+  return size;
+}
+
+bool TIHex::read(const Address address, uint8_t *out, size_t length, uint8_t fill, std::vector<Range> *holes) {
+  bool complete = true;
+  auto copy = [&](size_t index, uint64_t offset, uint64_t rangeOffset, uint64_t size) {
+    std::memcpy(out + rangeOffset, __entryData.data() + __entryList[index].dataOffset + offset, size);
+    return true;
+  };
+  auto fillHole = [&](uint64_t rangeOffset, uint64_t size) {
+    std::memset(out + rangeOffset, fill, size);
+    complete = false;
+    if(holes){
+      Address start = address + rangeOffset;
+      if(!holes->empty() && holes->back().address + holes->back().length == start) holes->back().length += size;
+      else holes->push_back({start, size});
+    }
+    return true;
+  };
+  if(!walk(address, length, copy, fillHole)){
+    __error = Error::Overflow;
+    return false;
+  }
+  __error = complete ? Error::None : Error::AddressNotFound;
+  return complete;
+}
+
+bool TIHex::hash(const Address address, uint64_t length, Hash &hash, uint8_t pad, std::vector<Range> *holes) {
+  sortIndex(); // Timed on its own.
+  PhaseTimer timer(__statistics, Statistics::Checksum, length);
+  // Pieces continuing the previous one in the data arena are joined, so hashing runs over long spans.
+  const uint8_t *span = nullptr;
+  size_t spanSize = 0;
+  auto data = [&](size_t index, uint64_t offset, uint64_t, uint64_t size) {
+    const uint8_t *piece = __entryData.data() + __entryList[index].dataOffset + offset;
+    if(span && span + spanSize == piece){
+      spanSize += size;
+      return true;
+    }
+    if(span) hash.update(span, spanSize);
+    span = piece;
+    spanSize = size;
+    return true;
+  };
+  auto padHole = [&](uint64_t rangeOffset, uint64_t size) {
+    if(span) hash.update(span, spanSize);
+    span = nullptr;
+    hash.update(pad, size);
+    if(holes){
+      Address start = address + rangeOffset;
+      if(!holes->empty() && holes->back().address + holes->back().length == start) holes->back().length += size;
+      else holes->push_back({start, size});
+    }
+    return true;
+  };
+  if(!walk(address, length, data, padHole)){
+    __error = Error::Overflow;
+    return false;
+  }
+  if(span) hash.update(span, spanSize);
+  __error = Error::None;
+  return true;
+}
+
+bool TIHex::pieces(const PatchSet &patches, std::vector<PatchPiece> &pieces, Range *unwritten) {
+  size_t position = 0;
+  size_t first = pieces.size();
+  Range hole = {0, 0};
+  for(auto &patch : patches.patches()){
+    const uint8_t *data = patches.data(patch);
+    auto piece = [&](size_t index, uint64_t offset, uint64_t rangeOffset, uint64_t size) {
+      pieces.push_back({index, offset, size, data + rangeOffset});
+      return true;
+    };
+    auto findHole = [&](uint64_t rangeOffset, uint64_t size) {
+      hole = {patch.address + rangeOffset, size};
+      return false;
+    };
+    if(!walk(patch.address, patch.length, piece, findHole, &position)){
+      pieces.resize(first);
+      if(unwritten) *unwritten = hole;
+      __error = Error::AddressNotFound;
+      return false;
+    }
+  }
+  __error = Error::None;
   return true;
 }
 
+size_t TIHex::render(const Header &header, const uint8_t *data, char *out) {
+  char *p = out;
+  *p++ = header.startCode;
+  HexCodec::encodeByte(header.byteCount, p); p += 2;
+  HexCodec::encodeByte(header.address >> 8, p); p += 2;
+  HexCodec::encodeByte(header.address & 0xFF, p); p += 2;
+  HexCodec::encodeByte(header.recordType, p); p += 2;
+  HexCodec::encode(data, header.byteCount, p); p += 2*header.byteCount;
+  HexCodec::encodeByte(header.checksum, p); p += 2;
+  *p++ = '\n';
+  return p - out;
+}
+
+TIHex::Error TIHex::verifyLine(const char *line, size_t length, Header &header, uint8_t *data) const {
+  size_t p;
+  for(p = 0; p < length && (line[p] == ' ' || line[p] == '\t'); p++);
+  if(p == length || line[p] != ':') return Error::Malformed;
+  p++;
+  while(length > p && (line[length - 1] == '\r' || line[length - 1] == ' ' || line[length - 1] == '\t')) length--;
+  if(length - p < 5*2) return Error::Malformed;
+
+  int byteCount = HexCodec::decodeByte(line + p);
+  int addressHigh = HexCodec::decodeByte(line + p + 2);
+  int addressLow = HexCodec::decodeByte(line + p + 4);
+  int recordType = HexCodec::decodeByte(line + p + 6);
+  if((byteCount | addressHigh | addressLow | recordType) < 0) return Error::Malformed;
+  p += 8;
+  header.startCode = ':';
+  header.byteCount = byteCount;
+  header.address = (addressHigh << 8) | addressLow;
+  header.recordType = recordType;
+  if(header.address > TIHEX_ADDRESS_MAX_JUMP) return Error::InvalidJumpSize;
+  if(length - p != 2*(static_cast<size_t>(byteCount) + 1)) return Error::InvalidDataSize;
+
+  // Data and checksum in one vectorized decode, then summed: a valid record sums to zero.
+  if(!HexCodec::decode(line + p, byteCount + 1, data)) return Error::Malformed;
+  header.checksum = data[byteCount];
+  if(checksumOf(header, data) != header.checksum) return Error::Checksum;
+
+  static const int typeByteCount[6] = {-1, 0, 2, 4, 2, 4}; // -1: any.
+  if(recordType > 0x05) return Error::Malformed;
+  if(typeByteCount[recordType] >= 0 && byteCount != typeByteCount[recordType]) return Error::InvalidDataSize;
+  return Error::None;
+}
+
+bool TIHex::verify(const char *begin, const char *end, std::vector<Issue> *issues) {
+  PhaseTimer timer(__statistics, Statistics::Parse, end - begin);
+  __errorLine = 0;
+  __errorOffset = 0;
+  __error = Error::None;
+
+  Header header;
+  uint8_t data[256];
+  Address addressPointer = 0;
+  Address dataEnd = 0; // After last data record, 0 before the first one.
+  bool valid = true;
+  uint64_t lineNumber = 0;
+  for(const char *line = begin; line < end;){
+    const char *next = static_cast<const char *>(std::memchr(line, '\n', end - line));
+    if(!next) next = end;
+    lineNumber++;
+    if(next != line && line[0] != '\r'){ // Skips empty lines, as load() does.
+      Error error = verifyLine(line, next - line, header, data);
+      if(error == Error::None || error == Error::Checksum){
+        // Addresses of records with bad checksums are still followed, so later lines are checked in place.
+        Error placement = advance(header, data, addressPointer);
+        if(placement == Error::None && header.recordType == 0x00){
+          Address start = addressPointer - header.byteCount;
+          if(start < dataEnd) placement = Error::AddressOrder;
+          dataEnd = std::max(dataEnd, addressPointer);
+        }
+        if(error == Error::None) error = placement;
+      }
+      if(error != Error::None){
+        if(valid){
+          __error = error;
+          __errorLine = lineNumber;
+          __errorOffset = line - begin;
+          valid = false;
+        }
+        if(!issues) return false;
+        issues->push_back({error, lineNumber, static_cast<uint64_t>(line - begin)});
+      }
+    }
+    line = next + 1;
+  }
+  return valid;
+}
+
 TIHex::Address TIHex::upperAddress(const Address address) {
-    auto it = __entryMap.upper_bound(address);
-    if(it == __entryMap.end()){
+    size_t position = indexUpperBound(address);
+    if(position == __indexAddress.size()){
       __error = Error::UpperAddressNotFound;
       return std::numeric_limits<Address>::max();
     }
     __error = Error::None;
-    return it->first;
+    return __indexAddress[position];
+}
+
+// write() renders this much text before handing it over, big enough to make system calls rare.
+static const size_t OUTPUT_BLOCK_SIZE = 1 << 20;
+
+#ifdef TIHEX_POSIX
+/* Write a whole block, resuming after signals and partial writes. */
+static bool writeAll(int fd, const char *block, size_t size) {
+  while(size){
+    ssize_t n = ::write(fd, block, size);
+    if(n < 0){
+      if(errno == EINTR) continue;
+      return false;
+    }
+    block += n;
+    size -= n;
+  }
+  return true;
+}
+#endif
+
+template <typename Flush>
+bool TIHex::renderBlocks(Flush flush) {
+  finalize();
+  PhaseTimer timer(__statistics, Statistics::Write);
+  __outputBuffer.resize(OUTPUT_BLOCK_SIZE);
+  char *block = __outputBuffer.data();
+  size_t used = 0;
+  for(auto &header : __entryList){
+    if(used + RECORD_TEXT_MAX > OUTPUT_BLOCK_SIZE){
+      if(!flush(block, used)) return false;
+      timer.bytes += used;
+      used = 0;
+    }
+    used += render(header, __entryData.data() + header.dataOffset, block + used);
+  }
+  timer.bytes += used;
+  return !used || flush(block, used);
+}
+
+bool TIHex::write(int fd) {
+#ifdef TIHEX_POSIX
+  auto flush = [fd](const char *block, size_t size) { return writeAll(fd, block, size); };
+  bool ok = renderBlocks(flush);
+#else
+  (void)fd;
+  errno = ENOSYS;
+  bool ok = false;
+#endif
+  __error = ok ? Error::None : Error::Output;
+  return ok;
+}
+
+bool TIHex::write(std::ostream &stream) {
+  auto flush = [&stream](const char *block, size_t size) {
+    return static_cast<bool>(stream.write(block, size));
+  };
+  bool ok = renderBlocks(flush);
+  __error = ok ? Error::None : Error::Output;
+  return ok;
+}
+
+bool TIHex::write(char *buffer, size_t size) {
+  if(outputSize() > size){
+    __error = Error::BufferSize;
+    return false;
+  }
+  finalize();
+  PhaseTimer timer(__statistics, Statistics::Write);
+  char *p = buffer;
+  for(auto &header : __entryList) p += render(header, __entryData.data() + header.dataOffset, p);
+  timer.bytes = p - buffer;
+  __error = Error::None;
+  return true;
+}
+
+/* Holes at least this long are skipped by sparse exportBinary(), shorter ones are filled. */
+static const uint64_t SPARSE_HOLE_MIN = 1 << 16;
+
+bool TIHex::exportBinary(int fd, const Address address, uint64_t length, uint8_t fill, bool sparse) {
+#ifdef TIHEX_POSIX
+  sortIndex(); // Timed on its own.
+  PhaseTimer timer(__statistics, Statistics::Write, length);
+  __outputBuffer.resize(OUTPUT_BLOCK_SIZE);
+  char *block = __outputBuffer.data();
+  size_t used = 0;
+  bool skipped = false; // Output ends with a skipped hole.
+  bool failed = false;  // Output failed, not the walk.
+  auto flush = [&]() {
+    failed = !writeAll(fd, block, used);
+    used = 0;
+    return !failed;
+  };
+  auto piece = [&](size_t index, uint64_t offset, uint64_t, uint64_t size) {
+    if(used + size > OUTPUT_BLOCK_SIZE && !flush()) return false;
+    std::memcpy(block + used, __entryData.data() + __entryList[index].dataOffset + offset, size);
+    used += size;
+    skipped = false;
+    return true;
+  };
+  auto hole = [&](uint64_t, uint64_t size) {
+    if(sparse && size >= SPARSE_HOLE_MIN){
+      if(!flush()) return false;
+      failed = ::lseek(fd, static_cast<off_t>(size), SEEK_CUR) < 0;
+      skipped = true;
+      return !failed;
+    }
+    while(size){
+      if(used == OUTPUT_BLOCK_SIZE && !flush()) return false;
+      size_t part = static_cast<size_t>(std::min<uint64_t>(size, OUTPUT_BLOCK_SIZE - used));
+      std::memset(block + used, fill, part);
+      used += part;
+      size -= part;
+    }
+    skipped = false;
+    return true;
+  };
+  bool ok = walk(address, length, piece, hole) && flush();
+  if(ok && skipped){
+    // Seeking alone doesn't grow a file: give it its full size.
+    off_t end = ::lseek(fd, 0, SEEK_CUR);
+    ok = end >= 0 && ::ftruncate(fd, end) == 0;
+    failed = !ok;
+  }
+  __error = ok ? Error::None : failed ? Error::Output : Error::Overflow;
+  return ok;
+#else
+  (void)fd;
+  (void)address;
+  (void)length;
+  (void)fill;
+  (void)sparse;
+  errno = ENOSYS;
+  __error = Error::Output;
+  return false;
+#endif
+}
+
+bool TIHex::extent(Range &range) {
+  auto &all = segments();
+  if(all.empty()) return false;
+  range = {all.front().address, all.back().address + all.back().length - all.front().address};
+  return true;
+}
+
+void TIHex::find(const uint8_t *pattern, const uint8_t *mask, size_t length, std::vector<Address> &matches) {
+  matches.clear();
+  if(!length) return;
+  const ByteScan::Pattern search(pattern, mask, length);
+  // Matches starting on the first starts bytes of data, which holds starts + length - 1 bytes from address.
+  auto scan = [&](Address address, const uint8_t *data, size_t starts) {
+    const size_t size = starts + length - 1;
+    for(size_t offset = 0; offset < starts; offset++){
+      size_t found = search.find(data + offset, size - offset);
+      if(found == size - offset) break;
+      offset += found;
+      if(offset < starts) matches.push_back(address + offset);
+    }
+  };
+
+  // Scattered segments are searched in place too, run by run of records stored back to back. Matches across runs are
+  // searched on a copy of the last length - 1 bytes before the junction and up to length - 1 bytes after it.
+  std::vector<uint8_t> junction;
+  for(auto &segment : segments()){
+    if(segment.length < length) continue;
+    if(const uint8_t *data = segmentData(segment)){
+      scan(segment.address, data, segment.length - length + 1);
+      continue;
+    }
+    junction.clear();
+    const uint8_t *run = nullptr;
+    uint64_t runOffset = 0, runLength = 0;
+    auto searchRun = [&]() {
+      const Address address = segment.address + runOffset;
+      const size_t tail = junction.size();
+      junction.insert(junction.end(), run, run + std::min<uint64_t>(runLength, length - 1));
+      if(tail && junction.size() >= length) scan(address - tail, junction.data(), std::min(tail, junction.size() - length + 1));
+      if(runLength >= length) scan(address, run, runLength - length + 1);
+      // The last length - 1 bytes so far wait for the next junction.
+      if(runLength >= length - 1) junction.assign(run + runLength - (length - 1), run + runLength);
+      else if(junction.size() > length - 1) junction.erase(junction.begin(), junction.end() - (length - 1));
+    };
+    auto piece = [&](size_t index, uint64_t offset, uint64_t rangeOffset, uint64_t size) {
+      const uint8_t *data = __entryData.data() + __entryList[index].dataOffset + offset;
+      if(run && run + runLength == data){
+        runLength += size;
+        return true;
+      }
+      if(run) searchRun();
+      run = data;
+      runOffset = rangeOffset;
+      runLength = size;
+      return true;
+    };
+    auto noHole = [](uint64_t, uint64_t) { return false; }; // Segments have none.
+    walk(segment.address, segment.length, piece, noHole);
+    if(run) searchRun();
+  }
+}
+
+bool TIHex::importBinary(const uint8_t *data, size_t size, const Address address, uint8_t recordSize, bool sparse,
+                         uint8_t fill) {
+  PhaseTimer timer(__statistics, Statistics::Parse, size);
+  if(!recordSize){
+    __error = Error::InvalidDataSize;
+    return false;
+  }
+  if(!size){
+    __error = Error::None;
+    return true;
+  }
+  // Extended linear address records reach 32 bit addresses.
+  if(address > 0xFFFFFFFF || size - 1 > 0xFFFFFFFF - address){
+    __error = Error::Overflow;
+    return false;
+  }
+  // Other tools don't carry the upper address over 64 KiB boundaries: it is only known at file start (zero),
+  // and set by the records written here.
+  uint64_t upper = __entryList.empty() ? 0 : ~static_cast<uint64_t>(0);
+  size_t records = size / recordSize + 1;
+  __entryList.reserve(__entryList.size() + records + records / 4096 + 1);
+  __entryData.reserve(__entryData.size() + size);
+  __sourceOffsets.reserve(__sourceOffsets.size() + records + records / 4096 + 1);
+  auto push = [this](const Header &header, const uint8_t *bytes) {
+    Header stored = header;
+    stored.dataOffset = __entryData.size();
+    stored.checksum = checksumOf(stored, bytes);
+    __entryList.push_back(stored);
+    __entryData.insert(__entryData.end(), bytes, bytes + header.byteCount);
+    __sourceOffsets.push_back(NO_SOURCE);
+    placeEntry(__entryList.size() - 1);
+  };
+  for(uint64_t done = 0; done < size;){
+    Address current = address + done;
+    // Records don't cross 64 KiB boundaries: their 16 bit address would wrap around.
+    uint64_t length = std::min<uint64_t>(std::min<uint64_t>(recordSize, size - done), 0x10000 - (current & 0xFFFF));
+    const uint8_t *bytes = data + done;
+    done += length;
+    if(sparse && bytes[0] == fill && std::count(bytes, bytes + length, fill) == static_cast<ptrdiff_t>(length)) continue;
+    if(current >> 16 != upper){
+      upper = current >> 16;
+      uint8_t upperBytes[2] = {static_cast<uint8_t>(upper >> 8), static_cast<uint8_t>(upper)};
+      push(Header{0, 0, 2, 0x04, 0, ':', 0, 0}, upperBytes);
+    }
+    push(Header{0, static_cast<uint16_t>(current), static_cast<uint8_t>(length), 0x00, 0, ':', 0, 0}, bytes);
+  }
+  __error = Error::None;
+  return true;
+}
+
+template <typename Read, typename Flush>
+bool TIHex::streamBlocks(Read read, Flush flush, const PatchSet &patches, Range *unwritten) {
+  __errorLine = 0;
+  __errorOffset = 0;
+  __error = Error::None;
+  // Reads and writes are timed apart, decoding and patching get the rest.
+  PhaseTimer timer(__statistics, Statistics::Parse);
+  auto timedRead = [&](char *buffer, size_t size) -> long {
+    auto start = std::chrono::steady_clock::now();
+    long n = read(buffer, size);
+    double spent = seconds(start);
+    addTime(Statistics::Read, spent, n > 0 ? n : 0);
+    timer.bytes += n > 0 ? n : 0;
+    timer.excluded += spent;
+    return n;
+  };
+  auto timedFlush = [&](const char *block, size_t size) {
+    auto start = std::chrono::steady_clock::now();
+    bool ok = flush(block, size);
+    double spent = seconds(start);
+    addTime(Statistics::Write, spent, size);
+    timer.excluded += spent;
+    return ok;
+  };
+  auto &patchList = patches.patches();
+  // Patch bytes written so far, in patch data order.
+  std::vector<uint8_t> written(patchList.empty() ? 0 : patchList.back().dataOffset + patchList.back().length);
+  std::vector<char> input(OUTPUT_BLOCK_SIZE);
+  __outputBuffer.resize(OUTPUT_BLOCK_SIZE);
+  char *block = __outputBuffer.data();
+  size_t used = 0;
+  size_t filled = 0;      // Characters in input.
+  uint64_t consumed = 0;  // Input offset of input[0].
+  uint64_t lineNumber = 0;
+  Header header = Header();
+  std::vector<uint8_t> data;
+  data.reserve(255);
+
+  for(;;){
+    long n = timedRead(input.data() + filled, input.size() - filled);
+    if(n < 0){
+      __error = Error::Input;
+      return false;
+    }
+    filled += n;
+    bool last = n == 0;
+    size_t p = 0;
+    while(p < filled){
+      const char *line = input.data() + p;
+      const char *next = static_cast<const char *>(std::memchr(line, '\n', filled - p));
+      if(!next){
+        if(!last) break; // Incomplete line, wait for more input.
+        next = input.data() + filled;
+      }
+      lineNumber++;
+      if(next != line && line[0] != '\r'){ // Skips empty lines
+        data.clear();
+        Error error = decodeLine(line, next - line, header, data);
+        if(error == Error::None) error = advance(header, data.data(), __addressPointer);
+        if(error == Error::None && header.recordType < 6) __statistics.records[header.recordType]++;
+        if(error != Error::None){
+          if(used) timedFlush(block, used);
+          __error = error;
+          __errorLine = lineNumber;
+          __errorOffset = consumed + p;
+          return false;
+        }
+        if(header.recordType == 0x00 && header.byteCount){
+          __programCounter += header.byteCount;
+          Address start = __addressPointer - header.byteCount;
+          bool patched = false;
+          for(size_t k = patches.lowerBound(start); k < patchList.size() && patchList[k].address < __addressPointer; k++){
+            const PatchSet::Patch &patch = patchList[k];
+            Address from = std::max(start, patch.address);
+            Address to = std::min(__addressPointer - 1, patch.address + (patch.length - 1)); // Last patched address.
+            std::memcpy(data.data() + (from - start), patches.data(patch) + (from - patch.address), to - from + 1);
+            std::memset(&written[patch.dataOffset + (from - patch.address)], 1, to - from + 1);
+            patched = true;
+          }
+          if(patched) header.checksum = checksumOf(header, data.data());
+        }
+        if(used + RECORD_TEXT_MAX > OUTPUT_BLOCK_SIZE){
+          if(!timedFlush(block, used)){
+            __error = Error::Output;
+            return false;
+          }
+          used = 0;
+        }
+        used += render(header, data.data(), block + used);
+      }
+      p = next - input.data() + 1;
+    }
+    if(last) break;
+    // Keep the incomplete line for next read.
+    std::memmove(input.data(), input.data() + p, filled - p);
+    consumed += p;
+    filled -= p;
+    if(filled == input.size()){
+      __error = Error::Malformed; // No line is that long.
+      __errorLine = lineNumber + 1;
+      __errorOffset = consumed;
+      return false;
+    }
+  }
+  if(used && !timedFlush(block, used)){
+    __error = Error::Output;
+    return false;
+  }
+
+  // Report first patch range without data.
+  for(auto &patch : patchList){
+    auto first = std::find(written.begin() + patch.dataOffset, written.begin() + patch.dataOffset + patch.length, 0);
+    if(first == written.begin() + patch.dataOffset + patch.length) continue;
+    auto end = std::find(first, written.begin() + patch.dataOffset + patch.length, 1);
+    if(unwritten) *unwritten = {patch.address + (first - (written.begin() + patch.dataOffset)),
+                                static_cast<uint64_t>(end - first)};
+    __error = Error::AddressNotFound;
+    return false;
+  }
+  return true;
+}
+
+bool TIHex::stream(int in, int out, const PatchSet &patches, Range *unwritten) {
+#ifdef TIHEX_POSIX
+  auto read = [in](char *buffer, size_t size) -> long {
+    for(;;){
+      ssize_t n = ::read(in, buffer, size);
+      if(n >= 0 || errno != EINTR) return n;
+    }
+  };
+  auto flush = [out](const char *block, size_t size) { return writeAll(out, block, size); };
+  return streamBlocks(read, flush, patches, unwritten);
+#else
+  (void)in;
+  (void)out;
+  (void)patches;
+  (void)unwritten;
+  errno = ENOSYS;
+  __error = Error::Input;
+  return false;
+#endif
+}
+
+bool TIHex::stream(std::istream &in, std::ostream &out, const PatchSet &patches, Range *unwritten) {
+  auto read = [&in](char *buffer, size_t size) -> long {
+    in.read(buffer, size);
+    if(in.bad()) return -1;
+    return in.gcount();
+  };
+  auto flush = [&out](const char *block, size_t size) {
+    return static_cast<bool>(out.write(block, size));
+  };
+  return streamBlocks(read, flush, patches, unwritten);
+}
+
+bool TIHex::writeInPlace(int fd) {
+  finalize();
+  PhaseTimer timer(__statistics, Statistics::Write);
+  std::sort(__modifiedEntries.begin(), __modifiedEntries.end());
+  for(size_t index : __modifiedEntries){
+    if(__sourceOffsets[index] == NO_SOURCE){
+      __error = Error::NotInSource;
+      return false;
+    }
+  }
+#ifdef TIHEX_POSIX
+  // Data characters are followed by checksum ones: one write per entry.
+  char text[2*(255 + 1)];
+  for(size_t index : __modifiedEntries){
+    const Header &header = __entryList[index];
+    HexCodec::encode(__entryData.data() + header.dataOffset, header.byteCount, text);
+    HexCodec::encodeByte(header.checksum, text + 2*header.byteCount);
+    const char *p = text;
+    size_t size = 2*(header.byteCount + 1);
+    timer.bytes += size;
+    off_t offset = __sourceOffsets[index];
+    while(size){
+      ssize_t n = ::pwrite(fd, p, size, offset);
+      if(n < 0){
+        if(errno == EINTR) continue;
+        __error = Error::Output;
+        return false;
+      }
+      p += n;
+      size -= n;
+      offset += n;
+    }
+  }
+#else
+  (void)fd;
+  if(!__modifiedEntries.empty()){
+    errno = ENOSYS;
+    __error = Error::Output;
+    return false;
+  }
+#endif
+  for(size_t index : __modifiedEntries) __entryList[index].flags &= ~HEADER_MODIFIED;
+  __modifiedEntries.clear();
+  __error = Error::None;
+  return true;
+}
+
+/*
+ * State layout, native byte order, every array starting at a multiple of 8 bytes:
+ *  StateHeader, __entryList, __entryData, __indexAddress, __indexEntry (as uint64_t), __indexTop, __sourceOffsets.
+ */
+struct TIHex::StateHeader
+{
+    char magic[8];
+    uint32_t headerSize;  // sizeof(Header), rejects states from other layouts.
+    uint32_t byteOrder;
+    uint64_t entries;
+    uint64_t dataSize;
+    uint64_t indexSize;
+    uint64_t topSize;
+    uint64_t addressPointer;
+    uint64_t programCounter;
+};
+
+// Headers are written as they are: every byte must be a field, set when the header is built.
+static_assert(sizeof(TIHex::Header) == 8 + 2 + 6*1, "Header has padding bytes");
+
+static const char STATE_MAGIC[8] = {'T', 'I', 'H', 'E', 'X', 'S', 'T', '1'};
+static const uint32_t STATE_BYTE_ORDER = 0x01020304;
+
+static uint64_t stateAlign(uint64_t size) { return (size + 7) & ~static_cast<uint64_t>(7); }
+
+void TIHex::saveState(std::vector<char> &out) {
+  finalize();
+  sortIndex();
+  StateHeader state;
+  std::memcpy(state.magic, STATE_MAGIC, sizeof(state.magic));
+  state.headerSize = sizeof(Header);
+  state.byteOrder = STATE_BYTE_ORDER;
+  state.entries = __entryList.size();
+  state.dataSize = __entryData.size();
+  state.indexSize = __indexAddress.size();
+  state.topSize = __indexTop.size();
+  state.addressPointer = __addressPointer;
+  state.programCounter = __programCounter;
+
+  size_t begin = out.size();
+  uint64_t size = sizeof(state) + stateAlign(state.entries * sizeof(Header)) + stateAlign(state.dataSize) +
+                  8 * (2*state.indexSize + state.topSize + state.entries);
+  out.resize(begin + size);
+  char *p = &out[begin];
+  auto put = [&p](const void *data, uint64_t length) {
+    std::memcpy(p, data, length);
+    std::memset(p + length, 0, stateAlign(length) - length);
+    p += stateAlign(length);
+  };
+  put(&state, sizeof(state));
+  put(__entryList.data(), state.entries * sizeof(Header));
+  put(__entryData.data(), state.dataSize);
+  put(__indexAddress.data(), 8 * state.indexSize);
+  for(size_t index : __indexEntry){
+    uint64_t value = index;
+    put(&value, 8);
+  }
+  put(__indexTop.data(), 8 * state.topSize);
+  put(__sourceOffsets.data(), 8 * state.entries);
+}
+
+bool TIHex::loadState(const char *begin, const char *end) {
+  clear();
+  PhaseTimer timer(__statistics, Statistics::Parse, end - begin);
+  __errorLine = 0;
+  __errorOffset = 0;
+  StateHeader state;
+  uint64_t length = end - begin;
+  if(length < sizeof(state)){
+    __error = Error::Malformed;
+    return false;
+  }
+  std::memcpy(&state, begin, sizeof(state));
+  // Sizes are checked one by one, so that huge values can't overflow the total.
+  uint64_t available = length - sizeof(state);
+  bool valid = !std::memcmp(state.magic, STATE_MAGIC, sizeof(state.magic)) && state.headerSize == sizeof(Header) &&
+               state.byteOrder == STATE_BYTE_ORDER;
+  valid = valid && state.entries <= available / sizeof(Header) && state.dataSize <= available;
+  valid = valid && state.indexSize <= available / 8 && state.topSize <= available / 8;
+  valid = valid && stateAlign(state.entries * sizeof(Header)) + stateAlign(state.dataSize) +
+                   8 * (2*state.indexSize + state.topSize + state.entries) == available;
+  valid = valid && state.indexSize <= state.entries && state.topSize == (state.indexSize + INDEX_BLOCK_SIZE - 1) / INDEX_BLOCK_SIZE;
+  if(!valid){
+    __error = Error::Malformed;
+    return false;
+  }
+
+  const char *p = begin + sizeof(state);
+  auto get = [&p](void *data, uint64_t length) {
+    std::memcpy(data, p, length);
+    p += stateAlign(length);
+  };
+  __entryList.resize(state.entries);
+  __entryData.resize(state.dataSize);
+  __indexAddress.resize(state.indexSize);
+  __indexEntry.resize(state.indexSize);
+  __indexTop.resize(state.topSize);
+  __sourceOffsets.resize(state.entries);
+  get(__entryList.data(), state.entries * sizeof(Header));
+  get(__entryData.data(), state.dataSize);
+  get(__indexAddress.data(), 8 * state.indexSize);
+  for(auto &index : __indexEntry){
+    uint64_t value;
+    get(&value, 8);
+    index = value;
+    valid = valid && value < state.entries;
+  }
+  get(__indexTop.data(), 8 * state.topSize);
+  get(__sourceOffsets.data(), 8 * state.entries);
+  __segmentsValid = false; // Rebuilt from the index when asked for.
+  for(auto &header : __entryList){
+    header.flags = 0;
+    valid = valid && header.dataOffset <= state.dataSize && header.byteCount <= state.dataSize - header.dataOffset;
+  }
+  if(!valid){
+    clear();
+    __error = Error::Malformed;
+    return false;
+  }
+  __addressPointer = state.addressPointer;
+  __programCounter = state.programCounter;
+  __error = Error::None;
+  return true;
 }
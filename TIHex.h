@@ -32,13 +32,17 @@
  * 
  */
 
+#include <cstddef>
 #include <cstdint>
-#include <list>
-#include <map>
+#include <iterator>
 #include <vector>
 #include <string>
+#include <iosfwd>
 #include <limits>
 
+class Hash;
+class PatchSet;
+
 class TIHex
 {
 public:
@@ -48,19 +52,97 @@ public:
     /* Maximum jump between two address lines */
     uint16_t TIHEX_ADDRESS_MAX_JUMP = 65535; // 65535: no limit.
 
-    struct Entry
+    /* Record header as stored. Data bytes of all records share one buffer, starting at dataOffset. */
+    struct Header
     {
-        // Start code   Byte count   Address   Record type   Data   Checksum
-        char startCode;
-        uint8_t byteCount;
+        uint64_t dataOffset;
         uint16_t address;
+        uint8_t byteCount;
         uint8_t recordType;
-        std::vector<uint8_t> data;
         uint8_t checksum;
+        char startCode;
+        uint8_t flags;      // HEADER_* bits.
+        uint8_t reserved;   // Always zero, so saveState() never writes uninitialized padding.
+    };
+
+    /* Header flags: checksum must be calculated again, see setLazyChecksum(). */
+    static const uint8_t HEADER_DIRTY = 0x01;
+    /* Header flags: data was overwritten since load or last writeInPlace(). */
+    static const uint8_t HEADER_MODIFIED = 0x02;
+
+    /**
+     * @brief Lightweight view of a stored record.
+     * Valid until more records are appended or the object is cleared.
+     */
+    class Entry
+    {
+    public:
+        Entry(Header *header = nullptr, uint8_t *data = nullptr) : __header(header), __data(data) {}
+
+        // Start code   Byte count   Address   Record type   Data   Checksum
+        char startCode() const { return __header->startCode; }
+        uint8_t byteCount() const { return __header->byteCount; }
+        uint16_t address() const { return __header->address; }
+        uint8_t recordType() const { return __header->recordType; }
+        uint8_t *data() const { return __data; }
+        uint8_t checksum() const { return __header->checksum; }
+
+        /* Data size, always equal to byteCount(). */
+        size_t size() const { return __header->byteCount; }
+        uint8_t &operator[](size_t index) const { return __data[index]; }
+
+        Header &header() const { return *__header; }
+
+    private:
+        Header *__header;
+        uint8_t *__data;
     };
 
     typedef uint64_t Address;
 
+    /* Contiguous address range */
+    struct Range
+    {
+        Address address;
+        uint64_t length;
+    };
+
+    /* Run of contiguous data addresses, made of one or more records */
+    struct Segment
+    {
+        Address address;
+        uint64_t length;
+        uint64_t dataOffset;  // Offset of its bytes in record storage, SCATTERED when they are not back to back there.
+    };
+    static const uint64_t SCATTERED = ~static_cast<uint64_t>(0);
+
+    /* Run of addresses whose data differs between two images, see diff(). */
+    struct Difference
+    {
+        enum class Kind
+        {
+            Changed,  // Data on both images, different values.
+            Added,    // Data on the other image only.
+            Removed   // Data on this image only.
+        };
+        Kind kind;
+        Address address;
+        uint64_t length;
+    };
+
+    /* Part of a patch falling into one entry: length bytes from data, written at offset of entry data. */
+    struct PatchPiece
+    {
+        size_t entry;        // Entry position, in original order.
+        uint64_t offset;
+        uint64_t length;
+        const uint8_t *data;
+    };
+
+    /* Longest record text: start code, 2 characters for each of byte count, 2 address bytes, record type,
+       255 data bytes and checksum, and '\n'. */
+    static const size_t RECORD_TEXT_MAX = 1 + 2*(4 + 255 + 1) + 1;
+
     enum class Error
     {
         None,                 // No errors.
@@ -72,11 +154,123 @@ public:
         LowerAddressNotFound, // Address lower value not found.
         UpperAddressNotFound, // Address upper value not found.
         Overflow,             // 64 bit addressing overflown. In this case, please, chop the data using two or more TIHex objects.
+        Output,               // Output could not be written. Check errno when writing to a file descriptor.
+        BufferSize,           // Output buffer is too small, see outputSize().
+        Input,                // Input could not be read. Check errno when reading from a file descriptor.
+        NotInSource,          // A modified entry was not loaded by load(), so it has no place in its source text.
+        AddressOrder,         // Data record starts before the end of the previous one.
 
         Unknown
     };
 
-    typedef std::list<Entry>::iterator iterator;
+    /* Problem found by verify() on a line */
+    struct Issue
+    {
+        Error error;
+        uint64_t line;    // Line number, starting at 1.
+        uint64_t offset;  // Offset of the line from the verified text begin pointer.
+    };
+
+    /* Work done and memory held by an object, see statistics(). */
+    struct Statistics
+    {
+        enum Phase
+        {
+            Read,      // Getting input text, timed by callers with addTime(), and reads of stream().
+            Parse,     // load(), loadState(), importBinary(), verify() and the decoding part of stream(). Includes
+                       // reading the pages of memory mapped text, when callers only timed mapping it as Read.
+            Index,     // Sorting the address index after out of order records.
+            Patch,     // apply() and range overwrite().
+            Checksum,  // finalize() and hash().
+            Write,     // write(), writeInPlace(), exportBinary() and writes of stream().
+            PHASES
+        };
+
+        double seconds[PHASES];     // Wall time per phase.
+        uint64_t bytes[PHASES];     // Characters read, parsed and written, data bytes patched and checksummed.
+        uint64_t records[6];        // Records held, by record type 0x00 to 0x05. Records streamed for stream().
+        uint64_t dataBytes;         // Data bytes held.
+        uint64_t recordMemory;      // Bytes allocated for record headers and their source offsets (capacity).
+        uint64_t dataMemory;        // Bytes allocated for data.
+        uint64_t indexMemory;       // Bytes allocated for the address index and segments.
+        uint64_t recordUsed;        // Bytes of recordMemory in use (size), the rest being spare capacity.
+        uint64_t dataUsed;          // Bytes of dataMemory in use.
+        uint64_t indexUsed;         // Bytes of indexMemory in use.
+
+        static const char *phaseName(Phase phase);
+    };
+
+    /* Index position of the last lookup, see Cursor. Stale when generation is not the index generation. */
+    struct LookupHint
+    {
+        size_t position = 0;
+        uint64_t generation = 0;
+    };
+
+    /**
+     * @brief Byte access remembering where the last lookup landed. Lookups in the same record or the next one, as on
+     * sequential access, skip the index search. A cursor stays usable across edits and appends: once the index was
+     * rebuilt (out of order appends, clear(), loadState()) its next lookup searches the index again.
+     * Several cursors may walk the same image, e.g. a reader and a writer.
+     */
+    class Cursor
+    {
+    public:
+        explicit Cursor(TIHex &hex) : __hex(&hex) {}
+
+        /**
+         * @brief Same as TIHex::getValue(). Check error() of the image.
+         */
+        uint8_t getValue(Address address);
+
+        /**
+         * @brief Same as TIHex::overwrite() of one byte.
+         */
+        bool overwrite(Address address, uint8_t data, bool calculateChecksum = true);
+
+    private:
+        TIHex *__hex;
+        LookupHint __hint;
+    };
+
+    /* STL style bidirectional iterator over all entries, in original order. */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef Entry value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef Entry *pointer;
+        typedef Entry &reference;
+
+        iterator(TIHex *hex = nullptr, size_t index = 0) : __hex(hex), __index(index) {}
+
+        Entry &operator*() { __entry = __hex->entryAt(__index); return __entry; }
+        Entry *operator->() { return &operator*(); }
+        iterator &operator++() { __index++; return *this; }
+        iterator operator++(int) { iterator it = *this; __index++; return it; }
+        iterator &operator--() { __index--; return *this; }
+        iterator operator--(int) { iterator it = *this; __index--; return it; }
+        bool operator==(const iterator &other) const { return __index == other.__index; }
+        bool operator!=(const iterator &other) const { return __index != other.__index; }
+
+        /* Entry position, in original order. */
+        size_t index() const { return __index; }
+
+    private:
+        TIHex *__hex;
+        size_t __index;
+        Entry __entry;
+    };
+
+    /**
+     * @brief Add work done outside this object to statistics(), e.g. reading the input file.
+     */
+    void addTime(Statistics::Phase phase, double seconds, uint64_t bytes)
+    {
+        __statistics.seconds[phase] += seconds;
+        __statistics.bytes[phase] += bytes;
+    }
 
     /**
      * @brief Append a complete line assuming correct address ordering.
@@ -87,13 +281,44 @@ public:
      */
     bool append(const std::string &line);
 
+    /**
+     * @brief Append a complete line assuming correct address ordering.
+     * Same as append(const std::string&), but works directly over a character buffer: no temporary strings
+     * are built and no exceptions are thrown. Anything after the checksum (e.g. '\r') is ignored.
+     *
+     * @param line pointer to the first character of the line.
+     * @param length number of characters available on line.
+     * @return true when everything has gone fine, false to anything else. Check error().
+     */
+    bool append(const char *line, size_t length);
+
+    /**
+     * @brief Overwrite all patches of a set in one ordered sweep over the entries.
+     * Like overwrite() for ranges, nothing is written if any patch address has no data.
+     * Check error(): AddressNotFound when some patch address has no data.
+     *
+     * @param patches sorted patches, see PatchSet::sort().
+     * @param calculateChecksum update checksum of each written entry, once.
+     * @param unwritten when not null and false is returned, receives the first range without data.
+     * @return true on success, false otherwise.
+     */
+    bool apply(const PatchSet &patches, bool calculateChecksum = true, Range *unwritten = nullptr);
+
+    /**
+     * @brief Get entry at a position in original order, as iterators do.
+     *
+     * @param index entry position, lower than size().
+     * @return Entry view.
+     */
+    Entry at(size_t index) { return entryAt(index); }
+
     /**
      * @brief STL iterator. Get first entry iterator.
-     * Use iterator->first to get Address value and iterator->second to get Entry data.
+     * Dereference it to get an Entry view.
      *
      * @return begin iterator.
      */
-    iterator begin() { return __entryList.begin(); }
+    iterator begin() { finalize(); return iterator(this, 0); }
 
     /**
      * @brief Clear all appended data. Current address is going to reset to zero.
@@ -103,8 +328,18 @@ public:
     {
         __addressPointer = 0;
         __programCounter = 0;
-        __entryMap.clear();
+        __indexAddress.clear();
+        __indexEntry.clear();
+        __indexTop.clear();
+        __indexSorted = true;
+        __indexGeneration++;
         __entryList.clear();
+        __entryData.clear();
+        __dirtyEntries.clear();
+        __modifiedEntries.clear();
+        __sourceOffsets.clear();
+        __segments.clear();
+        __segmentsValid = true;
     }
 
     /**
@@ -122,12 +357,22 @@ public:
      */
     Address currentAddress() { return __addressPointer; }
 
+    /**
+     * @brief Compare data of this image, taken as the old one, with other, whatever their record layout.
+     * Segments of both are walked together and overlapping runs compared with ByteScan kernels, straight from record
+     * storage when their bytes are back to back there.
+     *
+     * @param other new image.
+     * @param differences receives maximal runs of each kind, in address order. Empty when data is the same.
+     */
+    void diff(TIHex &other, std::vector<Difference> &differences);
+
     /**
      * @brief Check if entry map is empty.
      *
      * @return true if it is empty, false otherwise.
      */
-    bool empty() { return __entryMap.empty(); }
+    bool empty() { return __indexAddress.empty(); }
 
     /**
      * @brief STL iterator. Get end iterator.
@@ -136,7 +381,7 @@ public:
      *
      * @return after last iterator.
      */
-    iterator end() { return __entryList.end(); }
+    iterator end() { return iterator(this, __entryList.size()); }
 
     /**
      * @brief Get last error occurred.
@@ -145,24 +390,98 @@ public:
      */
     Error error() { return __error; }
 
+    /**
+     * @brief Get the line number, starting at 1, where the last load() failed.
+     *
+     * @return line number. Zero if the last load() succeeded.
+     */
+    uint64_t errorLine() { return __errorLine; }
+
+    /**
+     * @brief Get the offset, from load() begin pointer, of the line where the last load() failed.
+     *
+     * @return offset in characters.
+     */
+    uint64_t errorOffset() { return __errorOffset; }
+
     /**
      * @brief Get last error message.
      *
      * @return Error message.
      */
-    const std::string errorString();
+    const std::string errorString() { return errorString(__error); }
 
     /**
-     * @brief Calculate the checksum based on entry reference.
+     * @brief Get the message of an error code, e.g. of a verify() issue.
+     *
+     * @return Error message.
+     */
+    static const std::string errorString(Error error);
+
+    /**
+     * @brief Record checksum: two's complement of header and data bytes sum.
+     *
+     * @param header record header.
+     * @param data header.byteCount data bytes.
+     * @return checksum byte.
+     */
+    static uint8_t checksumOf(const Header &header, const uint8_t *data);
+
+    /**
+     * @brief Calculate checksums of all entries changed while lazy checksum mode is on, in one pass.
+     * begin() and operator[] call it, so iterating for output always gives up to date checksums.
+     *
+     */
+    void finalize();
+
+    /**
+     * @brief Calculate the checksum of an entry.
      * Check error() if returned false.
      *
-     * @param address
+     * @param entry view of the entry to fix.
      * @return true if checksum was fixed. False if an error occurred.
      */
-    bool fixChecksum(Entry &entry);
+    bool fixChecksum(Entry entry);
+
+    /**
+     * @brief Write a range of data as a flat binary image, copying each run of record data at once, in large blocks.
+     * read() does the same into a caller buffer.
+     * Check error(): Output (check errno) when the file could not be written, Overflow when range wraps around 64 bit
+     * addressing.
+     *
+     * @param fd file descriptor open for writing.
+     * @param address first address, at file position 0.
+     * @param length number of bytes, see extent().
+     * @param fill value of addresses without data.
+     * @param sparse skip holes of 64 KiB or more with lseek() instead of writing fill, leaving holes in the file. They read
+     * as zeros, whatever fill is. fd must be seekable then.
+     * @return true on success, false otherwise.
+     */
+    bool exportBinary(int fd, const Address address, uint64_t length, uint8_t fill = 0xFF, bool sparse = false);
+
+    /**
+     * @brief Get the range from the first to the last data address, see segments().
+     *
+     * @param range receives the range.
+     * @return false if there is no data.
+     */
+    bool extent(Range &range);
+
+    /**
+     * @brief Find every address where a byte pattern starts, including overlapping ones. Patterns match across record
+     * boundaries, not across addresses without data. Data is searched in place, run by run of records stored back to
+     * back, see ByteScan::Pattern.
+     *
+     * @param pattern length bytes.
+     * @param mask length bytes, only bits set on them have to match: 00 for any byte, null to match whole bytes.
+     * @param length number of bytes.
+     * @param matches receives start addresses, in address order. Empty when there are none or length is 0.
+     */
+    void find(const uint8_t *pattern, const uint8_t *mask, size_t length, std::vector<Address> &matches);
 
     /**
      * @brief Get value by address. Use overwrite() to set value.
+     * Sequential calls are answered from the record of the previous call or the next one, see Cursor.
      * Check error().
      *
      * @param address
@@ -170,6 +489,61 @@ public:
      */
     uint8_t getValue(Address address);
 
+    /**
+     * @brief Hash a range of data straight from record storage, e.g. the CRC32 of a flash region before signing it.
+     * Addresses without data are hashed as pad bytes. Records stored back to back are handed to hash in one call.
+     * Check error(): Overflow when range wraps around 64 bit addressing.
+     *
+     * @param address first address.
+     * @param length number of bytes.
+     * @param hash receives the bytes, see Hash::final().
+     * @param pad value of addresses without data.
+     * @param holes when not null, ranges of addresses without data are appended to it, in address order.
+     * @return true on success, holes included, false on overflow.
+     */
+    bool hash(const Address address, uint64_t length, Hash &hash, uint8_t pad = 0xFF, std::vector<Range> *holes = nullptr);
+
+    /**
+     * @brief Append a flat binary image as data records, as if their lines were appended: recordSize bytes each,
+     * never crossing a 64 KiB boundary, with an Extended Linear Address record (0x04) whenever the upper 16 address bits
+     * differ from those of the previous one, zero at file start: an empty image gets no 0x04 record before data below
+     * 64 KiB. Appending after other records always starts with one. No End Of File record is appended.
+     * Check error(): Overflow when data goes past 32 bit addressing, InvalidDataSize when recordSize is 0.
+     *
+     * @param data first byte.
+     * @param size number of bytes.
+     * @param address address of the first byte.
+     * @param recordSize data bytes per record, 1 to 255.
+     * @param sparse leave out records made only of fill bytes, e.g. erased flash.
+     * @param fill see sparse.
+     * @return true on success, false otherwise. Nothing is appended then.
+     */
+    bool importBinary(const uint8_t *data, size_t size, const Address address, uint8_t recordSize = 16,
+                      bool sparse = false, uint8_t fill = 0xFF);
+
+    /**
+     * @brief Append all lines from a buffer, e.g. a whole memory mapped file.
+     * Lines are split in place on '\n'. Empty lines and lines starting with '\r' are skipped, so CRLF files are accepted.
+     * Loading stops on the first line that can't be appended: check error(), errorLine() and errorOffset().
+     * Lines before the failing one are kept, as if append() was called line by line.
+     *
+     * Large buffers may be decoded by several threads. A single pass over the decoded records then resolves the
+     * extended address records (0x02 and 0x04), so results and reported errors are the same as a serial load.
+     *
+     * @param begin first character.
+     * @param end after last character.
+     * @param threads number of worker threads. 0 picks one per hardware thread, 1 loads serially.
+     * @return true when all lines were appended, false otherwise.
+     */
+    bool load(const char *begin, const char *end, unsigned threads = 1);
+
+    /**
+     * @brief Check if lazy checksum mode is on. See setLazyChecksum().
+     *
+     * @return true when checksums are calculated by finalize(), false when they are calculated on each overwrite.
+     */
+    bool lazyChecksum() { return __lazyChecksum; }
+
     /**
      * @brief Get entry address with a value lower than provided.
      * E.g. entry address list = {0x1000,0x1500}, lowerAddress(0x1500) is going to return 0x1000.
@@ -181,7 +555,7 @@ public:
     Address lowerAddress(const Address address);
 
     /**
-     * @brief Overwrite data at desired address.
+     * @brief Overwrite data at desired address. Shares the last lookup position with getValue().
      *
      * @param address to overwrite
      * @param data that will be overwritten
@@ -189,32 +563,171 @@ public:
      */
     bool overwrite(const Address address, uint8_t &data,bool calculateChecksum = true);
 
+    /**
+     * @brief Overwrite a range of data, walking affected entries once.
+     * Each entry gets its part copied at once and its checksum calculated once.
+     * Nothing is written unless every address in range has data: check error() and unwritten.
+     *
+     * @param address first address to overwrite.
+     * @param data bytes that will be overwritten.
+     * @param length number of bytes.
+     * @param calculateChecksum update checksums of touched entries.
+     * @param unwritten when not null and false is returned, set to the first range of addresses without data.
+     * @return true when overwrite was done. False otherwise.
+     */
+    bool overwrite(const Address address, const uint8_t *data, size_t length, bool calculateChecksum = true,
+                   Range *unwritten = nullptr);
+
     /**
      * @brief Get entry by address.
      * Use contain() to check if address exists, otherwise it throws an exception.
      *
      * @param address Address to access entry.
-     * @return reference to entry.
+     * @return view of the entry.
      */
-    Entry& operator[](const Address address){
+    Entry operator[](const Address address){
         if(!contains(address)){
             throw "invalid address";
         }
-        return *__entryMap[address];
+        finalize();
+        return entryAt(__indexEntry[indexUpperBound(address) - 1]);
+    }
+
+    /**
+     * @brief Exact number of characters write() produces: one '\n' terminated line per entry.
+     *
+     * @return output size in bytes.
+     */
+    uint64_t outputSize();
+
+    /**
+     * @brief Split patches into the entry pieces apply() would write, in patch address order, without writing them.
+     * Nothing is appended if any patch address has no data. Check error(): AddressNotFound in that case.
+     *
+     * @param patches sorted patches, see PatchSet::sort(). Pieces point to their data.
+     * @param pieces receives the pieces.
+     * @param unwritten when not null and false is returned, receives the first range without data.
+     * @return true on success, false otherwise.
+     */
+    bool pieces(const PatchSet &patches, std::vector<PatchPiece> &pieces, Range *unwritten = nullptr);
+
+    /**
+     * @brief Get data as runs of contiguous addresses, in address order, e.g. for a flash programmer.
+     * Bytes belong to records as for getValue(). Segments are extended as records are appended in address order, so
+     * enumerating them costs O(segments). Records appended out of order, or overlapping, make the next call
+     * rebuild them from the index once. Overwrites don't change them.
+     * Valid until more records are appended or the object is cleared.
+     *
+     * @return segments.
+     */
+    const std::vector<Segment> &segments();
+
+    /**
+     * @brief Get segment bytes without copying them, when their records are stored back to back.
+     * Otherwise use read(). Valid until more records are appended or the object is cleared.
+     *
+     * @param segment one of segments().
+     * @return first byte, null if segment.dataOffset is SCATTERED.
+     */
+    const uint8_t *segmentData(const Segment &segment) const
+    {
+        return segment.dataOffset == SCATTERED ? nullptr : __entryData.data() + segment.dataOffset;
     }
 
+    /**
+     * @brief Replace all entries by a state saved by saveState(), copying its arrays without parsing anything.
+     * Check error(): Malformed when the state is invalid or was saved by a build with another Header layout.
+     *
+     * @param begin first byte of the state.
+     * @param end after last byte of the state.
+     * @return true on success, false otherwise. Entries are cleared on failure.
+     */
+    bool loadState(const char *begin, const char *end);
+
     /**
      * @brief Get program size. Includes all data entries, i.e. only recordType equals to 0x00.
      * @return program size.
      */
     uint64_t programSize(){return __programCounter;}
 
+    /**
+     * @brief Read a range of data, copying each entry part at once.
+     * Addresses without data are filled with fill, and optionally reported as holes.
+     * Check error(): AddressNotFound when there were holes, Overflow when range wraps around 64 bit addressing.
+     *
+     * @param address first address to read.
+     * @param out buffer with room for length bytes.
+     * @param length number of bytes.
+     * @param fill value of addresses without data.
+     * @param holes when not null, ranges of addresses without data are appended to it, in address order.
+     * @return true when every address had data, false otherwise.
+     */
+    bool read(const Address address, uint8_t *out, size_t length, uint8_t fill = 0xFF,
+              std::vector<Range> *holes = nullptr);
+
+    /**
+     * @brief Render one record as text, upper case hexadecimal, terminated by '\n'.
+     *
+     * @param header record header.
+     * @param data header.byteCount data bytes.
+     * @param out room for RECORD_TEXT_MAX characters.
+     * @return number of characters written.
+     */
+    static size_t render(const Header &header, const uint8_t *data, char *out);
+
+    /**
+     * @brief Append a binary snapshot of all entries, index and address pointer to out, see loadState().
+     * Pending lazy checksums are finalized. Modified flags are not saved.
+     *
+     * @param out buffer receiving the state.
+     */
+    void saveState(std::vector<char> &out);
+
+    /**
+     * @brief Turn lazy checksum mode on or off. Off by default.
+     * When on, overwrites asking to calculate checksums only flag touched entries, and finalize() calculates all of them
+     * at once. Results are the same as calculating them on each overwrite. Turning it off calls finalize().
+     *
+     * @param lazy true to turn it on.
+     */
+    void setLazyChecksum(bool lazy) { __lazyChecksum = lazy; if(!lazy) finalize(); }
+
+    /**
+     * @brief Edit records while copying them from input to output, keeping only one line in memory.
+     * Each line is parsed, patched where it intersects patches, checksum calculated again if patched, and rendered
+     * as write() does. Entries are not stored: memory stays bounded whatever the input size.
+     * Address pointer and program size carry on from previously appended entries.
+     * On parse errors, lines before the failing one are already written, see errorLine() and errorOffset().
+     * Patches are written to every record covering them, unlike overwrite(), which only writes the last entry
+     * starting at or before each address.
+     *
+     * @param in file descriptor open for reading. Check errno on Error::Input.
+     * @param out file descriptor open for writing. Check errno on Error::Output.
+     * @param patches sorted patches, see PatchSet::sort().
+     * @param unwritten when not null and there was no data for some patch address, receives the first such range.
+     * @return true when all input was written and all patches found data, false otherwise.
+     */
+    bool stream(int in, int out, const PatchSet &patches, Range *unwritten = nullptr);
+
+    /**
+     * @brief Edit records while copying them from input to output, keeping only one line in memory.
+     * See stream(int, int, const PatchSet&, Range*).
+     *
+     */
+    bool stream(std::istream &in, std::ostream &out, const PatchSet &patches, Range *unwritten = nullptr);
+
     /**
      * @brief Get entries size. Includes all non-data entries, i.e. recordType different from 0x00.
      * @return entries list size.
      */
     uint64_t size(){return __entryList.size();}
 
+    /**
+     * @brief Get time spent per phase since construction, and records and memory held.
+     * Only bulk operations are timed: single line append() and single byte overwrite() or getValue() are not.
+     */
+    Statistics statistics();
+
     /**
      * @brief Get entry address with a value greater than provided.
      * E.g. entry address list = {0x1000,0x1500}, upperAddress(0x1000) is going to return 0x1500.
@@ -225,14 +738,230 @@ public:
      */
     Address upperAddress(const Address address);
 
+    /**
+     * @brief Check text as load() would read it, without storing anything: line structure, byte counts, checksums,
+     * address overflow and address order. Stricter than load(), which ignores checksums and anything after them.
+     * Lines must start with ':', after optional blanks, and hold exactly the characters their byte count asks for.
+     * Record types must be 0x00 to 0x05, with the byte count their type requires. Data records must not start before
+     * the end of the previous data record.
+     * Addresses start at zero, whatever was appended before. The first issue sets error(), errorLine() and errorOffset().
+     *
+     * @param begin first character.
+     * @param end after last character.
+     * @param issues when null, stop on the first issue. Otherwise verify all lines, appending every issue to it.
+     * @return true when no issue was found, false otherwise.
+     */
+    bool verify(const char *begin, const char *end, std::vector<Issue> *issues = nullptr);
+
+    /**
+     * @brief Write data and checksum characters of modified entries back into the text given to load(), e.g. its file.
+     * Record lengths never change, so only those characters are written, in upper case, and the rest of the text is
+     * left as it was. Pending lazy checksums are finalized. Entries are no longer modified once it succeeds.
+     * Meant for a single load() call: offsets are relative to the text of the load() call that decoded each entry.
+     *
+     * @param fd file descriptor of the source text, open for writing. Check errno on Error::Output.
+     * @return true on success, false otherwise. Error::NotInSource, before writing anything, if a modified entry came
+     * from append().
+     */
+    bool writeInPlace(int fd);
+
+    /**
+     * @brief Write all entries as text to a file descriptor, in large blocks. Pending lazy checksums are finalized.
+     * Check errno if false is returned.
+     *
+     * @param fd file descriptor open for writing.
+     * @return true on success, false otherwise (Error::Output).
+     */
+    bool write(int fd);
+
+    /**
+     * @brief Write all entries as text to a stream, in large blocks. Pending lazy checksums are finalized.
+     *
+     * @param stream output stream.
+     * @return true on success, false if the stream failed (Error::Output).
+     */
+    bool write(std::ostream &stream);
+
+    /**
+     * @brief Write all entries as text to a caller buffer. Pending lazy checksums are finalized.
+     *
+     * @param buffer room for size characters. Nothing is written when it is too small.
+     * @param size buffer size, at least outputSize().
+     * @return true on success, false if buffer is too small (Error::BufferSize).
+     */
+    bool write(char *buffer, size_t size);
+
 private:
-    /* __entryMap stores all references to entries, according to each header's address */
-    std::map<Address, Entry *> __entryMap;
+    /**
+     * @brief Decode a line into header, appending its data bytes to data, without touching object state.
+     * header.dataOffset is set to data size before appending. data is left unchanged on errors.
+     *
+     * @return Error::None on success.
+     */
+    Error decodeLine(const char *line, size_t length, Header &header, std::vector<uint8_t> &data) const;
+
+    /**
+     * @brief Decode and check a line for verify(), without touching object state.
+     *
+     * @param data receives byteCount data bytes and the checksum, room for 256 bytes.
+     * @return Error::None when the line is valid.
+     */
+    Error verifyLine(const char *line, size_t length, Header &header, uint8_t *data) const;
+
+    /**
+     * @brief Process entry record type, moving address pointer and inserting data entries into the map.
+     *
+     * @return Error::None on success.
+     */
+    Error placeEntry(size_t index);
+
+    /**
+     * @brief Address pointer arithmetic of a record. Data records start at addressPointer - byteCount once it returns.
+     *
+     * @param header decoded record.
+     * @param data record data.
+     * @param addressPointer address pointer before the record, moved after it on success.
+     * @return Error::None on success, Error::Overflow if address pointer would wrap around.
+     */
+    static Error advance(const Header &header, const uint8_t *data, Address &addressPointer);
+
+    struct LoadChunk;
+    struct StateHeader;
+
+    /**
+     * @brief Decode all lines of a chunk, resolving addresses relative to the chunk input address pointer.
+     * Runs on worker threads: it doesn't touch object state.
+     */
+    void decodeChunk(LoadChunk &chunk) const;
+
+    /**
+     * @brief load() implementation splitting the buffer into newline aligned chunks decoded by worker threads.
+     */
+    bool loadParallel(const char *begin, const char *end, unsigned threads);
+
+    /**
+     * @brief Render all entries into __outputBuffer, handing each full block to flush(block, size).
+     *
+     * @return false as soon as flush returns false.
+     */
+    template <typename Flush>
+    bool renderBlocks(Flush flush);
+
+    /**
+     * @brief Read, edit and write blocks of lines, see stream().
+     * read(buffer, size) returns the number of characters read, 0 at end of input, negative on errors.
+     */
+    template <typename Read, typename Flush>
+    bool streamBlocks(Read read, Flush flush, const PatchSet &patches, Range *unwritten);
+
+    /**
+     * @brief Flag an entry as HEADER_MODIFIED, see writeInPlace().
+     */
+    void markModified(size_t index);
+
+    /**
+     * @brief Calculate entry checksum now, or flag it for finalize() in lazy checksum mode.
+     */
+    void updateChecksum(size_t index);
+
+    Entry entryAt(size_t index) { return Entry(&__entryList[index], __entryData.data() + __entryList[index].dataOffset); }
+
+    /**
+     * @brief Add a data entry to the address index. An entry already indexed at the same address is replaced.
+     * Appending in address order keeps the index sorted, otherwise it is sorted again on next lookup.
+     */
+    void indexEntry(Address address, size_t index);
+
+    /**
+     * @brief Sort the index if entries were appended out of address order.
+     */
+    void sortIndex();
+
+    /**
+     * @brief Two level branchless binary search over the index, sorting it first if needed.
+     *
+     * @return number of indexed addresses lower than or equal to address.
+     */
+    size_t indexUpperBound(const Address address);
+
+    /**
+     * @brief Same as indexUpperBound(address), scanning forward from a position for address or a lower one.
+     *
+     */
+    size_t indexUpperBound(const Address address, size_t from);
+
+    /**
+     * @brief Append a run of data addresses to __segments, extending the last segment when it touches it.
+     */
+    void addSegment(Address address, uint64_t length, uint64_t dataOffset);
+
+    /**
+     * @brief Find the data entry containing address.
+     *
+     * @param address to look for.
+     * @param index set to the entry index in __entryList.
+     * @param offset set to address offset inside entry data.
+     * @param hint index position of a previous lookup, tried first along with the next position. Updated.
+     * @return true when found.
+     */
+    bool locate(const Address address, size_t &index, uint64_t &offset, LookupHint &hint);
+
+    /**
+     * @brief Walk an address range in order, splitting it into data pieces and holes.
+     * Each piece comes from one entry: piece(entryIndex, entryOffset, rangeOffset, length).
+     * Holes are addresses without data: hole(rangeOffset, length).
+     * Both callbacks return false to stop walking.
+     * hint, when not null, is an index position for address or a lower one, and receives the position after the range.
+     *
+     * @return false if a callback stopped the walk or range overflows 64 bit addressing, true otherwise.
+     */
+    template <typename Piece, typename Hole>
+    bool walk(const Address address, uint64_t length, Piece piece, Hole hole, size_t *hint = nullptr);
+
+    /*
+     * Flat address index of data entries: start addresses, sorted, and their __entryList indexes.
+     * Two plain arrays keep searches on the address array only. __indexTop holds the first address of each block of
+     * 64 index positions: searches run over it, small enough to stay in cache, and then over a single block.
+     */
+    std::vector<Address> __indexAddress;
+    std::vector<size_t> __indexEntry;
+    std::vector<Address> __indexTop;
+    bool __indexSorted = true;
+    /* Changes whenever index positions move, making lookup hints stale. */
+    uint64_t __indexGeneration = 1;
+    /* Last lookup of getValue() and overwrite() */
+    LookupHint __lastHit;
+
+    /* Segments of data addresses, see segments(). Rebuilt from the index on next call when not valid. */
+    std::vector<Segment> __segments;
+    bool __segmentsValid = true;
+
+    /* All entries headers are stored in __entryList, including it's original order */
+    std::vector<Header> __entryList;
+
+    /* All entries data bytes, in original order */
+    std::vector<uint8_t> __entryData;
+
+    /* Indexes of entries flagged HEADER_DIRTY, waiting for finalize() */
+    std::vector<size_t> __dirtyEntries;
+    bool __lazyChecksum = false;
+
+    /* Indexes of entries flagged HEADER_MODIFIED */
+    std::vector<size_t> __modifiedEntries;
+
+    /* Offset of each entry first data character in its load() text, NO_SOURCE for appended entries */
+    std::vector<uint64_t> __sourceOffsets;
+    static const uint64_t NO_SOURCE = ~static_cast<uint64_t>(0);
+
+    /* Reused by write(), see OUTPUT_BLOCK_SIZE in TIHex.cpp */
+    std::vector<char> __outputBuffer;
 
-    /* All entries data are stored in __entryList, including it's original order */
-    std::list<Entry> __entryList;
+    /* Phase times and bytes, see statistics(). Counts are taken when asked for, except for stream(). */
+    Statistics __statistics = Statistics();
 
     Error __error;
+    uint64_t __errorLine = 0;
+    uint64_t __errorOffset = 0;
     Address __addressPointer = 0;
     uint64_t __programCounter = 0;
 };
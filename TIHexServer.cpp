@@ -0,0 +1,487 @@
+#include "TIHexServer.h"
+#include "HexCodec.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TIHEX_POSIX 1
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+const size_t TIHexServer::REQUEST_MAX;
+const uint64_t TIHexServer::RANGE_MAX;
+
+namespace
+{
+    /* Blank separated words of a request line. */
+    struct Words
+    {
+        const char *p;
+        const char *end;
+
+        bool next(std::string &word)
+        {
+            while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+            const char *begin = p;
+            while(p < end && *p != ' ' && *p != '\t' && *p != '\r') p++;
+            word.assign(begin, p);
+            return p > begin;
+        }
+    };
+
+    /* Hexadecimal number, up to 16 digits. */
+    bool parseNumber(const std::string &word, uint64_t &value)
+    {
+        if(word.empty() || word.size() > 16) return false;
+        value = 0;
+        for(char c : word){
+            int digit = HexCodec::digitTable[static_cast<uint8_t>(c)];
+            if(digit < 0) return false;
+            value = (value << 4) | digit;
+        }
+        return true;
+    }
+
+    std::string hexNumber(uint64_t value)
+    {
+        char text[17];
+        int i = 16;
+        text[i] = '\0';
+        do{
+            text[--i] = HexCodec::pairTable[2*(value & 0xF) + 1];
+            value >>= 4;
+        }while(value);
+        return text + i;
+    }
+
+    void fail(std::string &response, const std::string &message)
+    {
+        response = "ERR " + message + "\n";
+    }
+}
+
+TIHexServer::TIHexServer(unsigned threads) : __threads(threads) {
+  if(__threads == 0) __threads = std::max(1u, std::thread::hardware_concurrency());
+}
+
+std::shared_ptr<TIHexServer::Image> TIHexServer::find(const std::string &name) {
+  std::lock_guard<std::mutex> lock(__imagesMutex);
+  auto it = __images.find(name);
+  return it == __images.end() ? nullptr : it->second;
+}
+
+void TIHexServer::request(const char *line, size_t length, std::string &response) {
+  Words words = {line, line + length};
+  std::string command, name;
+  if(!words.next(command)){
+    fail(response, "empty request");
+    return;
+  }
+  if(command != "LOAD" && command != "UNLOAD" && command != "READ" && command != "CHECKSUM" && command != "WRITE" &&
+     command != "SERIALIZE"){
+    fail(response, "unknown command");
+    return;
+  }
+  if(!words.next(name)){
+    fail(response, "missing image name");
+    return;
+  }
+
+  if(command == "LOAD"){
+    std::string filename;
+    if(!words.next(filename)){
+      fail(response, "missing file name");
+      return;
+    }
+    // Parse without holding any lock, then swap the new image in.
+    std::shared_ptr<Image> image = std::make_shared<Image>();
+    MappedFile input;
+    if(!input.open(filename)){
+      fail(response, std::strerror(errno));
+      return;
+    }
+    if(!image->hex.load(input.begin(), input.end())){
+      fail(response, image->hex.errorString() + " on line " + std::to_string(image->hex.errorLine()));
+      return;
+    }
+    image->hex.setLazyChecksum(true); // Checksums are calculated once per record, when serialized.
+    response = "OK " + hexNumber(image->hex.size()) + "\n";
+    std::lock_guard<std::mutex> lock(__imagesMutex);
+    __images[name] = image;
+    return;
+  }
+  if(command == "UNLOAD"){
+    std::lock_guard<std::mutex> lock(__imagesMutex);
+    if(!__images.erase(name)){
+      fail(response, "unknown image");
+      return;
+    }
+    response = "OK\n";
+    return;
+  }
+
+  std::shared_ptr<Image> image = find(name);
+  if(!image){
+    fail(response, "unknown image");
+    return;
+  }
+  std::string word;
+  if(command == "READ" || command == "CHECKSUM"){
+    uint64_t address, size;
+    if(!words.next(word) || !parseNumber(word, address) || !words.next(word) || !parseNumber(word, size)){
+      fail(response, "expected address and length");
+      return;
+    }
+    if(size > RANGE_MAX){
+      fail(response, "range too long");
+      return;
+    }
+    if(size && address + (size - 1) < address){
+      fail(response, "range wraps around 64 bit addressing");
+      return;
+    }
+    std::vector<uint8_t> data(size);
+    {
+      std::lock_guard<std::mutex> lock(image->mutex);
+      image->hex.read(address, data.data(), data.size());
+    }
+    if(command == "READ"){
+      response = "OK ";
+      response.resize(3 + 2*size);
+      HexCodec::encode(data.data(), size, &response[3]);
+      response += '\n';
+    }
+    else{
+      uint32_t sum = 0;
+      for(uint8_t byte : data) sum += byte;
+      response = "OK " + hexNumber(sum) + "\n";
+    }
+    return;
+  }
+  if(command == "WRITE"){
+    uint64_t address;
+    if(!words.next(word) || !parseNumber(word, address)){
+      fail(response, "expected address");
+      return;
+    }
+    std::string bytes;
+    std::vector<uint8_t> data;
+    while(words.next(bytes)){
+      size_t count = bytes.size() / 2;
+      data.resize(data.size() + count);
+      if(bytes.size() % 2 || !HexCodec::decode(bytes.data(), count, data.data() + data.size() - count)){
+        fail(response, "malformed data");
+        return;
+      }
+    }
+    if(data.empty() || address + (data.size() - 1) < address){
+      fail(response, "expected data");
+      return;
+    }
+    TIHex::Range unwritten;
+    bool ok;
+    {
+      std::lock_guard<std::mutex> lock(image->mutex);
+      ok = image->hex.overwrite(address, data.data(), data.size(), true, &unwritten);
+    }
+    if(!ok){
+      fail(response, "address " + hexNumber(unwritten.address) + " has no data");
+      return;
+    }
+    response = "OK\n";
+    return;
+  }
+  if(command == "SERIALIZE"){
+    std::string filename;
+    bool toFile = words.next(filename);
+    std::lock_guard<std::mutex> lock(image->mutex);
+    uint64_t size = image->hex.outputSize();
+    if(toFile){
+      std::FILE *file = std::fopen(filename.c_str(), "wb");
+      bool ok = file && image->hex.write(fileno(file));
+      int error = errno;
+      if(file && std::fclose(file) != 0 && ok){
+        ok = false;
+        error = errno;
+      }
+      if(!ok){
+        fail(response, std::strerror(error));
+        return;
+      }
+      response = "OK " + hexNumber(size) + "\n";
+      return;
+    }
+    response = "OK " + hexNumber(size) + "\n";
+    size_t header = response.size();
+    response.resize(header + size);
+    image->hex.write(&response[header], size);
+    return;
+  }
+  fail(response, "unknown command");
+}
+
+#ifdef TIHEX_POSIX
+
+namespace
+{
+    /* Connection state, only touched by the polling thread. */
+    struct Connection
+    {
+        std::vector<char> input = std::vector<char>(4096);
+        size_t used = 0;      // Characters in input.
+        size_t scanned = 0;   // Characters of input known to hold no '\n'.
+        std::string output;   // Replies not sent yet, from sent on.
+        size_t sent = 0;
+        bool busy = false;    // A request is with the workers: the next one waits, so replies keep request order.
+        bool ended = false;   // Nothing more to read: client closed its side, or the connection failed.
+        bool failed = false;  // Replies can't be sent anymore.
+
+        /* Length of the first complete request line, or false when there is none yet. */
+        bool line(size_t &length)
+        {
+            const char *newline = static_cast<const char *>(std::memchr(input.data() + scanned, '\n', used - scanned));
+            if(!newline){
+                scanned = used;
+                return false;
+            }
+            length = newline - input.data();
+            return true;
+        }
+
+        /* Reading waits while a complete request or replies are pending, so a client can't queue up unbounded work. */
+        bool wantsInput()
+        {
+            size_t length;
+            return !ended && sent == output.size() && !line(length);
+        }
+
+        void receive(int fd)
+        {
+            if(used == input.size()){
+                if(input.size() >= TIHexServer::REQUEST_MAX){ // Request line too long.
+                    ended = failed = true;
+                    return;
+                }
+                input.resize(std::min<size_t>(input.size() * 2, TIHexServer::REQUEST_MAX));
+            }
+            ssize_t n = ::read(fd, input.data() + used, input.size() - used);
+            if(n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            if(n < 0) failed = true;
+            if(n <= 0) ended = true;
+            else used += n;
+        }
+
+        /* Send replies until done or the socket is full, resuming after signals and partial writes. */
+        void send(int fd)
+        {
+            while(sent < output.size() && !failed){
+                ssize_t n = ::write(fd, output.data() + sent, output.size() - sent);
+                if(n < 0 && errno == EINTR) continue;
+                if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+                if(n < 0) ended = failed = true;
+                else sent += n;
+            }
+            output.clear();
+            sent = 0;
+        }
+
+        /* Connection can be closed: client is gone or done, and every reply was sent. */
+        bool finished()
+        {
+            size_t length;
+            return !busy && (failed || (ended && sent == output.size() && !line(length)));
+        }
+    };
+
+    bool setNonBlocking(int fd)
+    {
+        int flags = ::fcntl(fd, F_GETFL);
+        return flags >= 0 && ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+    }
+}
+
+void TIHexServer::work() {
+  for(;;){
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(__jobsMutex);
+      __pendingReady.wait(lock, [this]() { return !__pending.empty() || __stopping; });
+      if(__pending.empty()) return;
+      job = std::move(__pending.front());
+      __pending.pop_front();
+    }
+    request(job.line.data(), job.line.size(), job.response);
+    {
+      std::lock_guard<std::mutex> lock(__jobsMutex);
+      __done.push_back(std::move(job));
+    }
+    char byte = 0;
+    while(::write(__wake[1], &byte, 1) < 0 && errno == EINTR); // A full pipe already wakes the polling thread up.
+  }
+}
+
+bool TIHexServer::serve(const std::string &path) {
+  struct sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if(path.size() >= sizeof(address.sun_path)){
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+  // Replies to clients gone away must fail with EPIPE instead of ending the process.
+  std::signal(SIGPIPE, SIG_IGN);
+  int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if(listener < 0) return false;
+  struct stat status;
+  if(::lstat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) ::unlink(path.c_str()); // Left by an older server.
+  // Connecting needs write permission on the socket file: only its owner gets it. No other thread runs yet, so
+  // changing the process umask around bind() can't affect other files.
+  mode_t mask = ::umask(0177);
+  bool bound = ::bind(listener, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == 0;
+  ::umask(mask);
+  if(!bound || ::listen(listener, 128) != 0 || !setNonBlocking(listener) || ::pipe(__wake) != 0 ||
+     !setNonBlocking(__wake[0]) || !setNonBlocking(__wake[1])){
+    int error = errno;
+    ::close(listener);
+    for(int &fd : __wake){
+      if(fd >= 0) ::close(fd);
+      fd = -1;
+    }
+    errno = error;
+    return false;
+  }
+
+  __stopping = false;
+  std::vector<std::thread> workers;
+  for(unsigned t = 0; t < __threads; t++) workers.emplace_back(&TIHexServer::work, this);
+  std::map<int, Connection> connections;
+  std::vector<struct pollfd> polled;
+  std::deque<Job> done;
+  int error = 0;
+  while(listener >= 0 || !connections.empty()){
+    polled.clear();
+    polled.push_back({__wake[0], POLLIN, 0});
+    if(listener >= 0) polled.push_back({listener, POLLIN, 0});
+    size_t firstConnection = polled.size();
+    for(auto &entry : connections){
+      // Connections waiting for the workers only are left out (negative fd): hang ups would wake poll() up again and again.
+      Connection &connection = entry.second;
+      short events = (connection.wantsInput() ? POLLIN : 0) | (connection.sent < connection.output.size() ? POLLOUT : 0);
+      polled.push_back({events ? entry.first : -1, events, 0});
+    }
+    if(::poll(polled.data(), polled.size(), -1) < 0){
+      if(errno == EINTR) continue;
+      error = errno;
+      break;
+    }
+
+    // Replies done by workers.
+    if(polled[0].revents){
+      char bytes[256];
+      while(::read(__wake[0], bytes, sizeof bytes) > 0);
+      std::lock_guard<std::mutex> lock(__jobsMutex);
+      done.swap(__done);
+    }
+    for(auto &job : done){
+      Connection &connection = connections[job.fd];
+      connection.busy = false;
+      if(connection.output.empty()) connection.output.swap(job.response);
+      else connection.output += job.response;
+      connection.send(job.fd);
+    }
+    done.clear();
+
+    // New connections.
+    if(listener >= 0 && polled[1].revents){
+      for(;;){
+        int fd = ::accept(listener, nullptr, nullptr);
+        if(fd < 0){
+          if(errno == EINTR || errno == ECONNABORTED) continue;
+          if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+          // Stop listening: connections already accepted are still served.
+          error = errno;
+          ::close(listener);
+          listener = -1;
+          break;
+        }
+        if(!setNonBlocking(fd)){
+          ::close(fd);
+          continue;
+        }
+        connections[fd];
+      }
+    }
+
+    // Requests and replies. Connections accepted above are polled on next round.
+    for(size_t p = firstConnection; p < polled.size(); p++){
+      auto it = connections.find(polled[p].fd);
+      if(it == connections.end()) continue;
+      Connection &connection = it->second;
+      if(polled[p].revents & POLLOUT) connection.send(it->first);
+      if(polled[p].revents & (POLLIN | POLLHUP | POLLERR) && connection.wantsInput()) connection.receive(it->first);
+    }
+    for(auto it = connections.begin(); it != connections.end();){
+      Connection &connection = it->second;
+      size_t length;
+      if(!connection.busy && !connection.failed && connection.line(length)){
+        Job job;
+        job.fd = it->first;
+        job.line.assign(connection.input.data(), length);
+        connection.used -= length + 1;
+        std::memmove(connection.input.data(), connection.input.data() + length + 1, connection.used);
+        connection.scanned = 0;
+        connection.busy = true;
+        std::lock_guard<std::mutex> lock(__jobsMutex);
+        __pending.push_back(std::move(job));
+        __pendingReady.notify_one();
+      }
+      if(connection.finished()){
+        ::close(it->first);
+        it = connections.erase(it);
+      }
+      else ++it;
+    }
+  }
+
+  // Workers finish queued requests.
+  {
+    std::lock_guard<std::mutex> lock(__jobsMutex);
+    __stopping = true;
+  }
+  __pendingReady.notify_all();
+  for(auto &thread : workers) thread.join();
+  __done.clear();
+  for(auto &entry : connections) ::close(entry.first);
+  if(listener >= 0) ::close(listener);
+  for(int &fd : __wake){
+    ::close(fd);
+    fd = -1;
+  }
+  errno = error;
+  return false;
+}
+
+#else
+
+bool TIHexServer::serve(const std::string &path) {
+  (void)path;
+  errno = ENOSYS;
+  return false;
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef TIHEXSERVER_H
+#define TIHEXSERVER_H
+
+/**
+ * @file TIHexServer.h
+ * @author Fabricio Ribeiro Toloczko
+ * @brief Resident process keeping parsed images in memory, serving requests from clients over a Unix socket.
+ * Clients skip process start and parsing: each request only pays a socket round trip and the work itself.
+ *
+ * Requests and replies are text lines. Names are image names chosen by clients, numbers are hexadecimal:
+ *
+ *    LOAD name file              parse file as image name, replacing any image with that name.  OK entries
+ *    UNLOAD name                 forget an image.                                               OK
+ *    READ name address length    read data, addresses without data read as FF.                  OK bytes
+ *    WRITE name address bytes    overwrite data, as TIHex::overwrite() does for ranges.         OK
+ *    SERIALIZE name              image text.                                                    OK size, then size characters
+ *    SERIALIZE name file         write image text to a file.                                    OK size
+ *    CHECKSUM name address length  32 bit sum of data bytes, addresses without data read as FF. OK sum
+ *
+ * Failed requests get "ERR message". A client may send many requests on one connection, one reply each, in order.
+ *
+ * One thread polls the socket and all connections, queueing each complete request line to a pool of worker threads, so
+ * any number of clients may stay connected while the pool only ever holds requests ready to run. Requests of one
+ * connection run one at a time, in order. The socket file is only accessible to the user running the server (0600).
+ *
+ * @copyright Copyright (c) 2022
+ * License: ZLib, see TIHex.h.
+ */
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "TIHex.h"
+
+class TIHexServer
+{
+public:
+    /**
+     * @brief Longest request line accepted, in characters. Longer requests close their connection.
+     */
+    static const size_t REQUEST_MAX = 1 << 20;
+
+    /**
+     * @brief Longest range a READ or CHECKSUM request may ask for, in bytes.
+     */
+    static const uint64_t RANGE_MAX = 1 << 26;
+
+    /**
+     * @param threads number of threads running requests, 0 for one per hardware thread.
+     */
+    explicit TIHexServer(unsigned threads = 0);
+
+    TIHexServer(const TIHexServer &) = delete;
+    TIHexServer &operator=(const TIHexServer &) = delete;
+
+    /**
+     * @brief Process one request line, replacing response by its reply lines. Safe to call from several threads at once:
+     * the image list and each image have their own lock, so requests on different images run in parallel.
+     *
+     * @param line request characters, without '\n'.
+     * @param length number of characters.
+     * @param response receives the reply.
+     */
+    void request(const char *line, size_t length, std::string &response);
+
+    /**
+     * @brief Listen on a Unix socket and serve connections. Only returns on errors: when accepting connections fails,
+     * once the connections already accepted were served. An existing socket file at path is replaced. Check errno.
+     *
+     * @param path socket file name.
+     * @return false, when the socket could not be set up or accepting connections failed.
+     */
+    bool serve(const std::string &path);
+
+private:
+    /* Parsed image. Its lock is held while a request uses it. */
+    struct Image
+    {
+        std::mutex mutex;
+        TIHex hex;
+    };
+
+    /**
+     * @brief Find an image by name.
+     *
+     * @return image, null if there is none.
+     */
+    std::shared_ptr<Image> find(const std::string &name);
+
+    /* Request line of a connection, then its reply */
+    struct Job
+    {
+        int fd;
+        std::string line;
+        std::string response;
+    };
+
+    /**
+     * @brief Worker thread: take jobs from __pending, reply to them into __done and wake the polling thread, until
+     * __stopping and none is left.
+     */
+    void work();
+
+    unsigned __threads;
+
+    /* Images by name. Replaced images stay alive while requests still use them. */
+    std::map<std::string, std::shared_ptr<Image>> __images;
+    std::mutex __imagesMutex;
+
+    /* Requests waiting for a worker, and replies waiting for the polling thread */
+    std::deque<Job> __pending;
+    std::deque<Job> __done;
+    std::mutex __jobsMutex;
+    std::condition_variable __pendingReady;
+    bool __stopping = false;
+
+    /* Pipe written by workers to wake the polling thread up when a reply is done */
+    int __wake[2] = {-1, -1};
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include "TIHexVariants.h"
+#include "PatchSet.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TIHEX_POSIX 1
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+TIHexVariants::TIHexVariants(TIHex &base) : __base(base) {
+  base.finalize();
+  __text.resize(base.outputSize());
+  base.write(&__text[0], __text.size());
+  __lineOffsets.resize(base.size() + 1);
+  uint64_t offset = 0;
+  for(size_t i = 0; i < base.size(); i++){
+    __lineOffsets[i] = offset;
+    offset += 1 + 2*(4 + base.at(i).byteCount() + 1) + 1;
+  }
+  __lineOffsets[base.size()] = offset;
+}
+
+bool TIHexVariants::add(const PatchSet &patches, TIHex::Range *unwritten) {
+  std::vector<TIHex::PatchPiece> pieces;
+  if(!__base.pieces(patches, pieces, unwritten)) return false;
+  // Pieces of the same entry don't overlap, patches are merged. Copy each changed entry once.
+  std::stable_sort(pieces.begin(), pieces.end(),
+                   [](const TIHex::PatchPiece &a, const TIHex::PatchPiece &b) { return a.entry < b.entry; });
+  Variant variant;
+  uint8_t data[255];
+  for(size_t i = 0; i < pieces.size();){
+    auto entry = __base.at(pieces[i].entry);
+    TIHex::Header header = entry.header();
+    std::memcpy(data, entry.data(), entry.size());
+    size_t next = i;
+    for(; next < pieces.size() && pieces[next].entry == pieces[i].entry; next++){
+      std::memcpy(data + pieces[next].offset, pieces[next].data, pieces[next].length);
+    }
+    header.checksum = TIHex::checksumOf(header, data);
+    Line line = {pieces[i].entry, variant.text.size(), 0};
+    variant.text.resize(line.textOffset + TIHex::RECORD_TEXT_MAX);
+    line.textLength = TIHex::render(header, data, &variant.text[line.textOffset]);
+    variant.text.resize(line.textOffset + line.textLength);
+    variant.lines.push_back(line);
+    i = next;
+  }
+  __variants.push_back(std::move(variant));
+  return true;
+}
+
+uint64_t TIHexVariants::outputSize(size_t variant) const {
+  uint64_t size = __text.size();
+  for(auto &line : __variants[variant].lines){
+    size += line.textLength;
+    size -= __lineOffsets[line.entry + 1] - __lineOffsets[line.entry];
+  }
+  return size;
+}
+
+template <typename Emit>
+void TIHexVariants::spans(size_t variant, Emit emit) const {
+  const Variant &v = __variants[variant];
+  size_t entry = 0; // First entry not emitted yet.
+  for(auto &line : v.lines){
+    if(line.entry > entry) emit(__text.data() + __lineOffsets[entry], __lineOffsets[line.entry] - __lineOffsets[entry]);
+    emit(v.text.data() + line.textOffset, line.textLength);
+    entry = line.entry + 1;
+  }
+  size_t count = __lineOffsets.size() - 1;
+  if(count > entry) emit(__text.data() + __lineOffsets[entry], __lineOffsets[count] - __lineOffsets[entry]);
+}
+
+void TIHexVariants::write(size_t variant, char *buffer) const {
+  spans(variant, [&buffer](const char *text, size_t size) {
+    std::memcpy(buffer, text, size);
+    buffer += size;
+  });
+}
+
+#ifdef TIHEX_POSIX
+
+/* Write all iovecs, resuming after signals and partial writes. iov is modified. */
+static bool writevAll(int fd, struct iovec *iov, int count) {
+  while(count){
+    ssize_t n = ::writev(fd, iov, count);
+    if(n < 0){
+      if(errno == EINTR) continue;
+      return false;
+    }
+    while(count && static_cast<size_t>(n) >= iov->iov_len){
+      n -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if(count){
+      iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+      iov->iov_len -= n;
+    }
+  }
+  return true;
+}
+
+bool TIHexVariants::write(size_t variant, int fd) const {
+  // Base spans go straight from shared text to the kernel, interleaved with changed lines.
+  const int batch = 1024; // IOV_MAX on Linux and macOS.
+  struct iovec iov[batch];
+  int count = 0;
+  bool ok = true;
+  spans(variant, [&](const char *text, size_t size) {
+    if(!ok) return;
+    iov[count].iov_base = const_cast<char *>(text);
+    iov[count].iov_len = size;
+    if(++count == batch){
+      ok = writevAll(fd, iov, count);
+      count = 0;
+    }
+  });
+  return ok && writevAll(fd, iov, count);
+}
+
+bool TIHexVariants::writeFiles(const std::vector<std::string> &filenames, unsigned threads, size_t *failed) const {
+  if(threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t count = std::min(filenames.size(), __variants.size());
+  threads = std::min<size_t>(threads, std::max<size_t>(count, 1));
+  std::atomic<size_t> next(0);
+  std::mutex failure;
+  bool ok = true;
+  int error = 0;
+  size_t failedVariant = 0;
+  auto worker = [&]() {
+    for(size_t variant = next++; variant < count; variant = next++){
+      int fd = ::open(filenames[variant].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      bool written = fd >= 0 && write(variant, fd);
+      int e = errno;
+      if(fd >= 0 && ::close(fd) != 0 && written){
+        written = false;
+        e = errno;
+      }
+      if(!written){
+        std::lock_guard<std::mutex> lock(failure);
+        if(ok){
+          ok = false;
+          error = e;
+          failedVariant = variant;
+        }
+        next = count; // Stop other workers.
+        return;
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for(unsigned t = 1; t < threads; t++) workers.emplace_back(worker);
+  worker();
+  for(auto &thread : workers) thread.join();
+  if(!ok){
+    if(failed) *failed = failedVariant;
+    errno = error;
+  }
+  return ok;
+}
+
+#else
+
+bool TIHexVariants::write(size_t variant, int fd) const {
+  (void)variant;
+  (void)fd;
+  errno = ENOSYS;
+  return false;
+}
+
+bool TIHexVariants::writeFiles(const std::vector<std::string> &filenames, unsigned threads, size_t *failed) const {
+  (void)filenames;
+  (void)threads;
+  if(failed) *failed = 0;
+  errno = ENOSYS;
+  return false;
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef TIHEXVARIANTS_H
+#define TIHEXVARIANTS_H
+
+/**
+ * @file TIHexVariants.h
+ * @author Fabricio Ribeiro Toloczko
+ * @brief Many patched copies (variants) of one base image, e.g. per device serial numbers, MACs and keys.
+ * The base image is rendered to text once. Variants share it and only own the text of the records they change,
+ * so emitting a variant is mostly copying base text.
+ *
+ * @copyright Copyright (c) 2022
+ * License: ZLib, see TIHex.h.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "TIHex.h"
+
+class PatchSet;
+
+class TIHexVariants
+{
+public:
+    /**
+     * @brief Render the base image. Pending lazy checksums are finalized.
+     * Base must not change while variants are in use.
+     *
+     * @param base image shared by all variants.
+     */
+    explicit TIHexVariants(TIHex &base);
+
+    /**
+     * @brief Add a variant: base image with patches applied, as TIHex::apply() would do.
+     *
+     * @param patches sorted patches, see PatchSet::sort().
+     * @param unwritten when not null and false is returned, receives the first range without data.
+     * @return true on success, false if some patch address has no data on base image. No variant is added then.
+     */
+    bool add(const PatchSet &patches, TIHex::Range *unwritten = nullptr);
+
+    /**
+     * @brief Exact number of characters written for a variant.
+     *
+     * @param variant variant position, in adding order.
+     */
+    uint64_t outputSize(size_t variant) const;
+
+    /**
+     * @brief Get variants size.
+     */
+    size_t size() const { return __variants.size(); }
+
+    /**
+     * @brief Write a variant as text to a file descriptor. Safe to call from several threads at once.
+     * Check errno if false is returned.
+     *
+     * @param variant variant position, in adding order.
+     * @param fd file descriptor open for writing.
+     * @return true on success, false otherwise.
+     */
+    bool write(size_t variant, int fd) const;
+
+    /**
+     * @brief Write a variant as text to a caller buffer.
+     *
+     * @param variant variant position, in adding order.
+     * @param buffer room for outputSize(variant) characters.
+     */
+    void write(size_t variant, char *buffer) const;
+
+    /**
+     * @brief Write each variant to its own file, created or truncated, on several threads.
+     * Check errno if false is returned.
+     *
+     * @param filenames one file name per variant, in adding order.
+     * @param threads number of threads, 0 for one per hardware thread.
+     * @param failed when not null and false is returned, receives the position of a failing variant.
+     * @return true when all variants were written, false otherwise.
+     */
+    bool writeFiles(const std::vector<std::string> &filenames, unsigned threads = 0, size_t *failed = nullptr) const;
+
+private:
+    /* Record changed by a variant: its text replaces base text of entry. */
+    struct Line
+    {
+        size_t entry;
+        uint64_t textOffset;  // In Variant::text.
+        uint32_t textLength;
+    };
+
+    struct Variant
+    {
+        std::vector<Line> lines;  // In entry order.
+        std::string text;
+    };
+
+    /**
+     * @brief Hand a variant text to emit(text, size) in order: base spans and changed lines.
+     */
+    template <typename Emit>
+    void spans(size_t variant, Emit emit) const;
+
+    /* Base image text, and offset of each entry line in it (plus total size at the end) */
+    std::string __text;
+    std::vector<uint64_t> __lineOffsets;
+
+    TIHex &__base;
+    std::vector<Variant> __variants;
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include "Corpus.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace
+{
+    const char DIGITS[] = "0123456789ABCDEF";
+
+    /* Usual record sizes of a region: mostly 16 and 32 bytes, as linkers and programmers write them. */
+    const uint8_t RECORD_SIZES[] = {16, 16, 16, 16, 32, 32, 8, 64, 255};
+
+    /* Highest address data is placed at, keeping the whole image in 32 bit addressing. */
+    const uint64_t ADDRESS_LIMIT = 0xFFFFFFFF;
+}
+
+Corpus::Corpus(uint64_t dataSize, uint64_t seed) : __dataLeft(std::min<uint64_t>(dataSize, ADDRESS_LIMIT / 2)), __state(seed) {
+}
+
+uint64_t Corpus::random() {
+  // SplitMix64
+  uint64_t z = (__state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+bool Corpus::parseSize(const char *text, uint64_t &size) {
+  char *end;
+  size = std::strtoull(text, &end, 10);
+  if(end == text) return false;
+  switch(*end){
+    case 'G': case 'g': size <<= 10; // Fall through.
+    case 'M': case 'm': size <<= 10; // Fall through.
+    case 'K': case 'k': size <<= 10; end++; break;
+    default: break;
+  }
+  return *end == '\0';
+}
+
+void Corpus::record(std::string &text, uint8_t type, uint16_t address, const uint8_t *data, uint8_t size) {
+  char line[1 + 2*(4 + 255 + 1) + 1];
+  char *p = line;
+  uint8_t sum = size + (address >> 8) + (address & 0xFF) + type;
+  auto pair = [&p](uint8_t value) {
+    *p++ = DIGITS[value >> 4];
+    *p++ = DIGITS[value & 0xF];
+  };
+  *p++ = ':';
+  pair(size);
+  pair(address >> 8);
+  pair(address & 0xFF);
+  pair(type);
+  for(uint8_t i = 0; i < size; i++){
+    pair(data[i]);
+    sum += data[i];
+  }
+  pair(static_cast<uint8_t>(~sum + 1));
+  *p++ = '\n';
+  text.append(line, p);
+  __counts.records[type]++;
+}
+
+void Corpus::startRegion() {
+  if(__counts.regions){
+    // Gaps from a few bytes to 64 KiB, left out once the rest of the data would not fit below the address limit.
+    uint64_t gap = 1 + random() % (16ULL << (random() % 13));
+    if(__address + gap + __dataLeft <= ADDRESS_LIMIT) __address += gap;
+  }
+  // Regions from 256 bytes to 2 MiB, sizes spread evenly on a log scale.
+  uint64_t scale = 256ULL << (random() % 13);
+  __regionLeft = std::min(__dataLeft, scale + random() % scale);
+  __recordSize = RECORD_SIZES[random() % sizeof(RECORD_SIZES)];
+  __counts.regions++;
+}
+
+bool Corpus::next(std::string &text, size_t chunkSize) {
+  if(__done) return false;
+  size_t target = text.size() + chunkSize;
+  uint8_t data[256];
+  while(text.size() < target){
+    if(!__dataLeft){
+      uint8_t start[4] = {0, 0, 0, 0};
+      record(text, 0x05, 0, start, 4);
+      record(text, 0x01, 0, nullptr, 0);
+      __done = true;
+      break;
+    }
+    if(!__regionLeft) startRegion();
+
+    int64_t upper = static_cast<int64_t>(__address >> 16);
+    if(upper != __upper){
+      if(__address < 0x100000){
+        // Segment of the same 64 KiB boundary, so segment and linear readings of the file agree.
+        uint16_t segment = static_cast<uint16_t>(upper << 12);
+        data[0] = segment >> 8;
+        data[1] = segment & 0xFF;
+        record(text, 0x02, 0, data, 2);
+      }
+      else{
+        if(__upper >= 0 && __upper < 0x10){
+          // Some readers add segment and linear bases together: clear the segment base first.
+          data[0] = data[1] = 0;
+          record(text, 0x02, 0, data, 2);
+        }
+        data[0] = static_cast<uint8_t>(upper >> 8);
+        data[1] = static_cast<uint8_t>(upper);
+        record(text, 0x04, 0, data, 2);
+      }
+      __upper = upper;
+    }
+
+    // Records never cross a 64 KiB boundary; now and then one is cut short.
+    uint64_t size = std::min<uint64_t>({__recordSize, __regionLeft, 0x10000 - (__address & 0xFFFF)});
+    if(random() % 64 == 0) size = 1 + random() % size;
+    for(uint64_t i = 0; i < size; i += 8){
+      uint64_t bits = random();
+      for(uint64_t j = i; j < i + 8 && j < size; j++, bits >>= 8) data[j] = static_cast<uint8_t>(bits);
+    }
+    record(text, 0x00, static_cast<uint16_t>(__address), data, static_cast<uint8_t>(size));
+    __address += size;
+    __regionLeft -= size;
+    __dataLeft -= size;
+  }
+  return true;
+}
+
+std::string Corpus::text() {
+  std::string text;
+  text.reserve(__dataLeft * 3 + 4096);
+  while(next(text)){
+  }
+  return text;
+}
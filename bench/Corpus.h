@@ -0,0 +1,83 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+/**
+ * @file Corpus.h
+ * @brief Deterministic synthetic images for benchmarks, shaped like firmware files: regions of data separated by gaps,
+ * records of varying sizes, Extended Segment (0x02) records below 1 MiB and Extended Linear (0x04) records above,
+ * a Start Linear Address (0x05) record and the End Of File record. The same size and seed always give the same text.
+ *
+ * Text is canonical, as TIHex::write() renders it: upper case digits, '\n' line ends, so a loaded image written back
+ * must give the generated text again.
+ */
+
+#include <cstdint>
+#include <string>
+
+class Corpus
+{
+public:
+    /* Number of records of each type generated, by record type 0x00 to 0x05 */
+    struct Counts
+    {
+        uint64_t records[6] = {0, 0, 0, 0, 0, 0};
+        uint64_t regions = 0;
+    };
+
+    /**
+     * @param dataSize number of data bytes to generate, at most 2 GiB.
+     * @param seed any value, picks another image of the same size.
+     */
+    Corpus(uint64_t dataSize, uint64_t seed = 1);
+
+    /**
+     * @brief Generate the next lines, appending at least chunkSize characters to text, less on the last call.
+     * Large images can be written out piece by piece without holding the whole text.
+     *
+     * @return false once the End Of File record was generated, and text was left untouched.
+     */
+    bool next(std::string &text, size_t chunkSize = 1 << 20);
+
+    /**
+     * @brief Generate the whole image text.
+     */
+    std::string text();
+
+    /**
+     * @brief Records generated so far.
+     */
+    const Counts &counts() const { return __counts; }
+
+    /**
+     * @brief Parse a size such as "4096", "64K", "16M" or "2G" (binary multiples).
+     *
+     * @return true if text is a size.
+     */
+    static bool parseSize(const char *text, uint64_t &size);
+
+private:
+    uint64_t random();
+
+    /**
+     * @brief Append one record with its checksum.
+     */
+    void record(std::string &text, uint8_t type, uint16_t address, const uint8_t *data, uint8_t size);
+
+    /**
+     * @brief Start the next region of data after a gap, choosing its length and record size.
+     */
+    void startRegion();
+
+    uint64_t __dataLeft;
+    uint64_t __state;
+
+    uint64_t __address = 0;          // Next data address.
+    uint64_t __regionLeft = 0;       // Bytes left in the current region.
+    uint8_t __recordSize = 16;       // Usual data record size in the current region.
+    int64_t __upper = -1;            // Upper address bits set by the last extended address record, -1 if none yet.
+    bool __done = false;
+
+    Counts __counts;
+};
+
+#endif
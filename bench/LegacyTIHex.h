@@ -0,0 +1,237 @@
+#ifndef LEGACY_TIHEX_H
+#define LEGACY_TIHEX_H
+
+/**
+ * @file LegacyTIHex.h
+ * @brief Reference copy of the original std::string/std::stoul based TIHex parser and std::map lookup.
+ * Used only by tihex_bench to measure improvements against the first implementation.
+ */
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+class LegacyTIHex
+{
+public:
+    uint16_t TIHEX_ADDRESS_MAX_JUMP = 65535;
+
+    struct Entry
+    {
+        char startCode;
+        uint8_t byteCount;
+        uint16_t address;
+        uint8_t recordType;
+        std::vector<uint8_t> data;
+        uint8_t checksum;
+    };
+
+    typedef uint64_t Address;
+
+    enum class Error
+    {
+        None,
+        Malformed,
+        InvalidJumpSize,
+        InvalidDataSize,
+        Overflow,
+        AddressNotFound
+    };
+
+    bool append(const std::string &line);
+    uint8_t getValue(Address address);
+    uint64_t size(){return __entryList.size();}
+
+private:
+    std::map<Address, Entry *> __entryMap;
+    std::list<Entry> __entryList;
+
+    Error __error;
+    Address __addressPointer = 0;
+    uint64_t __programCounter = 0;
+};
+
+inline bool LegacyTIHex::append(const std::string &line) {
+  //Start code   Byte count   Address   Record type   Data   Checksum
+  int lineSize = line.size();
+  int p;
+  // Discard leading spaces or tabs or ':'
+  for (p = 0; line[p] == ' ' || line[p] == '\t' || line[p] == ':'; p++);
+  // Check if there is at least characters for 5 bytes.
+  if(p == lineSize || (lineSize - p < 5*2)){
+    __error = Error::Malformed;
+    return false;
+  }
+  std::string byteCountStr = line.substr(p,2); p+=2;
+  std::string addressStr = line.substr(p,4); p+=4;
+  std::string recordTypeStr = line.substr(p,2); p+=2;
+
+  uint16_t entryAddress = 0;
+  try{
+    entryAddress = std::stoul(addressStr,nullptr,16);
+  }
+  catch(const std::exception& e) {
+    __error = Error::Malformed;
+    return false;
+  }
+  if(static_cast<uint16_t>(__addressPointer) != entryAddress){
+    // Entry address is different from previous calculation.
+    Address newAddressPointer = __addressPointer & ~(0xFFFF); // __addressPointer with cleared lower 16 bits.
+    newAddressPointer |= entryAddress; // Define lower 16 bits with new entry.
+    __addressPointer = newAddressPointer;
+  }
+  __entryList.emplace_back(); // Append new element.
+  auto& entry = __entryList.back(); // Get reference.
+
+  entry.startCode = ':';
+
+  try{
+    entry.byteCount = std::stoul(byteCountStr,nullptr,16);
+  }
+  catch(const std::exception& e) {
+      __entryList.pop_back();
+    __error = Error::Malformed;
+    return false;
+  }
+  
+  // Check if there is enough data
+  if(2*(entry.byteCount+1) > lineSize-p){
+      __entryList.pop_back();
+    __error = Error::Malformed;
+    return false;
+  }
+  
+  entry.address = entryAddress;
+  if(entry.address > TIHEX_ADDRESS_MAX_JUMP){
+      __entryList.pop_back();
+    __error = Error::InvalidJumpSize;
+    return false;
+  }
+  try{
+    entry.recordType = std::stoul(recordTypeStr,nullptr,16);
+  }
+  catch(const std::exception& e) {
+      __entryList.pop_back();
+    __error = Error::Malformed;
+    return false;
+  }
+
+  std::string dataStr = line.substr(p,2*entry.byteCount); p+=2*entry.byteCount;
+  auto dataByteCount = dataStr.size()/2;
+  if(dataByteCount != entry.byteCount){
+      __entryList.pop_back();
+    __error = Error::InvalidDataSize;
+    return false;
+  }
+  uint64_t newProgramCounter = __programCounter;
+  entry.data.reserve(dataByteCount); // Preallocate memory.
+  for(int i=0; i<dataStr.size(); i+=2)
+  {
+    auto s = dataStr.substr(i,2);
+    uint8_t value;
+    try{
+      value = std::stoul(s,nullptr,16);
+    }
+    catch(const std::exception& e) {
+      __entryList.pop_back();
+      __error = Error::Malformed;
+      return false;
+    }
+    entry.data.push_back(value);
+    newProgramCounter++;
+  }
+
+  std::string checksumStr = line.substr(p,2); p+=2;
+
+  try{
+    entry.checksum = std::stoul(checksumStr,nullptr,16);
+  }
+  catch(const std::exception& e) {
+      __entryList.pop_back();
+    __error = Error::Malformed;
+    return false;
+  }
+
+  Address newAddressPointer = __addressPointer;
+
+  // Process record types
+  if(entry.recordType == 0x00){
+    __entryMap[__addressPointer] = &entry; // Add reference into map.
+    newAddressPointer += entry.byteCount;
+    if(newAddressPointer < __addressPointer){
+      __entryMap.erase(__addressPointer);
+      __entryList.pop_back();
+      __error = Error::Overflow;
+      return false;
+    }
+  }
+  else if(entry.recordType == 0x02){
+    // Extended Segment Address
+    auto dataSize = entry.data.size();
+    uint64_t addressOffset = 0;
+    for(int i=0; i < dataSize; i++){
+      addressOffset <<= 8;
+      addressOffset |= entry.data[i];
+    }
+    addressOffset <<= 4;
+    newAddressPointer = addressOffset;
+  }
+  else if(entry.recordType == 0x04){
+    // Extended Linear Address
+    auto dataSize = entry.data.size();
+    uint64_t upperAddress = 0;
+    for(int i=0; i < dataSize; i++){
+      upperAddress <<= 8;
+      upperAddress |= entry.data[i];
+    }
+    upperAddress <<= 32;
+    newAddressPointer = upperAddress;
+  }
+  else{
+    // End Of File or Start Segment Address or Start Linear Address
+    newAddressPointer += entry.byteCount;
+    if(newAddressPointer < __addressPointer){
+      __entryList.pop_back();
+      __error = Error::Overflow;
+      return false;
+    }
+  }
+  if(entry.recordType == 0x00) __programCounter = newProgramCounter;
+  __addressPointer = newAddressPointer;
+  __error = Error::None;
+  return true;
+}
+
+inline uint8_t LegacyTIHex::getValue(Address address) {
+    auto it = __entryMap.upper_bound(address);
+
+    // Let's choose the right iterator, if it exists.
+    if(it == __entryMap.end()){
+      // Over than last address.
+      if(__entryMap.size()){
+        it--; // Get last entry
+      }
+      else{
+          __error = Error::AddressNotFound;
+          return 0;
+      }
+    }
+    else it--;
+
+    // Checking the offset, if it exists.
+    auto offset = address - it->first;
+    auto& data = it->second->data;
+    if(offset >= data.size())
+    {
+        __error = Error::AddressNotFound;
+        return 0; // There is no data to overwrite.
+    }
+
+    __error = Error::None;
+    return data[offset];
+}
+
+#endif
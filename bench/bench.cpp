@@ -0,0 +1,382 @@
+/**
+ * @file bench.cpp
+ * @brief Micro-benchmarks for TIHex on a synthetic image (Corpus.h). Compares current code against the original
+ * implementation (LegacyTIHex.h) on images up to LEGACY_MAX bytes.
+ *
+ * Each benchmark reports time, ns per operation, MB/s and the number of heap allocations it made. With --json the
+ * results are also written as JSON, to be kept and compared across releases.
+ *
+ * Usage: tihex_bench [size] [--seed n] [--json file|-]
+ *   size  data bytes of the image, with an optional K, M or G suffix, 16M by default.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../AllocationCount.h"
+#include "../ByteScan.h"
+#include "../Hash.h"
+#include "../HexCodec.h"
+#include "../PatchSet.h"
+#include "../TIHex.h"
+#include "../TIHexVariants.h"
+#include "Corpus.h"
+#include "LegacyTIHex.h"
+
+/* The original implementation is too slow and memory hungry to run on larger images. */
+static const uint64_t LEGACY_MAX = 64 << 20;
+
+struct Result {
+  std::string name;
+  uint64_t operations;
+  uint64_t bytes;
+  double seconds;
+  uint64_t allocations;
+};
+
+static std::vector<Result> results;
+
+/* Where the results table goes: standard error when JSON goes to standard output. */
+static std::FILE *table = stdout;
+
+/* Time and allocations since construction or the last restart(). */
+class Timer {
+public:
+  Timer(){ restart(); }
+  void restart(){
+    __allocations = AllocationCount::count();
+    __start = std::chrono::steady_clock::now();
+  }
+  double seconds() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - __start).count(); }
+  uint64_t allocations() const { return AllocationCount::count() - __allocations; }
+
+private:
+  std::chrono::steady_clock::time_point __start;
+  uint64_t __allocations;
+};
+
+static void report(const std::string &name, uint64_t operations, uint64_t bytes, const Timer &timer){
+  Result result = {name, operations, bytes, timer.seconds(), timer.allocations()};
+  fprintf(table, "%-32s %10.3f ms %10.1f ns/op %10.1f MB/s %10llu allocs\n", name.c_str(), result.seconds * 1e3,
+         result.seconds * 1e9 / std::max<uint64_t>(operations, 1), bytes / result.seconds / 1e6,
+         static_cast<unsigned long long>(result.allocations));
+  results.push_back(result);
+}
+
+static std::vector<std::string> splitLines(const std::string &text){
+  std::vector<std::string> lines;
+  size_t p = 0;
+  while(p < text.size()){
+    size_t e = text.find('\n', p);
+    if(e == std::string::npos) e = text.size();
+    lines.emplace_back(text, p, e - p);
+    p = e + 1;
+  }
+  return lines;
+}
+
+/* Address of a byte in LegacyTIHex, which shifted Extended Linear Address records by 32 bits instead of 16. */
+static uint64_t legacyAddress(TIHex::Address address){
+  return address < 0x100000 ? address : ((address >> 16) << 32) | (address & 0xFFFF);
+}
+
+static std::string jsonString(const std::string &text){
+  std::string quoted = "\"";
+  for(char c : text){
+    if(c == '"' || c == '\\') quoted += '\\';
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+static bool writeJson(const char *filename, uint64_t size, uint64_t seed, const std::string &text, const Corpus &corpus){
+  std::FILE *out = std::strcmp(filename, "-") ? std::fopen(filename, "w") : stdout;
+  if(!out) return false;
+  const Corpus::Counts &counts = corpus.counts();
+  fprintf(out, "{\n  \"date\": %s,\n  \"commit\": %s,\n  \"codec\": %s,\n  \"hash\": %s,\n  \"threads\": %u,\n",
+          jsonString(GIT_COMMIT_DATE).c_str(), jsonString(GIT_COMMIT_HASH).c_str(), jsonString(HexCodec::isa()).c_str(),
+          jsonString(Hash::isa()).c_str(), std::thread::hardware_concurrency());
+  fprintf(out, "  \"image\": {\"size\": %llu, \"seed\": %llu, \"text\": %llu, \"regions\": %llu, \"records\": [",
+          static_cast<unsigned long long>(size), static_cast<unsigned long long>(seed),
+          static_cast<unsigned long long>(text.size()), static_cast<unsigned long long>(counts.regions));
+  for(int type = 0; type < 6; type++) fprintf(out, "%s%llu", type ? ", " : "", static_cast<unsigned long long>(counts.records[type]));
+  fprintf(out, "]},\n  \"results\": [\n");
+  for(size_t i = 0; i < results.size(); i++){
+    const Result &r = results[i];
+    fprintf(out, "    {\"name\": %s, \"operations\": %llu, \"bytes\": %llu, \"seconds\": %.9f, \"ns_per_op\": %.3f, "
+            "\"mb_per_s\": %.3f, \"allocations\": %llu}%s\n", jsonString(r.name).c_str(),
+            static_cast<unsigned long long>(r.operations), static_cast<unsigned long long>(r.bytes), r.seconds,
+            r.seconds * 1e9 / std::max<uint64_t>(r.operations, 1), r.bytes / r.seconds / 1e6,
+            static_cast<unsigned long long>(r.allocations), i + 1 < results.size() ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+  bool ok = !std::ferror(out);
+  if(out != stdout) ok = std::fclose(out) == 0 && ok;
+  return ok;
+}
+
+int main(int argc, char *argv[]){
+  uint64_t size = 16 << 20;
+  uint64_t seed = 1;
+  const char *json = nullptr;
+  for(int i = 1; i < argc; i++){
+    if(!std::strcmp(argv[i], "--json") && i + 1 < argc) json = argv[++i];
+    else if(!std::strcmp(argv[i], "--seed") && i + 1 < argc) seed = std::strtoull(argv[++i], nullptr, 0);
+    else if(!Corpus::parseSize(argv[i], size) || !size){
+      fprintf(stderr, "Usage: %s [size[K|M|G]] [--seed n] [--json file|-]\n", argv[0]);
+      return 2;
+    }
+  }
+  if(json && !std::strcmp(json, "-")) table = stderr;
+
+  Corpus corpus(size, seed);
+  std::string text = corpus.text();
+  std::vector<std::string> lines = splitLines(text);
+  const bool legacy = size <= LEGACY_MAX;
+  fprintf(table, "image: %llu bytes of data, %llu regions, %llu lines, %llu characters\n", static_cast<unsigned long long>(size),
+         static_cast<unsigned long long>(corpus.counts().regions), static_cast<unsigned long long>(lines.size()),
+         static_cast<unsigned long long>(text.size()));
+
+  if(legacy){
+    LegacyTIHex hex;
+    Timer timer;
+    for(auto &line : lines){
+      if(!hex.append(line)) return -1;
+    }
+    report("legacy append(string)", lines.size(), text.size(), timer);
+  }
+  {
+    TIHex hex;
+    Timer timer;
+    for(auto &line : lines){
+      if(!hex.append(line)) return -1;
+    }
+    report("append(string)", lines.size(), text.size(), timer);
+  }
+  {
+    TIHex hex;
+    Timer timer;
+    const char *p = text.data();
+    const char *end = p + text.size();
+    uint64_t count = 0;
+    while(p < end){
+      const char *e = static_cast<const char *>(memchr(p, '\n', end - p));
+      if(!e) e = end;
+      if(!hex.append(p, e - p)) return -1;
+      p = e + 1;
+      count++;
+    }
+    report("append(const char*,size_t)", count, text.size(), timer);
+  }
+  {
+    TIHex hex;
+    Timer timer;
+    if(!hex.load(text.data(), text.data() + text.size())) return -1;
+    report("load(buffer)", hex.size(), text.size(), timer);
+  }
+  for(unsigned threads : {2u, 4u, std::max(1u, std::thread::hardware_concurrency())}){
+    TIHex hex;
+    Timer timer;
+    if(!hex.load(text.data(), text.data() + text.size(), threads)) return -1;
+    report("load(buffer, " + std::to_string(threads) + " threads)", hex.size(), text.size(), timer);
+  }
+  {
+    TIHex hex;
+    Timer timer;
+    if(!hex.verify(text.data(), text.data() + text.size())) return -1;
+    report("checksum verify(buffer)", lines.size(), text.size(), timer);
+  }
+  {
+    // Lookups: sequential bytes through the segments, and random bytes spread evenly over the data.
+    TIHex hex;
+    hex.load(text.data(), text.data() + text.size());
+    const std::vector<TIHex::Segment> segments = hex.segments();
+    std::vector<uint64_t> ends; // Data bytes up to the end of each segment.
+    for(auto &s : segments) ends.push_back((ends.empty() ? 0 : ends.back()) + s.length);
+
+    const uint64_t lookups = 4000000;
+    std::vector<TIHex::Address> sequentialAddresses, randomAddresses(lookups);
+    for(size_t s = 0; s < segments.size() && sequentialAddresses.size() < lookups; s++){
+      for(uint64_t i = 0; i < segments[s].length && sequentialAddresses.size() < lookups; i++){
+        sequentialAddresses.push_back(segments[s].address + i);
+      }
+    }
+    uint64_t state = seed;
+    for(auto &a : randomAddresses){
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      uint64_t offset = (state >> 11) % ends.back();
+      size_t s = std::upper_bound(ends.begin(), ends.end(), offset) - ends.begin();
+      a = segments[s].address + segments[s].length - (ends[s] - offset);
+    }
+
+    unsigned sum = 0;
+    if(legacy){
+      LegacyTIHex legacyHex;
+      for(auto &line : lines) legacyHex.append(line);
+      std::vector<uint64_t> legacySequential(sequentialAddresses.size()), legacyRandom(lookups);
+      std::transform(sequentialAddresses.begin(), sequentialAddresses.end(), legacySequential.begin(), legacyAddress);
+      std::transform(randomAddresses.begin(), randomAddresses.end(), legacyRandom.begin(), legacyAddress);
+      Timer timer;
+      for(auto a : legacySequential) sum += legacyHex.getValue(a);
+      report("legacy getValue sequential", legacySequential.size(), legacySequential.size(), timer);
+      timer.restart();
+      for(auto a : legacyRandom) sum += legacyHex.getValue(a);
+      report("legacy getValue random", lookups, lookups, timer);
+    }
+    Timer timer;
+    for(auto a : sequentialAddresses) sum += hex.getValue(a);
+    report("getValue sequential", sequentialAddresses.size(), sequentialAddresses.size(), timer);
+    timer.restart();
+    for(auto a : randomAddresses) sum += hex.getValue(a);
+    report("getValue random", lookups, lookups, timer);
+    TIHex::Cursor cursor(hex);
+    timer.restart();
+    for(auto a : sequentialAddresses) sum += cursor.getValue(a);
+    report("Cursor getValue sequential", sequentialAddresses.size(), sequentialAddresses.size(), timer);
+    if(sum == 1) fprintf(table, "\n"); // Keep results alive.
+
+    // Overwrite 4 KiB blocks, one every 64 KiB of segments long enough: byte by byte, then whole ranges.
+    std::vector<uint8_t> block(4096, 0x5A);
+    std::vector<TIHex::Address> blockAddresses;
+    for(size_t s = 0; s < segments.size() && blockAddresses.size() < 1000; s++){
+      for(uint64_t i = 0; i + block.size() <= segments[s].length && blockAddresses.size() < 1000; i += 0x10000){
+        blockAddresses.push_back(segments[s].address + i);
+      }
+    }
+    const uint64_t blocks = blockAddresses.size();
+    timer.restart();
+    for(auto a : blockAddresses){
+      for(size_t i = 0; i < block.size(); i++) hex.overwrite(a + i, block[i]);
+    }
+    report("overwrite 4K byte by byte", blocks * block.size(), blocks * block.size(), timer);
+    timer.restart();
+    for(auto a : blockAddresses){
+      for(size_t i = 0; i < block.size(); i++) cursor.overwrite(a + i, block[i]);
+    }
+    report("Cursor overwrite 4K byte by byte", blocks * block.size(), blocks * block.size(), timer);
+    timer.restart();
+    for(auto a : blockAddresses){
+      if(!hex.overwrite(a, block.data(), block.size())) return -1;
+    }
+    report("overwrite 4K range", blocks, blocks * block.size(), timer);
+    hex.setLazyChecksum(true);
+    timer.restart();
+    for(auto a : blockAddresses){
+      for(size_t i = 0; i < block.size(); i++) hex.overwrite(a + i, block[i]);
+    }
+    hex.finalize();
+    report("overwrite 4K byte lazy", blocks * block.size(), blocks * block.size(), timer);
+    hex.setLazyChecksum(false);
+
+    // Scattered single byte edits: one overwrite each, then one sorted sweep.
+    PatchSet patches;
+    const uint64_t edits = std::min<uint64_t>(100000, lookups);
+    for(uint64_t i = 0; i < edits; i++) patches.add(randomAddresses[i], &block[0], 1);
+    timer.restart();
+    for(uint64_t i = 0; i < edits; i++) hex.overwrite(randomAddresses[i], block[0]);
+    report("overwrite scattered edits", edits, edits, timer);
+    timer.restart();
+    patches.sort();
+    hex.apply(patches);
+    report("apply scattered edits", edits, edits, timer);
+
+    // Read 4 KiB blocks back.
+    timer.restart();
+    for(auto a : blockAddresses){
+      for(size_t i = 0; i < block.size(); i++) block[i] = hex.getValue(a + i);
+    }
+    report("read 4K byte by byte", blocks * block.size(), blocks * block.size(), timer);
+    timer.restart();
+    for(auto a : blockAddresses) hex.read(a, block.data(), block.size());
+    report("read 4K range", blocks, blocks * block.size(), timer);
+
+    // Hash the start of the image, gaps padded, about 64 MiB in all.
+    TIHex::Range extent;
+    hex.extent(extent);
+    const uint64_t length = std::min<uint64_t>(extent.length, 1 << 20);
+    const uint64_t rounds = std::max<uint64_t>(1, (64 << 20) / length);
+    for(auto algorithm : {Hash::Algorithm::Crc32, Hash::Algorithm::Crc32c, Hash::Algorithm::Sha256}){
+      static const char *names[] = {"crc32", "crc32c", "sha256"};
+      uint8_t digest[Hash::DIGEST_MAX];
+      timer.restart();
+      for(uint64_t r = 0; r < rounds; r++){
+        Hash hash(algorithm);
+        if(!hex.hash(extent.address, length, hash)) return -1;
+        hash.final(digest);
+      }
+      report(std::string("checksum ") + names[static_cast<int>(algorithm)] + " " + Hash::isa(), rounds, rounds * length, timer);
+    }
+
+    // Search the whole image for bytes taken from its end, so they are found at least once.
+    const TIHex::Segment &last = hex.segments().back();
+    for(size_t patternLength : {4, 16, 64}){
+      if(last.length < patternLength) break;
+      std::vector<uint8_t> pattern(patternLength), mask(patternLength, 0xFF);
+      hex.read(last.address + last.length - patternLength, pattern.data(), patternLength);
+      std::vector<TIHex::Address> matches;
+      for(bool wildcard : {false, true}){
+        mask[1] = wildcard ? 0x00 : 0xFF; // Any second byte.
+        timer.restart();
+        hex.find(pattern.data(), mask.data(), patternLength, matches);
+        report("find " + std::to_string(patternLength) + " bytes" + (wildcard ? " wildcard " : " ") + ByteScan::isa(), 1,
+               hex.programSize(), timer);
+        if(matches.empty()) return -1;
+      }
+    }
+
+    // Per device variants: 3 small edits each, rendered from the shared base text.
+    TIHex base;
+    base.load(text.data(), text.data() + text.size());
+    TIHexVariants variants(base);
+    const size_t count = 100;
+    uint8_t serial[8] = {0};
+    timer.restart();
+    for(size_t v = 0; v < count; v++){
+      PatchSet devicePatches;
+      std::memcpy(serial, &v, sizeof(v) < sizeof(serial) ? sizeof(v) : sizeof(serial));
+      for(int i = 0; i < 3; i++) devicePatches.add(randomAddresses[i], serial, sizeof(serial));
+      devicePatches.sort();
+      if(!variants.add(devicePatches)) return -1;
+    }
+    report("variants add", count, 0, timer);
+    std::vector<char> output(variants.outputSize(0));
+    timer.restart();
+    for(size_t v = 0; v < count; v++) variants.write(v, output.data());
+    report("variants write(buffer)", count, count * output.size(), timer);
+  }
+  {
+    // Serialize an unmodified image: it must give the generated text back.
+    TIHex hex;
+    hex.load(text.data(), text.data() + text.size());
+    std::vector<char> output(hex.outputSize());
+    Timer timer;
+    if(!hex.write(output.data(), output.size())) return -1;
+    report("serialize write(buffer)", hex.size(), output.size(), timer);
+    if(output.size() != text.size() || std::memcmp(output.data(), text.data(), text.size())) return -1;
+  }
+  {
+    // Hex text <-> binary kernels over 16 byte blocks, as found on typical data records.
+    std::vector<uint8_t> bytes(size / 16 * 16);
+    std::vector<char> chars(bytes.size() * 2);
+    for(size_t i = 0; i < bytes.size(); i++) bytes[i] = static_cast<uint8_t>(i * 7);
+    Timer timer;
+    for(size_t i = 0; i < bytes.size(); i += 16) HexCodec::encode(&bytes[i], 16, &chars[2*i]);
+    report(std::string("encode ") + HexCodec::isa(), bytes.size() / 16, chars.size(), timer);
+    timer.restart();
+    for(size_t i = 0; i < bytes.size(); i += 16){
+      if(!HexCodec::decode(&chars[2*i], 16, &bytes[i])) return -1;
+    }
+    report(std::string("decode ") + HexCodec::isa(), bytes.size() / 16, chars.size(), timer);
+  }
+  if(json && !writeJson(json, size, seed, text, corpus)){
+    perror(json);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,51 @@
+/**
+ * @file generate.cpp
+ * @brief Write a synthetic image (see Corpus.h) to a file, e.g. to time tihex itself on large inputs.
+ *
+ * Usage: tihex_gen <size> [seed] [file]
+ *   size  data bytes, with an optional K, M or G suffix.
+ *   seed  picks another image of the same size, 1 by default.
+ *   file  output file, standard output if left out or "-".
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "Corpus.h"
+
+int main(int argc, char *argv[]){
+  uint64_t size;
+  if(argc < 2 || argc > 4 || !Corpus::parseSize(argv[1], size)){
+    fprintf(stderr, "Usage: %s <size>[K|M|G] [seed] [file]\n", argv[0]);
+    return 2;
+  }
+  uint64_t seed = argc > 2 ? std::strtoull(argv[2], nullptr, 0) : 1;
+  std::FILE *out = stdout;
+  if(argc > 3 && std::strcmp(argv[3], "-") != 0){
+    out = std::fopen(argv[3], "wb");
+    if(!out){
+      perror(argv[3]);
+      return 1;
+    }
+  }
+
+  Corpus corpus(size, seed);
+  std::string text;
+  while(corpus.next(text)){
+    if(std::fwrite(text.data(), 1, text.size(), out) != text.size()) break;
+    text.clear();
+  }
+  if(std::fclose(out) != 0 || !text.empty()){
+    perror(argc > 3 ? argv[3] : "stdout");
+    return 1;
+  }
+
+  const Corpus::Counts &counts = corpus.counts();
+  fprintf(stderr, "%llu regions, records: %llu data, %llu segment, %llu linear, %llu other\n",
+          static_cast<unsigned long long>(counts.regions), static_cast<unsigned long long>(counts.records[0x00]),
+          static_cast<unsigned long long>(counts.records[0x02]), static_cast<unsigned long long>(counts.records[0x04]),
+          static_cast<unsigned long long>(counts.records[0x01] + counts.records[0x03] + counts.records[0x05]));
+  return 0;
+}
@@ -1,30 +1,97 @@
 #include <iostream>
-#include <fstream>
+#include <cctype>
 #include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <iomanip>
 #include <sstream>
 
+#if defined(__unix__) || defined(__APPLE__)
+#define TIHEX_POSIX 1
+#include <sys/resource.h>
+#endif
+
 #include "TIHex.h"
+#include "AllocationCount.h"
+#include "Hash.h"
+#include "HexCodec.h"
+#include "ImageCache.h"
+#include "MappedFile.h"
+#include "PatchSet.h"
+#include "TIHexServer.h"
+#include "TIHexVariants.h"
 
 #define TEMP_BUFFER_SIZE 1024
 
+/* Range to hash, see --hash */
+struct HashRequest
+{
+  Hash::Algorithm algorithm;
+  std::string name;
+  TIHex::Address address;
+  uint64_t length;
+  bool store;
+  TIHex::Address storeAddress;
+};
+
+bool parsePattern(const std::string &text, std::vector<uint8_t> &pattern, std::vector<uint8_t> &mask);
 void showHelp();
+void showStatistics(TIHex &hex, bool json, double seconds, bool mapped);
 void showVersion();
 
+static double secondsSince(std::chrono::steady_clock::time_point start){
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
 int main(int argc, char *argv[]){
+  auto startTime = std::chrono::steady_clock::now();
   if(argc>-1){
     bool stdinEnabled = false;
     bool stdoutEnabled = false;
     std::string filename = "";
-    std::list<std::pair<TIHex::Address,std::vector<uint8_t>>> newDataList; // list of pairs <address,bytes list>
+    PatchSet patches; // Data to overwrite, merged by address.
     TIHex::Address lastAddress = 0;
     bool addressSet = false;
+    bool patchFileSet = false;
+    bool streamEnabled = false;
+    bool inPlaceEnabled = false;
+    bool cacheEnabled = false;
+    bool verifyEnabled = false;
+    bool verifyAll = false; // Report every issue, not only the first one.
+    std::string variantsFilename = "";
+    std::string serveSocket = "";
+    std::vector<HashRequest> hashes;
+    uint8_t pad = 0xFF; // Hashed, exported or skipped value of addresses without data.
+    bool fromBinary = false;
+    std::string binaryFilename = "";
+    bool binaryAddressSet = false;
+    TIHex::Address binaryAddress = 0;
+    unsigned recordSize = 16;
+    bool sparse = false;
+    bool segmentsEnabled = false;
+    int statistics = 0; // 1: text, 2: JSON.
+    std::string diffFilename = "";
+    std::string diffFormat = "list";
+    bool findEnabled = false;
+    std::vector<uint8_t> findPattern, findMask;
+    unsigned threads = 0; // One per hardware thread.
     for (int i = 1; i < argc; i++)
     {
       std::string arg = argv[i];
       if(arg == "-i" || arg == "--stdin") stdinEnabled = true;
       else if(arg == "-o" || arg == "--stdout") stdoutEnabled = true;
+      else if(arg == "-s" || arg == "--stream") streamEnabled = true;
+      else if(arg == "--in-place") inPlaceEnabled = true;
+      else if(arg == "--cache") cacheEnabled = true;
+      else if(arg == "--verify") verifyEnabled = true;
+      else if(arg == "--from-bin") fromBinary = true;
+      else if(arg == "--sparse") sparse = true;
+      else if(arg == "--segments") segmentsEnabled = true;
+      else if(arg == "--stats") statistics = 1;
+      else if(arg == "--stats-json") statistics = 2;
+      else if(arg == "--verify-all") verifyEnabled = verifyAll = true;
       else if(arg == "-a" || arg == "--address"){
         if(i+1 < argc){
           try
@@ -47,11 +114,15 @@ int main(int argc, char *argv[]){
         }
       }
       else if(arg == "-d" || arg == "--data"){
+        if(!addressSet){
+          std::cerr << "Data switch must follow an address switch: there's no address to write data at." << std::endl;
+          showHelp();
+          return -1;
+        }
         if(i+1 < argc){
           std::istringstream values(argv[i+1]);
-          newDataList.emplace_back();
-          auto& newData = newDataList.back();
-          newData.first = lastAddress;
+          TIHex::Address newDataAddress = lastAddress;
+          std::vector<uint8_t> newData;
           std::vector<std::string> valuesStrings;
           std::string s;
           // Split values on strings according to separator ','
@@ -68,7 +139,7 @@ int main(int argc, char *argv[]){
                 std::cout << s << "is greater than 0xFF. Use byte values only." << std::endl;
                 return -1;
               }
-              newData.second.push_back(v);
+              newData.push_back(v);
               //std::cout << v << " ";
             }
             catch(const std::exception& e)
@@ -78,6 +149,10 @@ int main(int argc, char *argv[]){
             }
           }
           //std::cout << '\n';
+          if(!patches.add(newDataAddress, newData.data(), newData.size())){
+            std::cerr << "Data address " << std::hex << newDataAddress << " could not be overwritten." << std::endl;
+            return -1;
+          }
           i++; // Move forward on arguments
         }
         else{
@@ -86,6 +161,221 @@ int main(int argc, char *argv[]){
           return -1;
         }
       }
+      else if(arg == "-p" || arg == "--patch-file"){
+        if(i+1 < argc){
+          MappedFile patchFile;
+          if(!patchFile.open(argv[i+1])){
+            std::cerr << "Error '" << std::strerror(errno) << "' while opening file: " << argv[i+1] << std::endl;
+            return errno;
+          }
+          uint64_t errorLine;
+          if(!patches.parse(patchFile.begin(), patchFile.end(), &errorLine)){
+            std::cerr << "Error 'Malformed' while parsing patch file " << argv[i+1] << " line " << errorLine << std::endl;
+            return -1;
+          }
+          patchFileSet = true;
+          i++; // Move forward on arguments.
+        }
+        else{
+          std::cerr << "Patch file switch must have a file name as following argument." << std::endl;
+          showHelp();
+          return -1;
+        }
+      }
+      else if(arg == "--variants"){
+        if(i+1 < argc){
+          variantsFilename = argv[i+1];
+          i++; // Move forward on arguments.
+        }
+        else{
+          std::cerr << "Variants switch must have a file name as following argument." << std::endl;
+          showHelp();
+          return -1;
+        }
+      }
+      else if(arg == "--hash"){
+        // algorithm,address,length
+        std::vector<std::string> fields;
+        if(i+1 < argc){
+          std::istringstream values(argv[i+1]);
+          std::string s;
+          while (std::getline(values, s, ',')) fields.push_back(s);
+        }
+        HashRequest request = {Hash::Algorithm::Crc32, "", 0, 0, false, 0};
+        if(fields.size() != 3 || !Hash::algorithm(fields[0], request.algorithm)){
+          std::cerr << "Hash switch must have algorithm (crc32, crc32c or sha256), hexadecimal address and length as following argument. E.g. \"crc32,8000000,1FFFC\"." << std::endl;
+          showHelp();
+          return -1;
+        }
+        request.name = fields[0];
+        try
+        {
+          request.address = std::stoull(fields[1],nullptr,16);
+          request.length = std::stoull(fields[2],nullptr,16);
+        }
+        catch(const std::exception& e)
+        {
+          std::cerr << e.what() << ": on " << argv[i+1] << '\n';
+          return -1;
+        }
+        hashes.push_back(request);
+        i++; // Move forward on arguments.
+      }
+      else if(arg == "--hash-store"){
+        if(i+1 < argc && !hashes.empty()){
+          try
+          {
+            hashes.back().storeAddress = std::stoull(argv[i+1],nullptr,16);
+          }
+          catch(const std::exception& e)
+          {
+            std::cerr << e.what() << ": on " << argv[i+1] << '\n';
+            return -1;
+          }
+          hashes.back().store = true;
+          i++; // Move forward on arguments.
+        }
+        else{
+          std::cerr << "Hash store switch must follow a hash switch and have a hexadecimal address as following argument." << std::endl;
+          showHelp();
+          return -1;
+        }
+      }
+      else if(arg == "--pad"){
+        unsigned long value = 256;
+        if(i+1 < argc){
+          try
+          {
+            value = std::stoul(argv[i+1],nullptr,16);
+          }
+          catch(const std::exception& e)
+          {
+            std::cerr << e.what() << ": on " << argv[i+1] << '\n';
+            return -1;
+          }
+        }
+        if(value > 255){
+          std::cerr << "Pad switch must have a hexadecimal byte value as following argument." << std::endl;
+          showHelp();
+          return -1;
+        }
+        pad = value;
+        i++; // Move forward on arguments.
+      }
+      else if(arg == "--to-bin"){
+        if(i+1 < argc){
+          binaryFilename = argv[i+1];
+          i++; // Move forward on arguments.
+        }
+        else{
+          std::cerr << "Binary output switch must have a file name as following argument." << std::endl;
+          showHelp();
+          return -1;
+        }
+      }
+      else if(arg == "--bin-address"){
+        if(i+1 < argc){
+          try
+          {
+            binaryAddress = std::stoull(argv[i+1],nullptr,16);
+          }
+          catch(const std::exception& e)
+          {
+            std::cerr << e.what() << ": on " << argv[i+1] << '\n';
+            return -1;
+          }
+          binaryAddressSet = true;
+          i++; // Move forward on arguments.
+        }
+        else{
+          std::cerr << "Binary address switch must have a hexadecimal value as following argument." << std::endl;
+          showHelp();
+          return -1;
+        }
+      }
+      else if(arg == "--record-size"){
+        recordSize = 0;
+        if(i+1 < argc){
+          try
+          {
+            recordSize = std::stoul(argv[i+1]);
+          }
+          catch(const std::exception& e)
+          {
+            std::cerr << e.what() << ": on " << argv[i+1] << '\n';
+            return -1;
+          }
+        }
+        if(recordSize < 1 || recordSize > 255){
+          std::cerr << "Record size switch must have a decimal value from 1 to 255 as following argument." << std::endl;
+          showHelp();
+          return -1;
+        }
+        i++; // Move forward on arguments.
+      }
+      else if(arg == "--diff"){
+        if(i+1 < argc){
+          diffFilename = argv[i+1];
+          i++; // Move forward on arguments.
+        }
+        else{
+          std::cerr << "Diff switch must have the old image file name as following argument." << std::endl;
+          showHelp();
+          return -1;
+        }
+      }
+      else if(arg == "--diff-format"){
+        if(i+1 < argc && (std::string(argv[i+1]) == "list" || std::string(argv[i+1]) == "patch" || std::string(argv[i+1]) == "args")){
+          diffFormat = argv[i+1];
+          i++; // Move forward on arguments.
+        }
+        else{
+          std::cerr << "Diff format switch must have list, patch or args as following argument." << std::endl;
+          showHelp();
+          return -1;
+        }
+      }
+      else if(arg == "--find"){
+        if(i+1 < argc && parsePattern(argv[i+1], findPattern, findMask)){
+          findEnabled = true;
+          i++; // Move forward on arguments.
+        }
+        else{
+          std::cerr << "Find switch must have hexadecimal bytes as following argument, ? matching any nibble. E.g. \"--find DEAD??EF\"." << std::endl;
+          showHelp();
+          return -1;
+        }
+      }
+      else if(arg == "--serve"){
+        if(i+1 < argc){
+          serveSocket = argv[i+1];
+          i++; // Move forward on arguments.
+        }
+        else{
+          std::cerr << "Serve switch must have a socket file name as following argument." << std::endl;
+          showHelp();
+          return -1;
+        }
+      }
+      else if(arg == "-j" || arg == "--threads"){
+        if(i+1 < argc){
+          try
+          {
+            threads = std::stoul(argv[i+1]);
+          }
+          catch(const std::exception& e)
+          {
+            std::cerr << e.what() << ": on " << argv[i+1] << '\n';
+            return -1;
+          }
+          i++; // Move forward on arguments.
+        }
+        else{
+          std::cerr << "Threads switch must have a decimal value as following argument." << std::endl;
+          showHelp();
+          return -1;
+        }
+      }
       else if(arg == "-h" || arg == "--help"){
         showHelp();
         return 0;
@@ -99,83 +389,361 @@ int main(int argc, char *argv[]){
       }
     }
     //std::cout << std::endl;
+
+    // Resident mode: images are loaded and edited by clients.
+    if(serveSocket > ""){
+      TIHexServer server(threads);
+      server.serve(serveSocket);
+      std::cerr << "Error '" << std::strerror(errno) << "' while serving on socket: " << serveSocket << std::endl;
+      return errno;
+    }
     
+    // Edits given on command line may overwrite each other, but patch files are meant to be consistent.
+    TIHex::Address conflict;
+    if(!patches.sort(&conflict) && patchFileSet){
+      std::cerr << "Conflicting edits on address " << std::hex << conflict << "." << std::endl;
+      return -1;
+    }
+
     // Get HEX data
     TIHex hex;
-    if(stdinEnabled){
-      std::string line;
-      uint64_t lineNumber = 0;
-      while(!std::cin.eof()){
-        lineNumber++;
-        std::getline(std::cin,line);
-        if( (line.size() && (line[0] == '\n' || line[0] == '\r')) || !line.size()) continue; // Skips empty lines
-        if(!hex.append(line))
-        {
-          std::cerr << "Error '" << hex.errorString() << "' while parsing line " << lineNumber << ": '" << line << "'\n";
-          return -1;
+    // Statistics are shown on the way out, whether it succeeded or not.
+    struct StatisticsReport
+    {
+      TIHex &hex;
+      int mode;
+      std::chrono::steady_clock::time_point start;
+      bool mapped; // Input read on first access while parsing, see showStatistics().
+      ~StatisticsReport(){ if(mode) showStatistics(hex, mode == 2, secondsSince(start), mapped); }
+    } statisticsReport = {hex, statistics, startTime, false};
+    if(streamEnabled && (!hashes.empty() || fromBinary || binaryFilename > "" || segmentsEnabled || diffFilename > "" || findEnabled ||
+                         inPlaceEnabled || cacheEnabled || variantsFilename > "")){
+      std::cerr << "Hash, binary, segments, diff, find, in-place, cache and variants switches need the whole image: they can't be used with stream switch." << std::endl;
+      return -1;
+    }
+    if(inPlaceEnabled && fromBinary){
+      std::cerr << "In place switch writes records back into their source text: it can't be used with binary input." << std::endl;
+      return -1;
+    }
+    if(verifyEnabled && (stdoutEnabled || addressSet || patchFileSet || streamEnabled || inPlaceEnabled || cacheEnabled ||
+                         fromBinary || binaryFilename > "" || variantsFilename > "" || !hashes.empty() || segmentsEnabled ||
+                         diffFilename > "" || findEnabled)){
+      std::cerr << "Verify switches only check the input text: they can't be used with edit, output, stream, in-place, cache, binary, variants, hash, segments, diff or find switches." << std::endl;
+      return -1;
+    }
+    if(streamEnabled){
+      // Edit while reading, one line at a time.
+      int in = fileno(stdin);
+      std::FILE *file = nullptr;
+      if(!stdinEnabled && filename > ""){
+        file = std::fopen(filename.c_str(), "rb");
+        if(!file){
+          std::cerr << "Error '" << std::strerror(errno) << "' while opening file: " << filename << std::endl;
+          return errno;
         }
+        in = fileno(file);
+      }
+      std::cout.flush();
+      TIHex::Range unwritten;
+      bool ok = hex.stream(in, fileno(stdout), patches, &unwritten);
+      int error = errno;
+      if(file) std::fclose(file);
+      if(ok) return 0;
+      switch(hex.error()){
+        case TIHex::Error::Input:
+        case TIHex::Error::Output:
+          std::cerr << "Error '" << std::strerror(error) << "' while streaming" << std::endl;
+          return error;
+        case TIHex::Error::AddressNotFound:
+          std::cerr << "Data address " << std::hex << unwritten.address << " could not be overwritten." << std::endl;
+          return -1;
+        default:
+          std::cerr << "Error '" << hex.errorString() << "' while parsing line " << hex.errorLine() << std::endl;
+          return -1;
+      }
+    }
+    MappedFile input;
+    auto readStart = std::chrono::steady_clock::now();
+    if(stdinEnabled){
+      if(!input.openStdin()){
+        std::cerr << "Error '" << std::strerror(errno) << "' while reading stdin" << std::endl;
+        return errno;
       }
-      //std::cout << std::endl;
     }
     else if(filename > ""){
-      std::fstream file(filename,file.in);
-      if(!file.is_open()){
+      if(!input.open(filename)){
         std::cerr << "Error '" << std::strerror(errno) << "' while opening file: " << filename << std::endl;
         return errno;
       }
-      else{
-        std::string line;
-        uint64_t lineNumber = 0;
-        while(!file.eof()){
-          lineNumber++;
-          std::getline(file,line);
-          if( (line.size() && (line[0] == '\n' || line[0] == '\r')) || !line.size()) continue; // Skips empty lines
-          if(!hex.append(line))
-          {
-            std::cerr << "Error '" << hex.errorString() << "' while parsing line " << lineNumber << ": '" << line << "'\n";
-            return -1;
+    }
+    hex.addTime(TIHex::Statistics::Read, secondsSince(readStart), input.size());
+    statisticsReport.mapped = input.mapped();
+    // Only check the input?
+    if(verifyEnabled){
+      std::vector<TIHex::Issue> issues;
+      if(hex.verify(input.begin(), input.end(), verifyAll ? &issues : nullptr)) return 0;
+      if(!verifyAll) issues.push_back({hex.error(), hex.errorLine(), hex.errorOffset()});
+      for(auto &issue : issues){
+        const char *line = input.begin() + issue.offset;
+        const char *lineEnd = static_cast<const char *>(memchr(line, '\n', input.end() - line));
+        if(!lineEnd) lineEnd = input.end();
+        std::cerr << "Error '" << TIHex::errorString(issue.error) << "' on line " << issue.line << ": '";
+        std::cerr.write(line, lineEnd - line) << "'\n";
+      }
+      return -1;
+    }
+
+    // Parsed image may be cached next to its file.
+    cacheEnabled = cacheEnabled && !stdinEnabled && filename > "" && !fromBinary;
+    ImageCache::Key cacheKey;
+    bool cached = false;
+    if(cacheEnabled){
+      cacheKey = ImageCache::key(input);
+      cached = ImageCache::load(hex, ImageCache::path(filename), cacheKey);
+    }
+    if(fromBinary){
+      // Raw image: records are generated, then an End Of File record.
+      if(!hex.importBinary(reinterpret_cast<const uint8_t *>(input.begin()), input.size(), binaryAddress, recordSize, sparse, pad)
+         || !hex.append(":00000001FF")){
+        std::cerr << "Error '" << hex.errorString() << "' while importing binary data at address " << std::hex << binaryAddress << std::endl;
+        return -1;
+      }
+    }
+    else if(!cached && !hex.load(input.begin(), input.end(), threads))
+    {
+      const char *line = input.begin() + hex.errorOffset();
+      const char *lineEnd = static_cast<const char *>(memchr(line, '\n', input.end() - line));
+      if(!lineEnd) lineEnd = input.end();
+      std::cerr << "Error '" << hex.errorString() << "' while parsing line " << hex.errorLine() << ": '";
+      std::cerr.write(line, lineEnd - line) << "'\n";
+      return -1;
+    }
+    if(cacheEnabled && !cached && !ImageCache::save(hex, ImageCache::path(filename), cacheKey)){
+      std::cerr << "Warning: '" << std::strerror(errno) << "' while writing cache file: " << ImageCache::path(filename) << std::endl;
+    }
+    input.close();
+
+    // Process HEX
+    if(!patches.empty()){
+      hex.setLazyChecksum(true); // Checksums are calculated once per record, before output.
+      TIHex::Range unwritten;
+      if(!hex.apply(patches, true, &unwritten)){
+        std::cerr << "Data address " << std::hex << unwritten.address << " could not be overwritten." << std::endl;
+        return -1;
+      }
+    }
+
+    // List contiguous data ranges?
+    if(segmentsEnabled){
+      std::ostream &out = stdoutEnabled ? std::cerr : std::cout; // Keep stdout for the image.
+      out << std::uppercase << std::hex;
+      for(auto &segment : hex.segments()) out << segment.address << ' ' << segment.length << '\n';
+      out << std::dec << std::nouppercase << std::flush;
+    }
+
+    // Hash ranges, in order: a stored digest is part of later hashes and of the output.
+    for(auto &request : hashes){
+      Hash hash(request.algorithm);
+      if(!hex.hash(request.address, request.length, hash, pad)){
+        std::cerr << "Hash range " << std::hex << request.address << " length " << request.length << " overflows 64 bit addressing." << std::endl;
+        return -1;
+      }
+      uint8_t digest[Hash::DIGEST_MAX];
+      hash.final(digest);
+      std::ostream &out = stdoutEnabled ? std::cerr : std::cout; // Keep stdout for the image.
+      out << request.name << ' ' << std::uppercase << std::hex << request.address << ' ' << request.length << ' ';
+      for(size_t b = 0; b < hash.size(); b++) out << std::setw(2) << std::setfill('0') << static_cast<unsigned>(digest[b]);
+      out << std::dec << std::nouppercase << std::endl;
+      TIHex::Range unwritten;
+      if(request.store && !hex.overwrite(request.storeAddress, digest, hash.size(), true, &unwritten)){
+        std::cerr << "Data address " << std::hex << unwritten.address << " could not be overwritten." << std::endl;
+        return -1;
+      }
+    }
+
+    // Compare with an older image?
+    bool differencesFound = false;
+    if(diffFilename > ""){
+      MappedFile oldInput;
+      TIHex oldHex;
+      if(!oldInput.open(diffFilename)){
+        std::cerr << "Error '" << std::strerror(errno) << "' while opening file: " << diffFilename << std::endl;
+        return errno;
+      }
+      if(!oldHex.load(oldInput.begin(), oldInput.end(), threads)){
+        std::cerr << "Error '" << oldHex.errorString() << "' while parsing line " << oldHex.errorLine() << " of file: " << diffFilename << std::endl;
+        return -1;
+      }
+      oldInput.close();
+      std::vector<TIHex::Difference> differences;
+      oldHex.diff(hex, differences);
+      differencesFound = !differences.empty();
+
+      std::ostream &out = stdoutEnabled ? std::cerr : std::cout; // Keep stdout for the image.
+      static const char *kinds[] = {"changed", "added", "removed"};
+      out << std::uppercase << std::hex;
+      std::vector<uint8_t> data;
+      for(auto &difference : differences){
+        const char *kind = kinds[static_cast<int>(difference.kind)];
+        if(diffFormat == "list" || difference.kind != TIHex::Difference::Kind::Changed){
+          // Added and removed data can't be expressed as edits of the old image.
+          if(diffFormat != "list") out << "# ";
+          out << kind << ' ' << difference.address << ' ' << difference.length << '\n';
+          continue;
+        }
+        // New values, as edits of the old image: patch file lines of up to 32 bytes, or one -a/-d pair per run.
+        const uint64_t lineBytes = diffFormat == "patch" ? 32 : difference.length;
+        for(uint64_t done = 0; done < difference.length; done += lineBytes){
+          uint64_t size = std::min(lineBytes, difference.length - done);
+          data.resize(size);
+          hex.read(difference.address + done, data.data(), size);
+          if(diffFormat == "patch"){
+            std::string text(2*size, ' ');
+            HexCodec::encode(data.data(), size, &text[0]);
+            out << difference.address + done << ' ' << text << '\n';
+          }
+          else{
+            out << "-a " << difference.address + done << " -d ";
+            for(uint64_t b = 0; b < size; b++) out << (b ? "," : "") << std::setw(2) << std::setfill('0') << static_cast<unsigned>(data[b]);
+            out << '\n';
           }
         }
-        //std::cout << std::endl;
-        file.close();
       }
+      out << std::dec << std::nouppercase << std::flush;
     }
 
-    // Process HEX
-    if(addressSet){
-      for(auto&pair : newDataList){
-        auto address = pair.first;
-        for(auto &v : pair.second){
-          if(!hex.overwrite(address,v)){
-            std::cerr << "Data address " << std::hex << address << " could not be overwritten." << std::endl;
+    // Search data?
+    bool patternFound = false;
+    if(findEnabled){
+      std::vector<TIHex::Address> matches;
+      hex.find(findPattern.data(), findMask.data(), findPattern.size(), matches);
+      patternFound = !matches.empty();
+      std::ostream &out = stdoutEnabled ? std::cerr : std::cout; // Keep stdout for the image.
+      out << std::uppercase << std::hex;
+      for(auto address : matches) out << address << '\n';
+      out << std::dec << std::nouppercase << std::flush;
+    }
+
+    // Write as a raw image?
+    if(binaryFilename > ""){
+      TIHex::Range range = {binaryAddress, 0};
+      if(hex.extent(range) && binaryAddressSet){
+        // Whatever comes before the chosen start address is left out.
+        uint64_t end = range.address + range.length;
+        range = {binaryAddress, end > binaryAddress ? end - binaryAddress : 0};
+      }
+      bool toStdout = binaryFilename == "-";
+      if(toStdout) std::cout.flush();
+      std::FILE *file = toStdout ? stdout : std::fopen(binaryFilename.c_str(), "wb");
+      bool ok = file && hex.exportBinary(fileno(file), range.address, range.length, pad, sparse);
+      int error = errno;
+      if(!ok && hex.error() == TIHex::Error::Overflow){
+        std::cerr << "Binary range " << std::hex << range.address << " length " << range.length << " overflows 64 bit addressing." << std::endl;
+        if(file && !toStdout) std::fclose(file);
+        return -1;
+      }
+      if(file && !toStdout && std::fclose(file) != 0 && ok){
+        ok = false;
+        error = errno;
+      }
+      if(!ok){
+        std::cerr << "Error '" << std::strerror(error) << "' while writing file: " << binaryFilename << std::endl;
+        return error;
+      }
+    }
+
+    // Write back into the input file?
+    if(inPlaceEnabled){
+      if(stdinEnabled || filename == ""){
+        std::cerr << "In place switch needs an input file name." << std::endl;
+        return -1;
+      }
+      std::FILE *file = std::fopen(filename.c_str(), "r+b");
+      if(!file){
+        std::cerr << "Error '" << std::strerror(errno) << "' while opening file: " << filename << std::endl;
+        return errno;
+      }
+      if(!hex.writeInPlace(fileno(file))){
+        // Only output errors set errno. Others (e.g. NotInSource) are found before writing anything.
+        bool outputError = hex.error() == TIHex::Error::Output;
+        int error = errno;
+        std::cerr << "Error '" << (outputError ? std::string(std::strerror(error)) : hex.errorString()) << "' while writing file: "
+                  << filename << std::endl;
+        std::fclose(file);
+        return outputError && error ? error : -1;
+      }
+      if(std::fclose(file) != 0){
+        std::cerr << "Error '" << std::strerror(errno) << "' while writing file: " << filename << std::endl;
+        return errno;
+      }
+    }
+
+    // Write variants?
+    if(variantsFilename > ""){
+      MappedFile manifest;
+      if(!manifest.open(variantsFilename)){
+        std::cerr << "Error '" << std::strerror(errno) << "' while opening file: " << variantsFilename << std::endl;
+        return errno;
+      }
+      // One variant per line: output file name, then ';' separated edits as on patch files.
+      TIHexVariants variants(hex);
+      std::vector<std::string> outputs;
+      uint64_t lineNumber = 0;
+      for(const char *line = manifest.begin(); line < manifest.end();){
+        const char *next = static_cast<const char *>(memchr(line, '\n', manifest.end() - line));
+        if(!next) next = manifest.end();
+        lineNumber++;
+        const char *p = line;
+        while(p < next && (*p == ' ' || *p == '\t')) p++;
+        const char *name = p;
+        while(p < next && *p != ' ' && *p != '\t' && *p != '\r') p++;
+        if(p > name && *name != '#'){
+          PatchSet variantPatches;
+          bool valid = true;
+          for(const char *edit = p; valid && edit < next;){
+            const char *editEnd = static_cast<const char *>(memchr(edit, ';', next - edit));
+            if(!editEnd) editEnd = next;
+            valid = variantPatches.parse(edit, editEnd);
+            edit = editEnd + 1;
+          }
+          TIHex::Address conflict;
+          if(!valid || !variantPatches.sort(&conflict)){
+            std::cerr << "Error 'Malformed' while parsing variants file " << variantsFilename << " line " << lineNumber << std::endl;
             return -1;
           }
-          address++;
+          TIHex::Range unwritten;
+          if(!variants.add(variantPatches, &unwritten)){
+            std::cerr << "Data address " << std::hex << unwritten.address << " could not be overwritten on variants file line "
+                      << std::dec << lineNumber << "." << std::endl;
+            return -1;
+          }
+          outputs.emplace_back(name, p - name);
         }
+        line = next + 1;
+      }
+      size_t failed;
+      auto writeStart = std::chrono::steady_clock::now();
+      bool written = variants.writeFiles(outputs, threads, &failed);
+      uint64_t writtenBytes = 0;
+      for(size_t v = 0; v < outputs.size(); v++) writtenBytes += variants.outputSize(v);
+      hex.addTime(TIHex::Statistics::Write, secondsSince(writeStart), written ? writtenBytes : 0);
+      if(!written){
+        std::cerr << "Error '" << std::strerror(errno) << "' while writing file: " << outputs[failed] << std::endl;
+        return errno;
       }
     }
 
     // Send to stdout?
     if(stdoutEnabled)
     {
-      char temp[8];
-      for(auto it = hex.begin(); it != hex.end(); it++){
-        //hex.fixChecksum(it);
-        snprintf(temp,sizeof(temp),"%.2X",it->byteCount);
-        std::cout << it->startCode << temp;
-        snprintf(temp,sizeof(temp),"%.4X",it->address);
-        std::cout << temp;
-        snprintf(temp,sizeof(temp),"%.2X",it->recordType);
-        std::cout << temp;
-        auto dataSize = it->data.size();
-        for(int i=0; i<dataSize; i++){
-          snprintf(temp,sizeof(temp),"%.2X",it->data[i]);
-          std::cout << temp;
-        }
-        snprintf(temp,sizeof(temp),"%.2X",it->checksum);
-        std::cout << temp << '\n';
+      std::cout.flush();
+      if(!hex.write(fileno(stdout))){
+        std::cerr << "Error '" << std::strerror(errno) << "' while writing to stdout" << std::endl;
+        return errno;
       }
     }
+    if(differencesFound) return 1; // As diff does.
+    if(findEnabled && !patternFound) return 1; // As grep does.
   }
   else{
     showHelp();
@@ -183,6 +751,33 @@ int main(int argc, char *argv[]){
   return 0;
 }
 
+bool parsePattern(const std::string &text, std::vector<uint8_t> &pattern, std::vector<uint8_t> &mask){
+  // Hexadecimal digits two by two, '?' for any nibble. Separators make patterns easier to read and are skipped.
+  pattern.clear();
+  mask.clear();
+  std::string digits;
+  for(char c : text){
+    if(c == ',' || c == ' ' || c == ':') continue;
+    if(!std::isxdigit(static_cast<unsigned char>(c)) && c != '?') return false;
+    digits += c;
+  }
+  if(digits.empty() || digits.size() % 2) return false;
+  for(size_t i = 0; i < digits.size(); i += 2){
+    uint8_t value = 0, bits = 0;
+    for(size_t n = 0; n < 2; n++){
+      char c = digits[i + n];
+      value <<= 4;
+      bits <<= 4;
+      if(c == '?') continue;
+      value |= std::isdigit(static_cast<unsigned char>(c)) ? c - '0' : (std::toupper(static_cast<unsigned char>(c)) - 'A' + 10);
+      bits |= 0xF;
+    }
+    pattern.push_back(value);
+    mask.push_back(bits);
+  }
+  return true;
+}
+
 void showHelp(){
   std::cout << "Textual Intel Hex Editor" << '\n';
   std::string ar = "@";
@@ -193,10 +788,94 @@ void showHelp(){
   std::cout << "--stdin or -i: process stdin." << '\n';
   std::cout << "--stdout or -o: show final data on stdout." << '\n';
   std::cout << "--address or -a: set address to overwrite, hexadecimal 0 to FFFFFFFFFFFFFFFF. E.g. \"-a EAF00F1\"." << '\n';
-  std::cout << "--data or -d: define data, hex values comma separated. E.g. \"-d 0,0,1a,95,AB\"." << '\n';
+  std::cout << "--data or -d: define data, hex values comma separated. E.g. \"-d 0,0,1a,95,AB\". Written at the address of the preceding address switch, or right after the data before." << '\n';
+  std::cout << "--patch-file or -p: read edits from a file, one per line: hexadecimal address and data bytes. E.g. \"0800F000 DEADBEEF # serial\"." << '\n';
+  std::cout << "--segments: print contiguous data ranges, one per line: hexadecimal address and length." << '\n';
+  std::cout << "--hash: print CRC32, CRC32C or SHA-256 of a range after edits: algorithm, hexadecimal address and length. E.g. \"--hash crc32,8000000,1FFFC\"." << '\n';
+  std::cout << "--hash-store: write the digest of the previous hash switch at a hexadecimal address, most significant byte first. E.g. \"--hash-store 801FFFC\"." << '\n';
+  std::cout << "--pad: hexadecimal byte value hashed for addresses without data, FF by default. E.g. \"--pad 0\"." << '\n';
+  std::cout << "--to-bin: write data as a raw binary file (\"-\" for stdout), from the lowest data address, or --bin-address, to the highest one. Addresses without data are written as --pad. E.g. \"--to-bin fw.bin\"." << '\n';
+  std::cout << "--from-bin: read input as a raw binary file, placed at --bin-address (0 by default), generating data and extended linear address records." << '\n';
+  std::cout << "--bin-address: hexadecimal address of the first binary file byte. E.g. \"--bin-address 8000000\"." << '\n';
+  std::cout << "--record-size: data bytes per record generated by --from-bin, 1 to 255, 16 by default. E.g. \"--record-size 32\"." << '\n';
+  std::cout << "--sparse: --to-bin leaves holes of 64 KiB or more without data as file holes (read as 0), --from-bin leaves out records made only of --pad bytes." << '\n';
+  std::cout << "--in-place: write edits back into the input file, changing only data and checksum characters of edited records. Not with --from-bin or --stream." << '\n';
+  std::cout << "--cache: keep the parsed input file in a binary file next to it (name.tihexcache), reused while the input file does not change." << '\n';
+  std::cout << "--verify: check input line structure, byte counts, checksums, address overflow and order, stopping on the first error. Only checks: can't be used with switches editing, writing or querying the image." << '\n';
+  std::cout << "--verify-all: same as --verify, reporting all errors." << '\n';
+  std::cout << "--stream or -s: edit while reading, writing each line to stdout at once. Memory use does not grow with input size." << '\n';
+  std::cout << "--variants: write patched copies of the image, one per line of a file: output file name and ';' separated edits as on patch files. E.g. \"dev1.hex 0800F000 0001; 0800F100 DEADBEEF\"." << '\n';
+  std::cout << "--diff: compare data with an older image file, after edits, whatever the record layouts. Prints changed, added and removed ranges: kind, hexadecimal address and length. Exits with 1 when data differs. E.g. \"tihex --diff old.hex new.hex\"." << '\n';
+  std::cout << "--diff-format: list (default), patch to print changed data as patch file lines (see --patch-file), or args as -a/-d switches. Added and removed ranges become # comments." << '\n';
+  std::cout << "--find: print addresses where hexadecimal bytes are found after edits, one per line, '?' matching any nibble. Matches may span records, not addresses without data. Exits with 1 when there is none. E.g. \"--find 5645522E??2E\"." << '\n';
+  std::cout << "--serve: keep running, serving LOAD, READ, WRITE, SERIALIZE and CHECKSUM requests on a Unix socket, see TIHexServer.h. -j sets threads running requests, any number of clients may connect. E.g. \"--serve /tmp/tihex.sock\"." << '\n';
+  std::cout << "--stats: show time per phase (read, parse, index, patch, checksum, write), record counts, memory used and held (size and capacity), heap allocations (operator new calls, including array and nothrow ones, not malloc()) and peak resident memory on stderr when done. Memory mapped input files are read while parsing: read is then shown as map, only timing the mapping." << '\n';
+  std::cout << "--stats-json: same as --stats, as JSON." << '\n';
+  std::cout << "--threads or -j: number of threads decoding large inputs or serving clients, 0 (default) for one per hardware thread. E.g. \"-j 8\"." << '\n';
   std::cout << "--version or -v: show version." << std::endl;
 }
 
+/*
+ * Mapped input is only mapped by the read phase: its pages are read from the file while parsing, so the read phase
+ * is shown as "map" and parse time includes input I/O.
+ */
+void showStatistics(TIHex &hex, bool json, double seconds, bool mapped){
+  TIHex::Statistics statistics = hex.statistics();
+  static const char *recordNames[6] = {"data", "end_of_file", "extended_segment_address", "start_segment_address",
+                                       "extended_linear_address", "start_linear_address"};
+  uint64_t peak = 0; // Peak resident memory, bytes.
+#ifdef TIHEX_POSIX
+  struct rusage usage;
+  if(getrusage(RUSAGE_SELF, &usage) == 0){
+#ifdef __APPLE__
+    peak = usage.ru_maxrss;
+#else
+    peak = static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+  }
+#endif
+  uint64_t count = AllocationCount::count();
+  uint64_t bytes = AllocationCount::bytes();
+
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(6);
+  if(json){
+    out << "{\"seconds\": " << seconds << ", \"input\": \"" << (mapped ? "mapped" : "read") << "\", \"phases\": {";
+    for(int p = 0; p < TIHex::Statistics::PHASES; p++){
+      auto phase = static_cast<TIHex::Statistics::Phase>(p);
+      out << (p ? ", " : "") << '"' << TIHex::Statistics::phaseName(phase) << "\": {\"seconds\": " << statistics.seconds[p]
+          << ", \"bytes\": " << statistics.bytes[p] << '}';
+    }
+    out << "}, \"records\": {";
+    for(int type = 0; type < 6; type++) out << (type ? ", " : "") << '"' << recordNames[type] << "\": " << statistics.records[type];
+    out << "}, \"data_bytes\": " << statistics.dataBytes << ", \"memory\": {\"records\": " << statistics.recordMemory
+        << ", \"data\": " << statistics.dataMemory << ", \"index\": " << statistics.indexMemory << "}, \"memory_used\": {\"records\": "
+        << statistics.recordUsed << ", \"data\": " << statistics.dataUsed << ", \"index\": " << statistics.indexUsed << "}, \"allocations\": " << count
+        << ", \"allocated_bytes\": " << bytes << ", \"peak_rss\": " << peak << "}\n";
+  }
+  else{
+    out << "phase         seconds            bytes       MB/s\n";
+    for(int p = 0; p < TIHex::Statistics::PHASES; p++){
+      auto phase = static_cast<TIHex::Statistics::Phase>(p);
+      const char *name = mapped && phase == TIHex::Statistics::Read ? "map" : TIHex::Statistics::phaseName(phase);
+      out << std::left << std::setw(9) << name << std::right << std::setw(12) << statistics.seconds[p]
+          << std::setw(17) << statistics.bytes[p] << std::setw(11) << std::setprecision(1)
+          << (statistics.seconds[p] > 0 ? statistics.bytes[p] / statistics.seconds[p] / 1e6 : 0.0) << std::setprecision(6) << '\n';
+    }
+    out << std::left << std::setw(9) << "total" << std::right << std::setw(12) << seconds << '\n';
+    if(mapped) out << "input was memory mapped: parse includes reading it from the file.\n";
+    out << "records:";
+    for(int type = 0; type < 6; type++) out << (type ? ", " : " ") << recordNames[type] << ' ' << statistics.records[type];
+    out << "\ndata bytes: " << statistics.dataBytes << '\n';
+    out << "memory used / held: " << statistics.recordUsed << " / " << statistics.recordMemory << " records, "
+        << statistics.dataUsed << " / " << statistics.dataMemory << " data, " << statistics.indexUsed << " / "
+        << statistics.indexMemory << " index bytes\n";
+    out << "allocations: " << count << " (" << bytes << " bytes)\n";
+    out << "peak resident memory: " << peak << " bytes\n";
+  }
+  std::cerr << out.str() << std::flush;
+}
+
 void showVersion(){
   std::cout << "Textual Intel Hex Editor" << '\n';
   std::cout << "Version: " << GIT_COMMIT_DATE << '\n';
@@ -0,0 +1,70 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+/**
+ * @file Check.h
+ * @brief Minimal checking helpers shared by the ctest programs of this directory.
+ * A test program counts failed checks and returns the count as exit status, 0 meaning success.
+ *
+ * @copyright Copyright (c) 2022
+ * License: ZLib, see TIHex.h.
+ */
+
+#include <cstdint>
+#include <cstdio>
+
+namespace Check
+{
+    /* Number of failed checks so far. */
+    inline int &failures()
+    {
+        static int count = 0;
+        return count;
+    }
+
+    /**
+     * @brief Count and report a failed check.
+     *
+     * @param passed result of the check.
+     * @param what description printed on failure.
+     * @return passed, so callers may stop early.
+     */
+    inline bool that(bool passed, const char *what)
+    {
+        if(!passed){
+            failures()++;
+            std::fprintf(stderr, "FAILED: %s\n", what);
+        }
+        return passed;
+    }
+
+    /**
+     * @brief Deterministic pseudo random numbers (xorshift64), so failures reproduce.
+     */
+    class Random
+    {
+    public:
+        explicit Random(uint64_t seed) : __state(seed ? seed : 1) {}
+        uint64_t next()
+        {
+            __state ^= __state << 13;
+            __state ^= __state >> 7;
+            __state ^= __state << 17;
+            return __state;
+        }
+        uint8_t byte() { return static_cast<uint8_t>(next() >> 24); }
+    private:
+        uint64_t __state;
+    };
+
+    /**
+     * @brief Exit status of a test program.
+     */
+    inline int result()
+    {
+        if(failures()) std::fprintf(stderr, "%d check(s) failed.\n", failures());
+        return failures() ? 1 : 0;
+    }
+}
+
+#endif
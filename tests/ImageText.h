@@ -0,0 +1,67 @@
+#ifndef IMAGETEXT_H
+#define IMAGETEXT_H
+
+/**
+ * @file ImageText.h
+ * @brief Intel HEX text of a byte map, for ctest programs comparing image code with plain maps.
+ * Records have random sizes and each one gets its own Extended Linear Address record, so records may come in any
+ * order and still land where the map says.
+ *
+ * @copyright Copyright (c) 2022
+ * License: ZLib, see TIHex.h.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Check.h"
+
+namespace ImageText
+{
+    typedef std::map<uint64_t, uint8_t> Bytes;
+
+    /**
+     * @brief Text of bytes at addresses below 4 GiB, ending with an End Of File record.
+     *
+     * @param bytes data by address.
+     * @param random picks record sizes, and their order when shuffled.
+     * @param shuffled write records in random order, making segment bytes scattered in record storage.
+     */
+    inline std::string text(const Bytes &bytes, Check::Random &random, bool shuffled = false)
+    {
+        std::vector<std::string> records;
+        char line[32 + 2*255];
+        for(auto it = bytes.begin(); it != bytes.end();){
+            uint64_t address = it->first;
+            size_t size = 1 + random.next() % 32;
+            int length = std::snprintf(line, sizeof line, ":02000004%.4X%.2X\n", static_cast<unsigned>(address >> 16),
+                                       static_cast<unsigned>((0x100 - ((6 + (address >> 24) + ((address >> 16) & 0xFF)) & 0xFF)) & 0xFF));
+            int header = length;
+            length += 9;
+            unsigned sum = 0;
+            size_t count = 0;
+            // Contiguous bytes, not crossing a 64 KiB window.
+            for(; it != bytes.end() && count < size && it->first == address + count && (count == 0 || ((address + count) & 0xFFFF)); ++it, count++){
+                length += std::snprintf(line + length, sizeof line - length, "%.2X", it->second);
+                sum += it->second;
+            }
+            sum += count + ((address >> 8) & 0xFF) + (address & 0xFF);
+            char prefix[10];
+            std::snprintf(prefix, sizeof prefix, ":%.2X%.4X00", static_cast<unsigned>(count), static_cast<unsigned>(address & 0xFFFF));
+            std::copy(prefix, prefix + 9, line + header);
+            std::snprintf(line + length, sizeof line - length, "%.2X\n", (0x100 - (sum & 0xFF)) & 0xFF);
+            records.push_back(line);
+        }
+        if(shuffled){
+            for(size_t i = records.size(); i > 1; i--) std::swap(records[i - 1], records[random.next() % i]);
+        }
+        std::string text;
+        for(auto &record : records) text += record;
+        return text + ":00000001FF\n";
+    }
+}
+
+#endif
@@ -0,0 +1,152 @@
+/**
+ * @file binary_test.cpp
+ * @brief TIHex::exportBinary() and importBinary() against a byte map: exported files hold the map, filled or sparse,
+ * and imported files come back as records holding the file, at any record size and address.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../TIHex.h"
+#include "Check.h"
+#include "ImageText.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+
+static const uint8_t FILL = 0xFF;
+static const uint64_t SPARSE_HOLE = 1 << 16; // Smallest hole sparse export leaves in the file.
+
+/* Bytes of an exported file, read back */
+static bool exported(TIHex &hex, TIHex::Range range, bool sparse, std::vector<uint8_t> &file){
+  char path[] = "/tmp/binary_testXXXXXX";
+  int fd = mkstemp(path);
+  if(fd < 0) return false;
+  ::unlink(path);
+  bool ok = hex.exportBinary(fd, range.address, range.length, FILL, sparse);
+  file.assign(range.length + 1, 0);
+  ssize_t n = ok ? ::pread(fd, file.data(), file.size(), 0) : -1;
+  ::close(fd);
+  file.resize(n < 0 ? 0 : n);
+  return ok;
+}
+
+/* What the file must hold: map bytes, fill between them, zeros in holes sparse export skipped */
+static std::vector<uint8_t> expectedFile(const ImageText::Bytes &bytes, TIHex::Range range, bool sparse){
+  std::vector<uint8_t> file(range.length, FILL);
+  uint64_t next = range.address; // After the previous byte.
+  for(auto &byte : bytes){
+    if(sparse && byte.first - next >= SPARSE_HOLE) std::fill(file.begin() + (next - range.address), file.begin() + (byte.first - range.address), 0);
+    file[byte.first - range.address] = byte.second;
+    next = byte.first + 1;
+  }
+  return file;
+}
+
+/* Image bytes from address on, and whether each one has data */
+static void contents(TIHex &hex, TIHex::Address address, size_t size, std::vector<uint8_t> &values, std::vector<bool> &present){
+  values.assign(size, 0);
+  present.assign(size, true);
+  std::vector<TIHex::Range> holes;
+  hex.read(address, values.data(), size, FILL, &holes);
+  for(auto &hole : holes) std::fill(present.begin() + (hole.address - address), present.begin() + (hole.address - address + hole.length), false);
+}
+
+static void checkImport(const std::vector<uint8_t> &file, TIHex::Address address, uint8_t recordSize, bool sparse){
+  TIHex hex;
+  if(!Check::that(hex.importBinary(file.data(), file.size(), address, recordSize, sparse, FILL) && hex.append(":00000001FF"),
+                  "importBinary() succeeds")) return;
+  std::vector<uint8_t> values;
+  std::vector<bool> present;
+  contents(hex, address, file.size(), values, present);
+  bool same = true;
+  for(size_t i = 0; same && i < file.size(); i++){
+    same = present[i] ? values[i] == file[i] : sparse && file[i] == FILL;
+  }
+  Check::that(same, sparse ? "sparse import holds every byte but fill ones" : "import holds the file");
+
+  // Records fit their size and 64 KiB windows, with 0x04 records only where upper address bits change.
+  bool fit = true, minimal = true;
+  uint64_t upper = 0;
+  for(auto entry : hex){
+    if(entry.recordType() == 0x00) fit = fit && entry.byteCount() <= recordSize && entry.address() + entry.byteCount() <= 0x10000;
+    if(entry.recordType() == 0x04){
+      uint64_t next = (entry[0] << 8) | entry[1];
+      minimal = minimal && next != upper;
+      upper = next;
+    }
+  }
+  Check::that(fit, "imported records are at most recordSize bytes and don't cross 64 KiB");
+  Check::that(minimal, "imported 0x04 records change the upper address bits, zero at file start");
+
+  // Text gives the same image again.
+  std::ostringstream out;
+  hex.write(out);
+  std::string text = out.str();
+  TIHex reloaded;
+  if(!Check::that(reloaded.load(text.data(), text.data() + text.size()), "imported image text loads")) return;
+  std::vector<uint8_t> reloadedValues;
+  std::vector<bool> reloadedPresent;
+  contents(reloaded, address, file.size(), reloadedValues, reloadedPresent);
+  Check::that(reloadedValues == values && reloadedPresent == present, "imported image text holds the same bytes");
+}
+
+int main(){
+  Check::Random random(19);
+  static const TIHex::Address addresses[] = {0, 0xFFF1, 0xFFFF, 0x0801FFFE};
+  static const uint8_t recordSizes[] = {1, 16, 32, 255};
+  for(int round = 0; round < 12; round++){
+    // Runs of data, some of fill bytes, between short holes and holes sparse export skips.
+    ImageText::Bytes bytes;
+    uint64_t base = random.next() % 2 ? random.next() % 0x100 : 0x0800F000 + random.next() % 0x1000;
+    for(uint64_t address = base; address < base + 0x28000;){
+      uint64_t length = 1 + random.next() % 3000;
+      switch(random.next() % 8){
+        case 0:
+          address += SPARSE_HOLE + random.next() % 0x4000;
+          break;
+        case 1:
+        case 2:
+          break;
+        default: {
+          bool fill = random.next() % 4 == 0;
+          for(uint64_t a = address; a < address + length; a++) bytes[a] = fill ? FILL : random.byte();
+        }
+      }
+      address += length;
+    }
+    // Ends after a hole of exactly the smallest size sparse export skips, or one byte less.
+    uint64_t last = bytes.empty() ? base : bytes.rbegin()->first;
+    uint64_t tail = last + 1 + SPARSE_HOLE - round % 2;
+    for(uint64_t a = tail; a < tail + 16; a++) bytes[a] = random.byte();
+    std::string text = ImageText::text(bytes, random, round % 2);
+    TIHex hex;
+    TIHex::Range range;
+    if(!Check::that(hex.load(text.data(), text.data() + text.size()) && hex.extent(range), "test image loads")) continue;
+    Check::that(range.address == bytes.begin()->first && range.length == bytes.rbegin()->first + 1 - range.address,
+                "extent() spans the map");
+
+    std::vector<uint8_t> file;
+    for(int sparse = 0; sparse < 2; sparse++){
+      Check::that(exported(hex, range, sparse, file) && file == expectedFile(bytes, range, sparse),
+                  sparse ? "sparse export holds the map, zeros in skipped holes" : "export holds the map, fill elsewhere");
+    }
+    exported(hex, range, false, file);
+    TIHex::Address address = addresses[round % 4];
+    for(uint8_t recordSize : recordSizes) checkImport(file, address, recordSize, random.next() % 2);
+    checkImport(file, address, 1 + random.next() % 255, true);
+  }
+  return Check::result();
+}
+
+#else
+
+int main(){
+  std::fprintf(stderr, "exportBinary() needs POSIX file descriptors: nothing to check.\n");
+  return 0;
+}
+
+#endif
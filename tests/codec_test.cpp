@@ -0,0 +1,73 @@
+/**
+ * @file codec_test.cpp
+ * @brief HexCodec decode and encode against a plain reference, whatever kernel TIHEX_ISA selects.
+ * ctest runs it once per level, see CMakeLists.txt.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../HexCodec.h"
+#include "Check.h"
+
+int main(){
+  const char *forced = std::getenv("TIHEX_ISA");
+  std::printf("HexCodec kernel: %s (TIHEX_ISA=%s)\n", HexCodec::isa(), forced ? forced : "");
+  // A forced level may only be lowered further by the CPU.
+  if(forced) Check::that(std::string("scalar sse2 avx2").find(HexCodec::isa()) <= std::string("scalar sse2 avx2").find(forced), "TIHEX_ISA bounds the selected kernel");
+
+  Check::Random random(2022);
+  // Every length up to a few vector widths, at every alignment of a 32 byte vector.
+  for(size_t length = 0; length <= 200; length++){
+    for(size_t offset = 0; offset < 32; offset++){
+      std::vector<uint8_t> bytes(offset + length);
+      for(auto &byte: bytes) byte = random.byte();
+      const uint8_t *in = bytes.data() + offset;
+
+      std::string expected(2*length + 1, '\0');
+      for(size_t i = 0; i < length; i++) std::snprintf(&expected[2*i], 3, "%.2X", in[i]);
+      expected.resize(2*length);
+
+      std::string text(offset + 2*length, '-');
+      HexCodec::encode(in, length, &text[offset]);
+      if(!Check::that(text.compare(offset, std::string::npos, expected) == 0, "encode matches printf(\"%.2X\")")) return Check::result();
+
+      // Lower case on random characters, then decode back.
+      for(size_t i = offset; i < text.size(); i++) if(random.byte() & 1) text[i] = static_cast<char>(std::tolower(text[i]));
+      std::vector<uint8_t> out(length + 1, 0xA5);
+      if(!Check::that(HexCodec::decode(text.data() + offset, length, out.data()), "decode accepts mixed case digits")) return Check::result();
+      if(!Check::that(std::memcmp(out.data(), in, length) == 0, "decode restores encoded bytes")) return Check::result();
+      Check::that(out[length] == 0xA5, "decode writes count bytes only");
+
+      // One invalid character anywhere must be caught.
+      if(length){
+        static const char invalid[] = {'G', 'g', 'x', ' ', ':', '/', '@', '`', '\0', '\x80'};
+        size_t position = offset + random.next() % (2*length);
+        char saved = text[position];
+        text[position] = invalid[random.next() % sizeof invalid];
+        if(!Check::that(!HexCodec::decode(text.data() + offset, length, out.data()), "decode rejects non hexadecimal characters")){
+          std::fprintf(stderr, "  length %zu, offset %zu, position %zu\n", length, offset, position - offset);
+          return Check::result();
+        }
+        text[position] = saved;
+      }
+    }
+  }
+
+  // Every byte value, and every character decodeByte() sees.
+  for(int value = 0; value < 256; value++){
+    char pair[3];
+    std::snprintf(pair, sizeof pair, "%.2X", value);
+    char encoded[2];
+    HexCodec::encodeByte(static_cast<uint8_t>(value), encoded);
+    Check::that(encoded[0] == pair[0] && encoded[1] == pair[1], "encodeByte matches printf(\"%.2X\")");
+    Check::that(HexCodec::decodeByte(pair) == value, "decodeByte restores encodeByte");
+    char digit[2] = {static_cast<char>(value), '0'};
+    bool isDigit = std::strchr("0123456789ABCDEFabcdef", value) && value;
+    Check::that((HexCodec::decodeByte(digit) >= 0) == isDigit, "decodeByte accepts hexadecimal digits only");
+  }
+  return Check::result();
+}
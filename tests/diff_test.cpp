@@ -0,0 +1,88 @@
+/**
+ * @file diff_test.cpp
+ * @brief TIHex::diff() against comparing two byte maps address by address, whatever the record layouts.
+ */
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../TIHex.h"
+#include "Check.h"
+#include "ImageText.h"
+
+typedef TIHex::Difference Difference;
+
+/* Maximal runs of each kind, address by address */
+static std::vector<Difference> reference(const ImageText::Bytes &oldBytes, const ImageText::Bytes &newBytes){
+  std::map<uint64_t, Difference::Kind> kinds;
+  for(auto &byte : oldBytes){
+    auto found = newBytes.find(byte.first);
+    if(found == newBytes.end()) kinds[byte.first] = Difference::Kind::Removed;
+    else if(found->second != byte.second) kinds[byte.first] = Difference::Kind::Changed;
+  }
+  for(auto &byte : newBytes){
+    if(!oldBytes.count(byte.first)) kinds[byte.first] = Difference::Kind::Added;
+  }
+  std::vector<Difference> differences;
+  for(auto &kind : kinds){
+    if(!differences.empty() && differences.back().kind == kind.second &&
+       differences.back().address + differences.back().length == kind.first) differences.back().length++;
+    else differences.push_back({kind.second, kind.first, 1});
+  }
+  return differences;
+}
+
+static void compare(const ImageText::Bytes &oldBytes, const ImageText::Bytes &newBytes, Check::Random &random, bool shuffled){
+  std::string oldText = ImageText::text(oldBytes, random, shuffled);
+  std::string newText = ImageText::text(newBytes, random, shuffled);
+  TIHex oldHex, newHex;
+  if(!Check::that(oldHex.load(oldText.data(), oldText.data() + oldText.size()) &&
+                  newHex.load(newText.data(), newText.data() + newText.size()), "test images load")) return;
+  std::vector<Difference> differences;
+  oldHex.diff(newHex, differences);
+  std::vector<Difference> expected = reference(oldBytes, newBytes);
+  bool same = differences.size() == expected.size();
+  for(size_t i = 0; same && i < expected.size(); i++){
+    same = differences[i].kind == expected[i].kind && differences[i].address == expected[i].address &&
+           differences[i].length == expected[i].length;
+  }
+  if(!Check::that(same, shuffled ? "diff() of scattered images matches the reference" : "diff() matches the reference")){
+    std::fprintf(stderr, "  %zu differences, %zu expected\n", differences.size(), expected.size());
+  }
+}
+
+int main(){
+  Check::Random random(24);
+  for(int round = 0; round < 150; round++){
+    // Runs of data around a 64 KiB boundary, then edits: changed bytes, removed and added runs.
+    ImageText::Bytes oldBytes, newBytes;
+    uint64_t base = 0x0800F000 + random.next() % 0x1000;
+    for(uint64_t address = base; address < base + 0x2000;){
+      uint64_t length = 1 + random.next() % 300;
+      if(random.next() % 4) for(uint64_t a = address; a < address + length; a++) oldBytes[a] = random.byte();
+      address += length;
+    }
+    newBytes = oldBytes;
+    unsigned edits = random.next() % 12;
+    for(unsigned e = 0; e < edits; e++){
+      uint64_t address = base + random.next() % 0x2000;
+      uint64_t length = 1 + random.next() % (random.next() % 2 ? 4 : 200);
+      switch(random.next() % 3){
+        case 0: // Change, where there is data.
+          for(uint64_t a = address; a < address + length; a++) if(newBytes.count(a)) newBytes[a] ^= 1 + random.next() % 255;
+          break;
+        case 1:
+          for(uint64_t a = address; a < address + length; a++) newBytes.erase(a);
+          break;
+        default: // Add, or overwrite.
+          for(uint64_t a = address; a < address + length; a++) newBytes[a] = random.byte();
+      }
+    }
+    compare(oldBytes, newBytes, random, false);
+    compare(oldBytes, newBytes, random, true);
+    compare(oldBytes, oldBytes, random, round % 2);
+  }
+  return Check::result();
+}
@@ -0,0 +1,119 @@
+/**
+ * @file find_test.cpp
+ * @brief ByteScan::Pattern and TIHex::find() against a brute force search, whatever kernel TIHEX_ISA selects.
+ * ctest runs it once per level, see CMakeLists.txt.
+ */
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../ByteScan.h"
+#include "../TIHex.h"
+#include "Check.h"
+#include "ImageText.h"
+
+static bool matchesAt(const uint8_t *data, const std::vector<uint8_t> &pattern, const std::vector<uint8_t> &mask){
+  for(size_t i = 0; i < pattern.size(); i++) if((data[i] ^ pattern[i]) & mask[i]) return false;
+  return true;
+}
+
+/* Random pattern: some bytes taken from data so it may occur, wildcard bytes and nibbles, 00 and FF bytes. Patterns
+ * without any whole byte to anchor the pair filter on go through Horspool or the scalar search. */
+static void pick(Check::Random &random, const uint8_t *data, size_t size, std::vector<uint8_t> &pattern, std::vector<uint8_t> &mask){
+  size_t length = 1 + random.next() % (random.next() % 4 ? 12 : 64);
+  if(length > size) length = size;
+  size_t from = random.next() % (size - length + 1);
+  pattern.assign(data + from, data + from + length);
+  mask.assign(length, 0xFF);
+  unsigned style = random.next() % 7;
+  for(size_t i = 0; i < length; i++){
+    unsigned r = random.next() % 16;
+    if(style == 1 && r < 3) mask[i] = 0x00;
+    if(style == 2 && r < 3) mask[i] = r & 1 ? 0xF0 : 0x0F;
+    if(style == 3) pattern[i] = r < 8 ? 0x00 : 0xFF;         // Only bytes filling most images.
+    if(style == 4) pattern[i] = pattern[0];                   // One value only.
+    if(style == 5 && r < 2) pattern[i] = random.byte();       // Likely no match.
+    if(style == 6) mask[i] = r < 6 ? 0xF0 : r < 12 ? 0x0F : 0x00; // No whole byte: Horspool.
+  }
+  if(random.next() % 20 == 0) mask.assign(length, 0x00);     // Anything matches.
+}
+
+static void checkPattern(Check::Random &random){
+  // Few byte values, so candidate positions abound.
+  std::vector<uint8_t> data(1 + random.next() % 3000);
+  unsigned values = 2 + random.next() % 6;
+  for(auto &byte : data){
+    uint8_t value = random.next() % values;
+    byte = value == 0 ? 0x00 : value == 1 ? 0xFF : static_cast<uint8_t>(0x40 + value);
+  }
+  std::vector<uint8_t> pattern, mask;
+  pick(random, data.data(), data.size(), pattern, mask);
+  ByteScan::Pattern compiled(pattern.data(), mask.data(), pattern.size());
+  size_t offset = random.next() % 40; // Unaligned starts.
+  if(offset > data.size()) offset = 0;
+  for(size_t start = offset; start <= data.size();){
+    size_t found = compiled.find(data.data() + start, data.size() - start);
+    size_t expected = start;
+    while(expected + pattern.size() <= data.size() && !matchesAt(data.data() + expected, pattern, mask)) expected++;
+    if(expected + pattern.size() > data.size()) expected = data.size();
+    if(!Check::that(start + found == expected, "Pattern::find() gives the first match")){
+      std::fprintf(stderr, "  length %zu, data %zu, from %zu: %zu instead of %zu\n", pattern.size(), data.size(), start, start + found, expected);
+      return;
+    }
+    if(expected == data.size()) break;
+    start = expected + 1;
+  }
+}
+
+static void checkImage(Check::Random &random, bool shuffled){
+  ImageText::Bytes bytes;
+  uint64_t base = 0x0800F000 + random.next() % 0x1000;
+  for(uint64_t address = base; address < base + 0x2000;){
+    uint64_t length = 1 + random.next() % 400;
+    if(random.next() % 4) for(uint64_t a = address; a < address + length; a++) bytes[a] = 0x40 + random.next() % 3;
+    address += length;
+  }
+  if(bytes.empty()) return;
+  std::string text = ImageText::text(bytes, random, shuffled);
+  TIHex hex;
+  if(!Check::that(hex.load(text.data(), text.data() + text.size()), "test image loads")) return;
+
+  // Flat copy of the map, with its runs of contiguous addresses.
+  std::vector<uint8_t> flat(base + 0x2000 - base + 512);
+  std::vector<bool> present(flat.size());
+  for(auto &byte : bytes){
+    flat[byte.first - base] = byte.second;
+    present[byte.first - base] = true;
+  }
+  for(int p = 0; p < 20; p++){
+    auto it = bytes.begin();
+    std::advance(it, random.next() % bytes.size());
+    std::vector<uint8_t> run;
+    for(auto next = it; next != bytes.end() && run.size() < 64 && next->first == it->first + run.size(); ++next) run.push_back(next->second);
+    std::vector<uint8_t> pattern, mask;
+    pick(random, run.data(), run.size(), pattern, mask);
+    std::vector<TIHex::Address> matches, expected;
+    hex.find(pattern.data(), mask.data(), pattern.size(), matches);
+    for(size_t at = 0; at + pattern.size() <= flat.size(); at++){
+      bool whole = true;
+      for(size_t i = 0; whole && i < pattern.size(); i++) whole = present[at + i];
+      if(whole && matchesAt(flat.data() + at, pattern, mask)) expected.push_back(base + at);
+    }
+    if(!Check::that(matches == expected, shuffled ? "TIHex::find() on scattered records matches brute force" : "TIHex::find() matches brute force")){
+      std::fprintf(stderr, "  length %zu: %zu matches, %zu expected\n", pattern.size(), matches.size(), expected.size());
+      return;
+    }
+  }
+}
+
+int main(){
+  std::printf("ByteScan kernel: %s\n", ByteScan::isa());
+  Check::Random random(25);
+  for(int round = 0; round < 3000; round++) checkPattern(random);
+  for(int round = 0; round < 40; round++){
+    checkImage(random, false);
+    checkImage(random, true);
+  }
+  return Check::result();
+}
@@ -0,0 +1,118 @@
+/**
+ * @file hash_test.cpp
+ * @brief Hash against published check values and bitwise references, whatever kernels TIHEX_ISA selects, and
+ * TIHex::hash() against hashing read() output. ctest runs it with native and scalar kernels, see CMakeLists.txt.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../Hash.h"
+#include "../TIHex.h"
+#include "../bench/Corpus.h"
+#include "Check.h"
+
+static std::string hex(const uint8_t *digest, size_t size){
+  std::string text;
+  char pair[3];
+  for(size_t i = 0; i < size; i++){
+    std::snprintf(pair, sizeof pair, "%.2x", digest[i]);
+    text += pair;
+  }
+  return text;
+}
+
+static std::string digestOf(Hash::Algorithm algorithm, const std::string &text){
+  Hash hash(algorithm);
+  hash.update(reinterpret_cast<const uint8_t *>(text.data()), text.size());
+  uint8_t digest[Hash::DIGEST_MAX];
+  hash.final(digest);
+  return hex(digest, hash.size());
+}
+
+/* Reflected CRC, one bit at a time */
+static uint32_t crcReference(uint32_t polynomial, const uint8_t *data, size_t size){
+  uint32_t crc = 0xFFFFFFFF;
+  for(size_t i = 0; i < size; i++){
+    crc ^= data[i];
+    for(int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (crc & 1 ? polynomial : 0);
+  }
+  return ~crc;
+}
+
+int main(){
+  const char *forced = std::getenv("TIHEX_ISA");
+  std::printf("Hash kernels: %s (TIHEX_ISA=%s)\n", Hash::isa(), forced ? forced : "");
+  if(forced && !std::strcmp(forced, "scalar")) Check::that(!std::strcmp(Hash::isa(), "scalar"), "TIHEX_ISA=scalar selects portable code");
+
+  // Check values of the CRC catalogue and FIPS 180-2 examples.
+  Check::that(digestOf(Hash::Algorithm::Crc32, "123456789") == "cbf43926", "CRC32 check value");
+  Check::that(digestOf(Hash::Algorithm::Crc32c, "123456789") == "e3069283", "CRC32C check value");
+  Check::that(digestOf(Hash::Algorithm::Crc32, "") == "00000000", "CRC32 of nothing");
+  Check::that(digestOf(Hash::Algorithm::Sha256, "abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", "SHA-256 of \"abc\"");
+  Check::that(digestOf(Hash::Algorithm::Sha256, "") == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855", "SHA-256 of nothing");
+  Check::that(digestOf(Hash::Algorithm::Sha256, "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+              "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1", "SHA-256 of two blocks");
+  Hash million(Hash::Algorithm::Sha256);
+  million.update('a', 1000000);
+  uint8_t digest[Hash::DIGEST_MAX];
+  million.final(digest);
+  Check::that(hex(digest, 32) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0", "SHA-256 of a million 'a'");
+
+  // CRCs of every length up to a few folding blocks and at every alignment, then split at random places.
+  Check::Random random(18);
+  std::vector<uint8_t> buffer(4096 + 64);
+  for(auto &byte : buffer) byte = random.byte();
+  for(size_t size = 0; size <= 1024; size += size < 300 ? 1 : 37){
+    const uint8_t *data = buffer.data() + random.next() % 64;
+    uint32_t crc32 = Hash::crc32(data, size), crc32c = Hash::crc32c(data, size);
+    if(!Check::that(crc32 == crcReference(0xEDB88320, data, size), "CRC32 matches the bitwise reference") ||
+       !Check::that(crc32c == crcReference(0x82F63B78, data, size), "CRC32C matches the bitwise reference")){
+      std::fprintf(stderr, "  size %zu\n", size);
+      break;
+    }
+    size_t split = size ? random.next() % size : 0;
+    Check::that(Hash::crc32(data + split, size - split, Hash::crc32(data, split)) == crc32, "CRC32 continues from a previous CRC");
+    Check::that(Hash::crc32c(data + split, size - split, Hash::crc32c(data, split)) == crc32c, "CRC32C continues from a previous CRC");
+  }
+  for(auto algorithm : {Hash::Algorithm::Crc32, Hash::Algorithm::Crc32c, Hash::Algorithm::Sha256}){
+    Hash whole(algorithm), pieces(algorithm);
+    whole.update(buffer.data(), 4096);
+    whole.update(0x5A, 1000);
+    for(size_t done = 0; done < 4096;){
+      size_t size = std::min<size_t>(random.next() % 200, 4096 - done);
+      pieces.update(buffer.data() + done, size);
+      done += size;
+    }
+    std::vector<uint8_t> padding(1000, 0x5A);
+    pieces.update(padding.data(), padding.size());
+    uint8_t wholeDigest[Hash::DIGEST_MAX], piecesDigest[Hash::DIGEST_MAX];
+    whole.final(wholeDigest);
+    pieces.final(piecesDigest);
+    Check::that(!std::memcmp(wholeDigest, piecesDigest, whole.size()), "hashing in pieces and repeated bytes gives the same digest");
+  }
+
+  // Image ranges with holes hash as read() fills them.
+  std::string firmware = Corpus(256 << 10, 5).text();
+  TIHex image;
+  image.load(firmware.data(), firmware.data() + firmware.size());
+  TIHex::Address first = image.segments().front().address;
+  for(int round = 0; round < 50; round++){
+    TIHex::Address address = first + random.next() % (512 << 10);
+    std::vector<uint8_t> bytes(random.next() % (64 << 10));
+    image.read(address, bytes.data(), bytes.size(), 0x00);
+    for(auto algorithm : {Hash::Algorithm::Crc32, Hash::Algorithm::Sha256}){
+      Hash ranged(algorithm), expected(algorithm);
+      image.hash(address, bytes.size(), ranged, 0x00);
+      expected.update(bytes.data(), bytes.size());
+      uint8_t rangedDigest[Hash::DIGEST_MAX], expectedDigest[Hash::DIGEST_MAX];
+      ranged.final(rangedDigest);
+      expected.final(expectedDigest);
+      Check::that(!std::memcmp(rangedDigest, expectedDigest, ranged.size()), "TIHex::hash() hashes read() bytes");
+    }
+  }
+  return Check::result();
+}
@@ -0,0 +1,145 @@
+/**
+ * @file inplace_test.cpp
+ * @brief TIHex::writeInPlace() on a copy of the image file against write() of the same edits.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../PatchSet.h"
+#include "../TIHex.h"
+#include "../bench/Corpus.h"
+#include "Check.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+
+/* Temporary file holding a copy of the text, removed on destruction */
+class TempFile
+{
+public:
+    explicit TempFile(const std::string &text)
+    {
+        char path[] = "/tmp/inplace_testXXXXXX";
+        __fd = mkstemp(path);
+        __path = path;
+        if(__fd >= 0 && (::write(__fd, text.data(), text.size()) != static_cast<ssize_t>(text.size()))){
+            ::close(__fd);
+            __fd = -1;
+        }
+    }
+    ~TempFile()
+    {
+        if(__fd >= 0) ::close(__fd);
+        ::unlink(__path.c_str());
+    }
+    int fd() const { return __fd; }
+
+    std::string text() const
+    {
+        std::string text;
+        char buffer[1 << 16];
+        ssize_t n;
+        for(off_t offset = 0; (n = ::pread(__fd, buffer, sizeof buffer, offset)) > 0; offset += n) text.append(buffer, n);
+        return text;
+    }
+
+private:
+    int __fd;
+    std::string __path;
+};
+
+static std::string output(TIHex &hex){
+  std::ostringstream out;
+  hex.write(out);
+  return out.str();
+}
+
+/* Canonical lines with blanks before each ':', as many as given for that line */
+static std::string indented(const std::string &text, const std::vector<unsigned> &blanks){
+  std::string result;
+  size_t line = 0;
+  for(size_t p = 0; p < text.size(); p++){
+    if(text[p] == ':' && (p == 0 || text[p - 1] == '\n')){
+      for(unsigned b = 0; b < blanks[line]; b++) result += b % 2 ? '\t' : ' ';
+      line++;
+    }
+    result += text[p];
+  }
+  return result;
+}
+
+/* Random overwrites and patches inside segments */
+static void edit(TIHex &hex, Check::Random &random){
+  std::vector<TIHex::Segment> segments = hex.segments();
+  unsigned edits = 1 + random.next() % 200;
+  for(unsigned e = 0; e < edits; e++){
+    const TIHex::Segment &segment = segments[random.next() % segments.size()];
+    uint64_t length = 1 + random.next() % (random.next() % 2 ? 4 : 300);
+    if(length > segment.length) length = segment.length;
+    uint64_t address = segment.address + random.next() % (segment.length - length + 1);
+    std::vector<uint8_t> bytes(length);
+    for(auto &byte : bytes) byte = random.byte();
+    if(random.next() % 2){
+      Check::that(hex.overwrite(address, bytes.data(), bytes.size()), "range overwrite inside a segment");
+    }else{
+      PatchSet patches;
+      patches.add(address, bytes.data(), bytes.size());
+      patches.sort();
+      Check::that(hex.apply(patches), "patch inside a segment");
+    }
+  }
+}
+
+static void checkInPlace(const std::string &canonical, Check::Random &random, unsigned threads, bool blanks){
+  size_t lines = 0;
+  for(char c : canonical) lines += c == '\n';
+  std::vector<unsigned> counts(lines, 0);
+  if(blanks) for(auto &count : counts) count = random.next() % 3 ? 0 : 1 + random.next() % 3;
+  std::string text = indented(canonical, counts);
+  TempFile file(text);
+  if(!Check::that(file.fd() >= 0, "temporary file is written")) return;
+  TIHex hex;
+  if(!Check::that(hex.load(text.data(), text.data() + text.size(), threads), "image loads")) return;
+  if(random.next() % 2) hex.setLazyChecksum(true);
+  for(int pass = 0; pass < 2; pass++){
+    edit(hex, random);
+    Check::that(hex.writeInPlace(file.fd()), "writeInPlace() succeeds");
+    Check::that(file.text() == indented(output(hex), counts), "file gets the records write() gives, blanks kept");
+  }
+  Check::that(hex.writeInPlace(file.fd()) && file.text() == indented(output(hex), counts),
+              "writeInPlace() without edits leaves the file as it was");
+
+  // An edited record that did not come from the file: nothing is written, not even other edits.
+  std::string before = file.text();
+  hex.append(std::string(":020000047FFF7C"));
+  hex.append(std::string(":0100000055AA"));
+  uint8_t byte = 0xA5;
+  Check::that(hex.overwrite(0x7FFF0000, byte), "appended record is edited");
+  edit(hex, random);
+  Check::that(!hex.writeInPlace(file.fd()) && hex.error() == TIHex::Error::NotInSource, "writeInPlace() reports NotInSource");
+  Check::that(file.text() == before, "NotInSource leaves the file untouched");
+}
+
+int main(){
+  Check::Random random(14);
+  std::string small = Corpus(256 << 10, 14).text();
+  std::string large = Corpus(3 << 20, 15).text();
+  for(int round = 0; round < 4; round++){
+    checkInPlace(small, random, 1, round % 2);
+    checkInPlace(large, random, round % 2 ? 1 : 4, round >= 2);
+  }
+  return Check::result();
+}
+
+#else
+
+int main(){
+  std::fprintf(stderr, "writeInPlace() needs POSIX file descriptors: nothing to check.\n");
+  return 0;
+}
+
+#endif
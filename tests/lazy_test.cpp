@@ -0,0 +1,101 @@
+/**
+ * @file lazy_test.cpp
+ * @brief Lazy checksums calculated by TIHex::finalize() against checksums calculated on each overwrite.
+ */
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../PatchSet.h"
+#include "../TIHex.h"
+#include "../bench/Corpus.h"
+#include "Check.h"
+
+static std::string output(TIHex &hex){
+  std::ostringstream out;
+  hex.write(out);
+  return out.str();
+}
+
+/* Random address and length inside one segment, so range overwrites find data everywhere */
+static TIHex::Range pick(const std::vector<TIHex::Segment> &segments, Check::Random &random, uint64_t maximum){
+  const TIHex::Segment &segment = segments[random.next() % segments.size()];
+  uint64_t length = 1 + random.next() % maximum;
+  if(length > segment.length) length = segment.length;
+  return {segment.address + random.next() % (segment.length - length + 1), length};
+}
+
+/* Same edits on both images, the lazy one being read through begin() or operator[] from time to time */
+static void edit(TIHex &eager, TIHex &lazy, Check::Random &random){
+  const std::vector<TIHex::Segment> segments = eager.segments();
+  std::vector<TIHex::Range> touched;
+  unsigned edits = 50 + random.next() % 200;
+  for(unsigned e = 0; e < edits; e++){
+    // Often back on an edited range: its records are still dirty, or were finalized since.
+    TIHex::Range range = touched.empty() || random.next() % 3 ? pick(segments, random, random.next() % 2 ? 4 : 300)
+                                                             : touched[random.next() % touched.size()];
+    touched.push_back(range);
+    std::vector<uint8_t> bytes(range.length);
+    for(auto &byte : bytes) byte = random.byte();
+    switch(random.next() % 4){
+      case 0:
+        for(uint64_t k = 0; k < range.length; k++){
+          eager.overwrite(range.address + k, bytes[k]);
+          lazy.overwrite(range.address + k, bytes[k]);
+        }
+        break;
+      case 1: {
+        TIHex::Cursor eagerCursor(eager), lazyCursor(lazy);
+        for(uint64_t k = 0; k < range.length; k++){
+          eagerCursor.overwrite(range.address + k, bytes[k]);
+          lazyCursor.overwrite(range.address + k, bytes[k]);
+        }
+        break;
+      }
+      case 2: {
+        PatchSet patches;
+        patches.add(range.address, bytes.data(), bytes.size());
+        TIHex::Range more = pick(segments, random, 40);
+        patches.add(more.address, bytes.data(), more.length < bytes.size() ? more.length : bytes.size());
+        patches.sort();
+        Check::that(eager.apply(patches) == lazy.apply(patches), "apply() succeeds on both images, or on none");
+        break;
+      }
+      default:
+        Check::that(eager.overwrite(range.address, bytes.data(), bytes.size()) &&
+                    lazy.overwrite(range.address, bytes.data(), bytes.size()), "range overwrite inside a segment");
+    }
+    switch(random.next() % 16){
+      case 0: // Finalizes.
+        lazy.begin();
+        break;
+      case 1: { // Finalizes, looking up the record holding the first edited address.
+        TIHex::Address start = eager.lowerAddress(range.address + 1);
+        Check::that(lazy[start].checksum() == eager[start].checksum(), "operator[] gives the finalized checksum");
+        break;
+      }
+    }
+  }
+}
+
+int main(){
+  Check::Random random(9);
+  std::string text = Corpus(256 << 10, 9).text();
+  for(int round = 0; round < 20; round++){
+    TIHex eager, lazy;
+    if(!Check::that(eager.load(text.data(), text.data() + text.size()) && lazy.load(text.data(), text.data() + text.size()),
+                    "corpus loads")) break;
+    lazy.setLazyChecksum(true);
+    edit(eager, lazy, random);
+    Check::that(lazy.lazyChecksum(), "lazy checksum mode stays on");
+    Check::that(output(lazy) == output(eager), "lazy checksums write the same text as eager ones");
+    // More edits after the output finalized every record.
+    edit(eager, lazy, random);
+    lazy.setLazyChecksum(false);
+    Check::that(output(lazy) == output(eager), "turning lazy checksums off finalizes them");
+    Check::that(output(lazy) != text, "edits changed the image");
+  }
+  return Check::result();
+}
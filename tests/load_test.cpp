@@ -0,0 +1,100 @@
+/**
+ * @file load_test.cpp
+ * @brief TIHex::load() on several threads against the serial load: same records, same output, same errors.
+ */
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../TIHex.h"
+#include "../bench/Corpus.h"
+#include "Check.h"
+
+/* What a loaded image looks like from outside */
+struct Loaded
+{
+    bool success;
+    TIHex::Error error;
+    uint64_t errorLine;
+    uint64_t errorOffset;
+    std::string text;
+    std::vector<TIHex::Segment> segments;
+};
+
+static Loaded load(const std::string &text, unsigned threads){
+  TIHex hex;
+  Loaded loaded;
+  loaded.success = hex.load(text.data(), text.data() + text.size(), threads);
+  loaded.error = hex.error();
+  loaded.errorLine = hex.errorLine();
+  loaded.errorOffset = hex.errorOffset();
+  std::ostringstream out;
+  hex.write(out);
+  loaded.text = out.str();
+  loaded.segments = hex.segments();
+  return loaded;
+}
+
+static void compare(const std::string &text, const char *what){
+  Loaded serial = load(text, 1);
+  for(unsigned threads : {2u, 3u, 4u, 7u}){
+    Loaded parallel = load(text, threads);
+    bool same = parallel.success == serial.success && parallel.error == serial.error &&
+                parallel.errorLine == serial.errorLine && parallel.errorOffset == serial.errorOffset &&
+                parallel.text == serial.text && parallel.segments.size() == serial.segments.size();
+    for(size_t i = 0; same && i < serial.segments.size(); i++){
+      same = parallel.segments[i].address == serial.segments[i].address && parallel.segments[i].length == serial.segments[i].length;
+    }
+    if(!Check::that(same, what)) std::fprintf(stderr, "  %u threads: error %s line %llu, serial error %s line %llu\n", threads,
+                                              TIHex::errorString(parallel.error).c_str(), (unsigned long long)parallel.errorLine,
+                                              TIHex::errorString(serial.error).c_str(), (unsigned long long)serial.errorLine);
+  }
+}
+
+/* Append one record with its checksum */
+static void record(std::string &text, uint8_t type, uint16_t address, const uint8_t *data, uint8_t size){
+  char line[600];
+  unsigned sum = size + (address >> 8) + (address & 0xFF) + type;
+  int length = std::snprintf(line, sizeof line, ":%.2X%.4X%.2X", size, address, type);
+  for(uint8_t i = 0; i < size; i++){
+    length += std::snprintf(line + length, sizeof line - length, "%.2X", data[i]);
+    sum += data[i];
+  }
+  std::snprintf(line + length, sizeof line - length, "%.2X\n", (0x100 - (sum & 0xFF)) & 0xFF);
+  text += line;
+}
+
+int main(){
+  // Synthetic firmware, with its 0x02 and 0x04 records spread everywhere.
+  std::string firmware = Corpus(4 << 20, 7).text();
+  if(!Check::that(load(firmware, 1).text == firmware, "serial load writes the corpus back")) return Check::result();
+  compare(firmware, "corpus loads the same on several threads");
+
+  // A single Extended Linear Address record, then records running across many 64K windows: later chunks only have
+  // addresses relative to the chunk input, which must be carried from the chunks before.
+  std::string relative;
+  uint8_t upper[2] = {0x12, 0x34};
+  record(relative, 0x04, 0, upper, 2);
+  Check::Random random(4);
+  uint8_t data[16];
+  for(uint32_t i = 0; i < 200000; i++){
+    for(auto &byte : data) byte = random.byte();
+    record(relative, 0x00, static_cast<uint16_t>(i * 16), data, 16);
+  }
+  std::string relativeEnd = relative + ":00000001FF\n";
+  compare(relativeEnd, "address pointers are carried between chunks");
+
+  // Errors anywhere: the first one wins, records before it are kept.
+  for(double where : {0.1, 0.3, 0.5, 0.74, 0.99}){
+    std::string broken = firmware;
+    size_t line = broken.find('\n', static_cast<size_t>(broken.size() * where)) + 1;
+    broken[line + 3] = 'x';
+    compare(broken, "a malformed line fails the same way on several threads");
+    broken[line + 3] = '0';
+    broken.insert(line, "\n\n:0\n");
+    compare(broken, "a short line after empty lines fails the same way on several threads");
+  }
+  return Check::result();
+}
@@ -0,0 +1,135 @@
+/**
+ * @file patch_test.cpp
+ * @brief PatchSet merging and conflicts against a byte map reference, patch file parsing, and TIHex::apply().
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../PatchSet.h"
+#include "../TIHex.h"
+#include "Check.h"
+
+/* Merge edits in adding order, as PatchSet::sort() must: the last one wins, other values at the same address conflict. */
+static void checkMerge(Check::Random &random){
+  PatchSet patches;
+  std::map<PatchSet::Address, uint8_t> expected;
+  std::map<PatchSet::Address, bool> conflicting;
+  unsigned edits = 1 + random.next() % 12;
+  for(unsigned e = 0; e < edits; e++){
+    PatchSet::Address address = random.next() % 200;
+    std::vector<uint8_t> bytes(1 + random.next() % 24);
+    for(auto &byte : bytes) byte = random.byte() & 1; // Few values: many overlaps agree.
+    patches.add(address, bytes.data(), bytes.size());
+    for(size_t k = 0; k < bytes.size(); k++){
+      auto found = expected.find(address + k);
+      if(found != expected.end() && found->second != bytes[k]) conflicting[address + k] = true;
+      expected[address + k] = bytes[k];
+    }
+  }
+  PatchSet::Address conflict = ~static_cast<PatchSet::Address>(0);
+  bool consistent = patches.sort(&conflict);
+  Check::that(consistent == conflicting.empty(), "sort() reports conflicts, and only them");
+  if(!consistent) Check::that(conflicting.count(conflict) == 1, "sort() conflict address gets two values");
+
+  // Patches cover the edited addresses exactly, in order, neither overlapping nor touching.
+  std::map<PatchSet::Address, uint8_t> merged;
+  const auto &list = patches.patches();
+  for(size_t p = 0; p < list.size(); p++){
+    if(p) Check::that(list[p].address > list[p - 1].address + list[p - 1].length, "patches are sorted apart");
+    for(uint64_t k = 0; k < list[p].length; k++) merged[list[p].address + k] = patches.data(list[p])[k];
+    Check::that(patches.lowerBound(list[p].address) == p && patches.lowerBound(list[p].address + list[p].length - 1) == p,
+                "lowerBound() finds the patch holding an address");
+  }
+  Check::that(merged == expected, "patches hold the last value given to each address");
+}
+
+/* Append one record with its checksum */
+static void record(TIHex &hex, uint8_t type, uint16_t address, const uint8_t *data, uint8_t size){
+  char line[600];
+  unsigned sum = size + (address >> 8) + (address & 0xFF) + type;
+  int length = std::snprintf(line, sizeof line, ":%.2X%.4X%.2X", size, address, type);
+  for(uint8_t i = 0; i < size; i++){
+    length += std::snprintf(line + length, sizeof line - length, "%.2X", data[i]);
+    sum += data[i];
+  }
+  std::snprintf(line + length, sizeof line - length, "%.2X", (0x100 - (sum & 0xFF)) & 0xFF);
+  Check::that(hex.append(std::string(line)), "test image record is valid");
+}
+
+static void checkParse(){
+  const char text[] = "# serial numbers\n"
+                      "0800F000 DEADBEEF # board 1\n"
+                      "\n"
+                      "  0x10 01 02 0304\r\n"
+                      "10\tFF\n";
+  PatchSet patches;
+  uint64_t errorLine = 0;
+  Check::that(patches.parse(text, text + sizeof text - 1, &errorLine), "patch file parses");
+  patches.sort();
+  const auto &list = patches.patches();
+  if(Check::that(list.size() == 2, "patch file gives two patches")){
+    static const uint8_t first[] = {0xFF, 0x02, 0x03, 0x04};
+    Check::that(list[0].address == 0x10 && list[0].length == 4 && !std::memcmp(patches.data(list[0]), first, 4), "later line wins on 0x10");
+    static const uint8_t second[] = {0xDE, 0xAD, 0xBE, 0xEF};
+    Check::that(list[1].address == 0x0800F000 && list[1].length == 4 && !std::memcmp(patches.data(list[1]), second, 4), "grouped bytes");
+  }
+
+  for(const char *bad : {"10 0G\n", "10 012\n", "10\n", "G0 01\n", "0x 01\n", "11112222333344445 01\n", "FFFFFFFFFFFFFFFF 01 02\n"}){
+    std::string broken = std::string("20 AA\n") + bad + "30 BB\n";
+    PatchSet rejected;
+    errorLine = 0;
+    bool parsed = rejected.parse(broken.data(), broken.data() + broken.size(), &errorLine);
+    Check::that(!parsed && errorLine == 2, "malformed patch line is reported");
+    if(parsed || errorLine != 2) std::fprintf(stderr, "  on \"%s\"\n", bad);
+  }
+}
+
+static void checkApply(){
+  // Data on 0x00 to 0x3F and 0x80 to 0xBF.
+  TIHex hex;
+  uint8_t data[16];
+  for(uint16_t address = 0; address < 0xC0; address += 16){
+    if(address >= 0x40 && address < 0x80) continue;
+    for(int i = 0; i < 16; i++) data[i] = static_cast<uint8_t>(address + i);
+    record(hex, 0x00, address, data, 16);
+  }
+  uint8_t before[0xC0], after[0xC0];
+  hex.read(0, before, sizeof before, 0xEE);
+
+  PatchSet inside;
+  static const uint8_t bytes[] = {1, 2, 3, 4, 5, 6, 7, 8};
+  inside.add(0x0C, bytes, 8);    // Across two records.
+  inside.add(0x3E, bytes, 2);    // Last bytes before the gap.
+  inside.add(0x80, bytes + 4, 4);
+  inside.sort();
+  Check::that(hex.apply(inside), "apply() writes patches on data");
+  hex.read(0, after, sizeof after, 0xEE);
+  uint8_t expected[0xC0];
+  std::memcpy(expected, before, sizeof expected);
+  std::memcpy(expected + 0x0C, bytes, 8);
+  std::memcpy(expected + 0x3E, bytes, 2);
+  std::memcpy(expected + 0x80, bytes + 4, 4);
+  Check::that(!std::memcmp(after, expected, sizeof after), "apply() writes patch bytes only");
+
+  PatchSet hole;
+  hole.add(0x20, bytes, 4);
+  hole.add(0x3E, bytes, 4);    // Runs into the gap.
+  hole.sort();
+  TIHex::Range unwritten = {0, 0};
+  Check::that(!hex.apply(hole, true, &unwritten) && hex.error() == TIHex::Error::AddressNotFound, "apply() fails over a gap");
+  Check::that(unwritten.address == 0x40, "apply() reports the first address without data");
+  hex.read(0, before, sizeof before, 0xEE);
+  Check::that(!std::memcmp(after, before, sizeof after), "failed apply() writes nothing");
+}
+
+int main(){
+  Check::Random random(12);
+  for(int round = 0; round < 20000; round++) checkMerge(random);
+  checkParse();
+  checkApply();
+  return Check::result();
+}
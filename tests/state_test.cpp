@@ -0,0 +1,201 @@
+/**
+ * @file state_test.cpp
+ * @brief TIHex::saveState() and loadState() against the parsed image, and ImageCache falling back to parsing whenever a
+ * cache file can't be trusted.
+ */
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../ImageCache.h"
+#include "../MappedFile.h"
+#include "../TIHex.h"
+#include "../bench/Corpus.h"
+#include "Check.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+
+/* Temporary file name, the file and its cache being removed on destruction */
+class TempPath
+{
+public:
+    TempPath()
+    {
+        char path[] = "/tmp/state_testXXXXXX";
+        int fd = mkstemp(path);
+        if(fd >= 0) ::close(fd);
+        __path = path;
+    }
+    ~TempPath()
+    {
+        ::unlink(__path.c_str());
+        ::unlink(ImageCache::path(__path).c_str());
+    }
+    const std::string &path() const { return __path; }
+
+private:
+    std::string __path;
+};
+
+static bool writeFile(const std::string &path, const char *data, size_t size){
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if(!file) return false;
+  bool ok = std::fwrite(data, 1, size, file) == size;
+  return std::fclose(file) == 0 && ok;
+}
+
+static std::string readFile(const std::string &path){
+  MappedFile file;
+  return file.open(path) ? std::string(file.begin(), file.size()) : std::string();
+}
+
+static std::string output(TIHex &hex){
+  std::ostringstream out;
+  hex.write(out);
+  return out.str();
+}
+
+static bool sameSegments(TIHex &a, TIHex &b){
+  const std::vector<TIHex::Segment> &first = a.segments();
+  const std::vector<TIHex::Segment> &second = b.segments();
+  if(first.size() != second.size()) return false;
+  for(size_t i = 0; i < first.size(); i++){
+    if(first[i].address != second[i].address || first[i].length != second[i].length) return false;
+  }
+  return true;
+}
+
+/* Same new bytes on both images, for every data record */
+static void edit(TIHex &a, TIHex &b, Check::Random &random){
+  for(auto &segment : a.segments()){
+    std::vector<uint8_t> bytes(segment.length);
+    for(auto &byte : bytes) byte = random.byte();
+    a.overwrite(segment.address, bytes.data(), bytes.size());
+    b.overwrite(segment.address, bytes.data(), bytes.size());
+  }
+}
+
+/* A restored image behaves as the parsed one, down to writing edits back into the source text */
+static void checkRoundTrip(const std::string &text, Check::Random &random, unsigned threads){
+  TIHex parsed;
+  if(!Check::that(parsed.load(text.data(), text.data() + text.size(), threads), "image loads")) return;
+  std::vector<char> state;
+  parsed.saveState(state);
+  TIHex restored;
+  if(!Check::that(restored.loadState(state.data(), state.data() + state.size()), "state loads")) return;
+  Check::that(output(restored) == output(parsed), "restored image writes the same text");
+  Check::that(sameSegments(restored, parsed), "restored image has the same segments");
+
+  TempPath parsedFile, restoredFile;
+  if(!Check::that(writeFile(parsedFile.path(), text.data(), text.size()) &&
+                  writeFile(restoredFile.path(), text.data(), text.size()), "source copies are written")) return;
+  edit(parsed, restored, random);
+  std::FILE *a = std::fopen(parsedFile.path().c_str(), "r+b");
+  std::FILE *b = std::fopen(restoredFile.path().c_str(), "r+b");
+  if(Check::that(a && b, "source copies open")){
+    Check::that(parsed.writeInPlace(fileno(a)) && restored.writeInPlace(fileno(b)), "writeInPlace() succeeds");
+  }
+  if(a) std::fclose(a);
+  if(b) std::fclose(b);
+  Check::that(readFile(restoredFile.path()) == readFile(parsedFile.path()), "restored source offsets write in place alike");
+
+  // Truncated states are rejected, leaving an empty image.
+  for(int round = 0; round < 20; round++){
+    size_t size = random.next() % state.size();
+    TIHex truncated;
+    Check::that(!truncated.loadState(state.data(), state.data() + size) && truncated.size() == 0,
+                "truncated state is rejected");
+  }
+}
+
+/* Headers of imported images are built field by field, none of their bytes is left to chance */
+static void checkImported(Check::Random &random){
+  std::vector<uint8_t> data(5000);
+  for(auto &byte : data) byte = random.next() % 3 ? random.byte() : 0xFF;
+  std::vector<char> first, second;
+  {
+    TIHex hex;
+    hex.importBinary(data.data(), data.size(), 0x1FFF0, 32, true);
+    hex.saveState(first);
+  }
+  {
+    std::vector<uint8_t> garbage(1 << 16, 0xA5);
+  } // Freed memory the next headers may be allocated in.
+  {
+    TIHex hex;
+    hex.importBinary(data.data(), data.size(), 0x1FFF0, 32, true);
+    hex.saveState(second);
+  }
+  Check::that(first == second, "states of the same imported image are the same bytes");
+}
+
+/* Same steps as the tool: use the cache when it loads, parse the text otherwise */
+static bool open(TIHex &hex, const std::string &path, const ImageCache::Key &key, const std::string &text){
+  if(ImageCache::load(hex, ImageCache::path(path), key)) return true;
+  Check::that(hex.size() == 0, "rejected cache leaves the image empty");
+  hex.load(text.data(), text.data() + text.size());
+  return false;
+}
+
+static void checkCache(const std::string &text, Check::Random &random){
+  TempPath source;
+  if(!Check::that(writeFile(source.path(), text.data(), text.size()), "source is written")) return;
+  MappedFile file;
+  if(!Check::that(file.open(source.path()), "source opens")) return;
+  ImageCache::Key key = ImageCache::key(file);
+  TIHex parsed;
+  parsed.load(file.begin(), file.end());
+  std::string expected = output(parsed);
+  if(!Check::that(ImageCache::save(parsed, ImageCache::path(source.path()), key), "cache is saved")) return;
+  std::string cache = readFile(ImageCache::path(source.path()));
+
+  TIHex cached;
+  Check::that(open(cached, source.path(), key, text), "valid cache is used");
+  Check::that(output(cached) == expected, "cached image writes the parsed text");
+
+  for(int round = 0; round < 30; round++){
+    std::string damaged = cache;
+    const char *what;
+    ImageCache::Key used = key;
+    switch(round % 3){
+      case 0:
+        damaged.resize(random.next() % cache.size());
+        what = "truncated cache falls back to parsing";
+        break;
+      case 1:
+        damaged[random.next() % damaged.size()] ^= 1 << (random.next() % 8);
+        what = "cache with a flipped byte falls back to parsing";
+        break;
+      default:
+        if(random.next() % 2) used.mtime++;
+        else used.hash ^= 1;
+        what = "stale cache falls back to parsing";
+    }
+    if(!Check::that(writeFile(ImageCache::path(source.path()), damaged.data(), damaged.size()), "cache is damaged")) return;
+    TIHex hex;
+    Check::that(!open(hex, source.path(), used, text) && output(hex) == expected, what);
+  }
+}
+
+int main(){
+  Check::Random random(15);
+  std::string small = Corpus(256 << 10, 15).text();
+  std::string large = Corpus(3 << 20, 16).text();
+  checkRoundTrip(small, random, 1);
+  checkRoundTrip(large, random, 4);
+  checkImported(random);
+  checkCache(small, random);
+  return Check::result();
+}
+
+#else
+
+int main(){
+  std::fprintf(stderr, "Cache files need POSIX file descriptors: nothing to check.\n");
+  return 0;
+}
+
+#endif
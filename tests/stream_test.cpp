@@ -0,0 +1,152 @@
+/**
+ * @file stream_test.cpp
+ * @brief TIHex::stream() against load(), apply() and write() of the same input: same text, same unwritten range.
+ */
+
+#include <cctype>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../PatchSet.h"
+#include "../TIHex.h"
+#include "../bench/Corpus.h"
+#include "Check.h"
+#include "ImageText.h"
+
+/* What an edit gives, streamed or not */
+struct Edited
+{
+    bool success;
+    TIHex::Error error;
+    TIHex::Range unwritten;
+    std::string text;
+};
+
+static Edited streamed(const std::string &text, const PatchSet &patches){
+  TIHex hex;
+  Edited edited = {false, TIHex::Error::None, {0, 0}, ""};
+  std::istringstream in(text);
+  std::ostringstream out;
+  edited.success = hex.stream(in, out, patches, &edited.unwritten);
+  edited.error = hex.error();
+  edited.text = out.str();
+  return edited;
+}
+
+static Edited applied(const std::string &text, const PatchSet &patches){
+  TIHex hex;
+  Edited edited = {false, TIHex::Error::None, {0, 0}, ""};
+  if(!Check::that(hex.load(text.data(), text.data() + text.size()), "test image loads")) return edited;
+  edited.success = hex.apply(patches, true, &edited.unwritten);
+  edited.error = hex.error();
+  std::ostringstream out;
+  hex.write(out);
+  edited.text = out.str();
+  return edited;
+}
+
+/* Same text with lower case digits and CRLF line ends on random lines, after some empty lines moving where 1 MiB
+   reads split it */
+static std::string variant(const std::string &text, Check::Random &random){
+  std::string result(random.next() % 4096, '\n');
+  result.reserve(text.size() + text.size() / 16);
+  bool lower = false, crlf = false;
+  for(char c : text){
+    if(c == ':'){
+      lower = random.next() % 4 == 0;
+      crlf = random.next() % 4 == 0;
+    }
+    if(c == '\n' && crlf) result += '\r';
+    result += lower ? static_cast<char>(std::tolower(static_cast<unsigned char>(c))) : c;
+  }
+  return result;
+}
+
+/* Random patches where the image has data, many of them longer than records */
+static PatchSet patchesIn(const std::vector<TIHex::Segment> &segments, Check::Random &random){
+  PatchSet patches;
+  unsigned count = 1 + random.next() % 64;
+  for(unsigned p = 0; p < count; p++){
+    const TIHex::Segment &segment = segments[random.next() % segments.size()];
+    uint64_t length = 1 + random.next() % (random.next() % 2 ? 8 : 600);
+    if(length > segment.length) length = segment.length;
+    std::vector<uint8_t> bytes(length);
+    for(auto &byte : bytes) byte = random.byte();
+    patches.add(segment.address + random.next() % (segment.length - length + 1), bytes.data(), bytes.size());
+  }
+  patches.sort();
+  return patches;
+}
+
+static void checkCorpus(Check::Random &random){
+  std::string canonical = Corpus(3 << 20, 11).text();
+  TIHex hex;
+  if(!Check::that(hex.load(canonical.data(), canonical.data() + canonical.size()), "corpus loads")) return;
+  std::vector<TIHex::Segment> segments = hex.segments();
+  for(int round = 0; round < 6; round++){
+    std::string text = round ? variant(canonical, random) : canonical;
+    PatchSet patches = round % 3 == 1 ? PatchSet() : patchesIn(segments, random);
+    Edited expected = applied(text, patches);
+    Edited edited = streamed(text, patches);
+    Check::that(expected.success && edited.success, "patches inside segments are written");
+    Check::that(edited.text == expected.text, "stream() writes the text of load(), apply() and write()");
+  }
+}
+
+/* Patches over gaps: stream() reports the first range without data as apply() does */
+static void checkGaps(Check::Random &random){
+  for(int round = 0; round < 200; round++){
+    ImageText::Bytes bytes;
+    uint64_t base = 0x0800F000 + random.next() % 0x1000;
+    for(uint64_t address = base; address < base + 0x2000;){
+      uint64_t length = 1 + random.next() % 300;
+      if(random.next() % 3) for(uint64_t a = address; a < address + length; a++) bytes[a] = random.byte();
+      address += length;
+    }
+    std::string text = ImageText::text(bytes, random);
+    PatchSet patches;
+    std::vector<uint8_t> data(400);
+    for(auto &byte : data) byte = random.byte();
+    unsigned count = 1 + random.next() % 4;
+    for(unsigned p = 0; p < count; p++) patches.add(base + random.next() % 0x2000, data.data(), 1 + random.next() % data.size());
+    patches.sort();
+
+    // First address without data, in patch order, and how many follow it.
+    TIHex::Range hole = {0, 0};
+    for(auto &patch : patches.patches()){
+      uint64_t a = patch.address;
+      while(a < patch.address + patch.length && bytes.count(a)) a++;
+      if(a == patch.address + patch.length) continue;
+      hole.address = a;
+      while(a < patch.address + patch.length && !bytes.count(a)) a++;
+      hole.length = a - hole.address;
+      break;
+    }
+    Edited expected = applied(text, patches);
+    Edited edited = streamed(text, patches);
+    if(!hole.length){
+      Check::that(edited.success && edited.text == expected.text, "stream() writes patches over data");
+      continue;
+    }
+    Check::that(!expected.success && expected.error == TIHex::Error::AddressNotFound &&
+                expected.unwritten.address == hole.address && expected.unwritten.length == hole.length,
+                "apply() reports the first range without data");
+    if(!Check::that(!edited.success && edited.error == TIHex::Error::AddressNotFound &&
+                    edited.unwritten.address == hole.address && edited.unwritten.length == hole.length,
+                    "stream() reports the first range without data")){
+      std::fprintf(stderr, "  unwritten 0x%llX+%llu, expected 0x%llX+%llu\n",
+                   static_cast<unsigned long long>(edited.unwritten.address),
+                   static_cast<unsigned long long>(edited.unwritten.length),
+                   static_cast<unsigned long long>(hole.address), static_cast<unsigned long long>(hole.length));
+    }
+  }
+}
+
+int main(){
+  Check::Random random(11);
+  checkCorpus(random);
+  checkGaps(random);
+  return Check::result();
+}
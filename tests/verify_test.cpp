@@ -0,0 +1,94 @@
+/**
+ * @file verify_test.cpp
+ * @brief TIHex::verify() on hand made lines, on every issue of a text, and against load() on corrupted images.
+ */
+
+#include <cctype>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../TIHex.h"
+#include "../bench/Corpus.h"
+#include "Check.h"
+
+/* One record with its checksum, plus a checksum adjustment to break it */
+static std::string record(uint8_t type, uint16_t address, std::vector<uint8_t> data, int checksumDelta = 0){
+  char line[600];
+  unsigned sum = data.size() + (address >> 8) + (address & 0xFF) + type;
+  int length = std::snprintf(line, sizeof line, ":%.2X%.4X%.2X", static_cast<unsigned>(data.size()), address, type);
+  for(uint8_t byte : data){
+    length += std::snprintf(line + length, sizeof line - length, "%.2X", byte);
+    sum += byte;
+  }
+  std::snprintf(line + length, sizeof line - length, "%.2X\n", (0x100 - (sum & 0xFF) + checksumDelta) & 0xFF);
+  return line;
+}
+
+static void expect(const std::string &text, TIHex::Error error, uint64_t line, const char *what){
+  TIHex hex;
+  bool valid = hex.verify(text.data(), text.data() + text.size());
+  bool passed = valid == (error == TIHex::Error::None) && hex.error() == error && (valid || hex.errorLine() == line);
+  if(!Check::that(passed, what)) std::fprintf(stderr, "  got %s on line %llu\n", hex.errorString().c_str(), (unsigned long long)hex.errorLine());
+}
+
+int main(){
+  const std::string end = ":00000001FF\n";
+  const std::string first = record(0x00, 0x0000, {0x11, 0x22});
+  expect(first + end, TIHex::Error::None, 0, "valid records");
+  expect("  " + first + "\r\n" + end, TIHex::Error::None, 0, "leading blanks, blank lines and CR line ends");
+  expect(first + record(0x00, 0x0002, {0x33}, 1) + end, TIHex::Error::Checksum, 2, "checksum");
+  expect(first + ":0100000011" + end, TIHex::Error::InvalidDataSize, 2, "missing data characters");
+  expect(first + ":0100000011EE00\n" + end, TIHex::Error::InvalidDataSize, 2, "extra characters after checksum");
+  expect(first + ":01000000G1EE\n" + end, TIHex::Error::Malformed, 2, "non hexadecimal data");
+  expect(first + "0100000011EE\n" + end, TIHex::Error::Malformed, 2, "missing start code");
+  expect(first + record(0x06, 0x0000, {}) + end, TIHex::Error::Malformed, 2, "unknown record type");
+  expect(first + record(0x04, 0x0000, {0x00}) + end, TIHex::Error::InvalidDataSize, 2, "byte count of an address record");
+  expect(first + record(0x01, 0x0000, {0x00}), TIHex::Error::InvalidDataSize, 2, "byte count of the end of file record");
+  expect(first + record(0x00, 0x0001, {0x44}) + end, TIHex::Error::AddressOrder, 2, "overlapping data records");
+  expect(first + record(0x04, 0x0000, {0x00, 0x01}) + record(0x00, 0x0000, {0x44}) + end, TIHex::Error::None, 0,
+         "Extended Linear Address moves on");
+  expect(first + record(0x04, 0x0000, {0x00, 0x01}, 1) + record(0x00, 0x0000, {0x44}) + end, TIHex::Error::Checksum, 2,
+         "addresses of records with bad checksums are still followed");
+
+  // Every issue, with its line and offset, not only the first one.
+  std::string text = first + record(0x00, 0x0002, {0x33}, 1) + "\n" + ":01000000G1EE\n" + record(0x00, 0x0000, {0x55}) + end;
+  std::vector<TIHex::Issue> issues;
+  TIHex hex;
+  Check::that(!hex.verify(text.data(), text.data() + text.size(), &issues), "issues make verify() fail");
+  Check::that(hex.error() == TIHex::Error::Checksum && hex.errorLine() == 2 && hex.errorOffset() == first.size(), "first issue is the error");
+  if(Check::that(issues.size() == 3, "every issue is listed")){
+    Check::that(issues[0].error == TIHex::Error::Checksum && issues[0].line == 2, "issue on line 2");
+    Check::that(issues[1].error == TIHex::Error::Malformed && issues[1].line == 4 && text.compare(issues[1].offset, 3, ":01") == 0, "issue on line 4");
+    Check::that(issues[2].error == TIHex::Error::AddressOrder && issues[2].line == 5, "issue on line 5");
+  }
+
+  // A synthetic image verifies, and single character changes verify only when load() reads the same bytes back.
+  std::string firmware = Corpus(64 << 10, 3).text();
+  Check::that(hex.verify(firmware.data(), firmware.data() + firmware.size()), "synthetic image verifies");
+  TIHex original;
+  original.load(firmware.data(), firmware.data() + firmware.size());
+  const auto segments = original.segments();
+  Check::Random random(17);
+  static const char replacements[] = "0123456789ABCDEFabcdef:G \r\n";
+  for(int round = 0; round < 3000; round++){
+    std::string changed = firmware;
+    size_t position = random.next() % changed.size();
+    changed[position] = replacements[random.next() % (sizeof replacements - 1)];
+    TIHex checked, loaded;
+    if(!checked.verify(changed.data(), changed.data() + changed.size())) continue;
+    bool same = loaded.load(changed.data(), changed.data() + changed.size()) && loaded.segments().size() == segments.size();
+    for(size_t s = 0; same && s < segments.size(); s++){
+      std::vector<uint8_t> expected(segments[s].length), got(segments[s].length);
+      original.read(segments[s].address, expected.data(), expected.size());
+      same = loaded.read(segments[s].address, got.data(), got.size()) && got == expected;
+    }
+    if(!Check::that(same || changed[position] == std::toupper(firmware[position]) || std::toupper(changed[position]) == firmware[position] ||
+                    changed[position] == ' ' || changed[position] == '\r' || changed[position] == '\n',
+                    "a verified change keeps the image, unless it only changes case or blanks")){
+      std::fprintf(stderr, "  offset %zu: '%c' instead of '%c'\n", position, changed[position], firmware[position]);
+      break;
+    }
+  }
+  return Check::result();
+}